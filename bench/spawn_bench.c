@@ -0,0 +1,100 @@
+// Spawn benchmark: latency of starting /bin/true from a process with a large
+// heap, with fork() from the big process and through the zygote forked
+// before the heap grew.
+//
+//   make bench && ./build/bench/spawn_bench [heap_mb] [runs]
+
+#define _GNU_SOURCE
+
+#include "zygote.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, double *t, int runs) {
+    qsort(t, runs, sizeof(double), cmp_double);
+    printf("%-16s p50 %8.1f us   p99 %8.1f us\n",
+           name, t[runs / 2], t[(runs * 99) / 100]);
+}
+
+int main(int argc, char **argv) {
+    size_t heap_mb = argc > 1 ? strtoul(argv[1], NULL, 10) : 500;
+    int runs = argc > 2 ? atoi(argv[2]) : 200;
+    if (runs <= 0) {
+        fprintf(stderr, "usage: spawn_bench [heap_mb] [runs]\n");
+        return 2;
+    }
+
+    if (zygote_start() != 0) {
+        perror("zygote_start");
+        return 1;
+    }
+
+    // Touch every page so fork has the whole heap to copy page tables for
+    size_t size = heap_mb << 20;
+    char *heap = malloc(size ? size : 1);
+    if (!heap) {
+        perror("malloc");
+        return 1;
+    }
+    memset(heap, 1, size);
+
+    char *args[] = {"/bin/true", NULL};
+    RedirPlan plan;
+    redir_plan_init(&plan, STDIN_FILENO, STDOUT_FILENO);
+    double *spawn = malloc(runs * sizeof(double));
+    double *total = malloc(runs * sizeof(double));
+    if (!spawn || !total) return 1;
+    printf("%d runs, %zu MB heap\n", runs, heap_mb);
+
+    for (int i = 0; i < runs; i++) {
+        double start = now_us();
+        pid_t pid = fork();
+        if (pid == 0) {
+            execv(args[0], args);
+            _exit(127);
+        }
+        spawn[i] = now_us() - start;
+        waitpid(pid, NULL, 0);
+        total[i] = now_us() - start;
+    }
+    report("fork spawn", spawn, runs);
+    report("fork total", total, runs);
+
+    for (int i = 0; i < runs; i++) {
+        double start = now_us();
+        pid_t pid = zygote_spawn(args, &plan, -1, 0);
+        spawn[i] = now_us() - start;
+        if (pid <= 0) {
+            fprintf(stderr, "spawn_bench: zygote spawn failed\n");
+            return 1;
+        }
+        int wstatus;
+        while (zygote_next_exit(&wstatus, 1) != pid) {
+        }
+        total[i] = now_us() - start;
+    }
+    report("zygote spawn", spawn, runs);
+    report("zygote total", total, runs);
+
+    zygote_stop();
+    free(spawn);
+    free(total);
+    free(heap);
+    return 0;
+}
@@ -0,0 +1,118 @@
+// Startup benchmark: times `minibash -c true` with no rc file, with a large
+// rc file parsed on every launch, and with the same rc file loaded from its
+// snapshot.
+//
+//   make bench && ./build/bench/startup_bench [./minibash] [runs] [lines]
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double run_once(const char *shell, int norc) {
+    double start = now_us();
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (norc) {
+            execl(shell, shell, "--norc", "-c", "true", (char *)NULL);
+        } else {
+            execl(shell, shell, "-c", "true", (char *)NULL);
+        }
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "startup_bench: %s failed\n", shell);
+        exit(1);
+    }
+    return now_us() - start;
+}
+
+static void report(const char *name, const char *shell, int norc, int runs) {
+    double *t = malloc(runs * sizeof(double));
+    if (!t) exit(1);
+    run_once(shell, norc);
+    for (int i = 0; i < runs; i++) {
+        t[i] = run_once(shell, norc);
+    }
+    qsort(t, runs, sizeof(double), cmp_double);
+    printf("%-10s p50 %8.1f us   p99 %8.1f us\n",
+           name, t[runs / 2], t[(runs * 99) / 100]);
+    free(t);
+}
+
+int main(int argc, char **argv) {
+    const char *shell = argc > 1 ? argv[1] : "./minibash";
+    int runs = argc > 2 ? atoi(argv[2]) : 200;
+    int lines = argc > 3 ? atoi(argv[3]) : 500;
+    if (runs <= 0 || lines <= 0) {
+        fprintf(stderr, "usage: startup_bench [shell] [runs] [lines]\n");
+        return 2;
+    }
+
+    char shell_path[4096];
+    if (!realpath(shell, shell_path)) {
+        perror(shell);
+        return 1;
+    }
+
+    char dir[] = "/tmp/minibash-bench-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char rc[4096], snap[4096];
+    snprintf(rc, sizeof(rc), "%s/.minibashrc", dir);
+    snprintf(snap, sizeof(snap), "%s/.minibashrc.snap", dir);
+
+    FILE *f = fopen(rc, "w");
+    if (!f) {
+        perror(rc);
+        return 1;
+    }
+    for (int i = 0; i < lines; i++) {
+        if (i % 2) {
+            fprintf(f, "export BENCH_VAR_%d=/opt/bench/%d/bin\n", i, i);
+        } else {
+            fprintf(f, "alias bench_alias_%d='ls -la /tmp/%d'\n", i, i);
+        }
+    }
+    fclose(f);
+
+    setenv("HOME", dir, 1);
+    unsetenv("MINIBASHRC");
+    printf("%d runs, rc with %d lines\n", runs, lines);
+
+    report("norc", shell_path, 1, runs);
+
+    setenv("MINIBASH_SNAPSHOT", "0", 1);
+    report("rc parse", shell_path, 0, runs);
+
+    unsetenv("MINIBASH_SNAPSHOT");
+    run_once(shell_path, 0);
+    if (access(snap, R_OK) != 0) {
+        fprintf(stderr, "startup_bench: no snapshot written\n");
+    }
+    report("snapshot", shell_path, 0, runs);
+
+    unlink(snap);
+    unlink(rc);
+    rmdir(dir);
+    return 0;
+}
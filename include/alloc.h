@@ -0,0 +1,42 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include "outbuf.h"
+
+#include <stddef.h>
+
+// Subsystems the shell's own allocations are charged to
+typedef enum {
+    ALLOC_PARSER,
+    ALLOC_EXECUTOR,
+    ALLOC_COMPLETION,
+    ALLOC_HISTORY,
+    ALLOC_VARS,
+    ALLOC_EDITOR,
+    ALLOC_TAGS
+} AllocTag;
+
+// Turn profiling on if MINIBASH_ALLOC_PROFILE=1. Must run before the first
+// tagged allocation. Off, the wrappers below are plain libc calls.
+void alloc_init(void);
+int alloc_profiling(void);
+
+// Tagged allocation. Profiling records each live block with its tag and
+// call site; xfree accepts any heap pointer, tracked or not.
+#define xmalloc(tag, n) alloc_malloc((tag), (n), __FILE__, __LINE__)
+#define xcalloc(tag, n, size) alloc_calloc((tag), (n), (size), __FILE__, __LINE__)
+#define xrealloc(tag, p, n) alloc_realloc((tag), (p), (n), __FILE__, __LINE__)
+#define xstrdup(tag, s) alloc_strndup((tag), (s), (size_t)-1, __FILE__, __LINE__)
+#define xstrndup(tag, s, n) alloc_strndup((tag), (s), (n), __FILE__, __LINE__)
+void xfree(void *p);
+
+void *alloc_malloc(AllocTag tag, size_t n, const char *file, int line);
+void *alloc_calloc(AllocTag tag, size_t n, size_t size, const char *file, int line);
+void *alloc_realloc(AllocTag tag, void *p, size_t n, const char *file, int line);
+char *alloc_strndup(AllocTag tag, const char *s, size_t n, const char *file, int line);
+
+// Per-subsystem counts, and with sites the live blocks grouped by where
+// they were allocated. Returns -1 if profiling is off.
+int alloc_report(OutBuf *out, int sites);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef ARITH_H
+#define ARITH_H
+
+#include "command.h"
+
+// Shell arithmetic, as in $((...)) and ((...)): 64-bit integers with the C
+// operators plus **. A name is a variable, read from and assigned to the
+// variable store directly; unset or empty it is 0, and a value that is not a
+// number is evaluated as an expression itself. Each expression is compiled
+// once into a postfix program kept in a cache keyed on its text, so running
+// the same text again only interprets the program.
+
+// Evaluate expr into *result. Returns -1 after reporting an error.
+int arith_eval(const char *expr, long long *result);
+
+// ((expr)) as a command. Returns -1 if cmd is not one, else 0 if expr is
+// nonzero and 1 if it is zero or could not be evaluated.
+int arith_command(const Command *cmd);
+
+void arith_cleanup(void);
+
+#endif
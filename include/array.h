@@ -0,0 +1,59 @@
+#ifndef ARRAY_H
+#define ARRAY_H
+
+#include "command.h"
+#include "outbuf.h"
+
+#include <stddef.h>
+
+// Array variables, kept apart from the flat string variables. Each array
+// packs its strings into one text buffer. An indexed array holds their
+// offsets in one vector; an associative array keeps its entries in
+// insertion order in a vector, found through an open-addressing table of
+// entry numbers. Strings handed out stay valid until the array changes.
+
+typedef struct {
+    const struct Array *array;
+    size_t pos;
+} ArrayIter;
+
+// Element sub of array name; NULL if either is unset. Indexed subscripts
+// are numbers (negative ones count from the end) or names of variables
+// holding one.
+const char *array_get(const char *name, const char *sub);
+
+// Set element sub of name, making name an indexed array if it is not an
+// array yet. Indexed storage is dense, so an index may not leave more
+// unset slots past the end than the larger of 4096 and the number of
+// elements set. Returns -1 after reporting an error.
+int array_set(const char *name, const char *sub, const char *value);
+
+// Returns -1 if there is no such array or element
+int array_unset(const char *name);
+int array_unset_element(const char *name, const char *sub);
+
+// Number of elements set, or -1 if name is not an array
+long array_count(const char *name);
+
+// Walk the elements in order: indexed by index, associative by insertion.
+// array_iter returns -1 if name is not an array. array_next returns 0 at
+// the end; an indexed key is formatted into num.
+int array_iter(const char *name, ArrayIter *it);
+int array_next(ArrayIter *it, const char **key, const char **value, char *num, size_t num_size);
+
+// name=(word...), name+=(word...) and name[sub]=value, which take no
+// redirections. Returns -1 if cmd is not an assignment, else its status.
+int array_assignment(const Command *cmd);
+
+// Builtin: declare [-a|-A|-p] [name...] [name=(word...)]
+int builtin_declare(OutBuf *out, OutBuf *err, int argc, char **argv);
+
+// Builtin: mapfile [-t] [-n count] [-s count] [name], also readarray
+// Replaces the indexed array name (MAPFILE by default) with the lines of
+// stdin, which is read in large blocks and split with memchr. -t drops the
+// newlines, -s skips the first count lines and -n keeps at most count.
+int builtin_mapfile(int argc, char **argv);
+
+void array_cleanup(void);
+
+#endif
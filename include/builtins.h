@@ -2,10 +2,12 @@
 #define BUILTINS_H
 
 #include "command.h"
+#include "outbuf.h"
 
 typedef struct {
     char **names;
     char **values;
+    unsigned char *exported;
     int count;
     int cap;
 } EnvironmentVars;
@@ -23,9 +25,31 @@ int builtins_init(void);
 // Check if a command is a builtin
 int is_builtin(const char *cmd);
 
+// Where a builtin writes: buffers bound to the descriptors its stdout and
+// stderr resolve to (-1 if closed), handed out in large writes. Redirecting
+// a builtin run in the shell then needs no dup2 and no restore.
+typedef struct {
+    OutBuf out;
+    OutBuf err;
+    int error;      // errno of the first failed write to out
+} BuiltinIO;
+
+// Whether a builtin needs its redirections installed on 0, 1 and 2 because
+// it reads stdin or starts commands that inherit them
+int builtin_needs_fds(const char *cmd);
+
+// Whether a builtin ending a pipeline may run in the shell itself: it only
+// reads and writes data, or stores what it reads (mapfile). Builtins that
+// change the shell's state, such as cd, exit or set, run in a child there.
+int builtin_is_filter(const char *cmd);
+
 // Execute a builtin command, returns exit code
 int execute_builtin(const char *cmd, int argc, char **argv);
 
+// Execute a builtin that does not need its fds installed, writing to out_fd
+// and err_fd directly
+int execute_builtin_io(const char *cmd, int argc, char **argv, int out_fd, int err_fd);
+
 // Get current working directory
 const char *get_cwd(void);
 
@@ -42,6 +66,15 @@ int unset_alias(const char *name);
 // Export variable to environment
 int export_var(const char *name, const char *value);
 
+// Add entries without checking for an existing one; for bulk loading names
+// known to be new
+int append_var(const char *name, const char *value, int exported);
+int append_alias(const char *name, const char *cmd);
+
+// Read-only views of the variable and alias tables
+const EnvironmentVars *get_vars(void);
+const Aliases *get_aliases(void);
+
 // Cleanup
 void builtins_cleanup(void);
 
@@ -1,26 +1,59 @@
 #ifndef COMMAND_H
 #define COMMAND_H
 
+#include "arena.h"
+
 #include <stddef.h>
 
 #define MAX_ARGS 128
 #define MAX_CMDS 16
+#define MAX_REDIRS 16
+#define MAX_PROCSUBS 8
 
 typedef enum OutputType {
     OUTPUT_NONE,
-    OUTPUT_PIPE,
-    OUTPUT_REDIRECT,
-    OUTPUT_REDIRECT_APPEND
+    OUTPUT_PIPE
 } OutputType;
 
+typedef enum RedirType {
+    REDIR_IN,       // N< path
+    REDIR_OUT,      // N> path
+    REDIR_APPEND,   // N>> path
+    REDIR_HEREDOC,  // N<< delimiter
+    REDIR_DUP,      // N>&M, N<&M
+    REDIR_CLOSE     // N>&-, N<&-
+} RedirType;
+
+// One redirection, applied left to right. &> path is stored as 1> path
+// followed by 2>&1.
+typedef struct Redir {
+    RedirType type;
+    int fd;
+    int src_fd;     // REDIR_DUP
+    char *path;     // file name or heredoc delimiter
+} Redir;
+
+// <(line) or >(line): line runs with its stdout (stdin for >) on a pipe,
+// and the word becomes /dev/fd/N for the other end
+typedef struct ProcSub {
+    char *line;
+    int output;     // >(...)
+    int arg;        // index in args, or -1
+    int redir;      // index in redirs, or -1
+} ProcSub;
+
 typedef struct Command {
     char *name;
     char **args;
     int argc;
+    // The MAX_ARGS array args is parsed into; expansion may move args to a
+    // larger one
+    char **arg_store;
     OutputType output_type;
-    char *redirect_path;
-    char *input_path;
-    char *heredoc_delim;
+    Redir redirs[MAX_REDIRS];
+    int nredirs;
+    ProcSub subs[MAX_PROCSUBS];
+    int nsubs;
 } Command;
 
 typedef struct Pipeline {
@@ -28,9 +61,35 @@ typedef struct Pipeline {
     int count;
 } Pipeline;
 
+// A parsed command stored at its actual size, for parsed text that is kept
+// (function bodies, sourced scripts). Words still point into the text.
+typedef struct PackedCommand {
+    char **args;        // argc + 1, NULL-terminated
+    Redir *redirs;
+    ProcSub *subs;
+    int argc;
+    int nredirs;
+    int nsubs;
+    OutputType output_type;
+} PackedCommand;
+
+typedef struct PackedPipeline {
+    PackedCommand *cmds;
+    int count;
+} PackedPipeline;
+
 void init_command(Command *cmd);
 void free_command(Command *cmd);
 void init_pipeline(Pipeline *pipeline);
 void free_pipeline(Pipeline *pipeline);
+// Empty a pipeline set up by init_pipeline, keeping its argument arrays
+void reset_pipeline(Pipeline *pipeline);
+
+// Copy src into arena. Returns -1 when out of memory.
+int pack_pipeline(PackedPipeline *dst, const Pipeline *src, Arena *arena);
+// Rebuild a pipeline that can be run (and rewritten) from src; args[i]
+// holds MAX_ARGS pointers for stage i, allocated from arena when NULL.
+// Returns -1 when out of memory.
+int unpack_pipeline(Pipeline *dst, char **args[], const PackedPipeline *src, Arena *arena);
 
 #endif
@@ -1,12 +1,43 @@
 #ifndef COMPLETION_H
 #define COMPLETION_H
 
+#include "arena.h"
+
+struct ExecIndex;
+
+// Flags for completion_find() and completion_start()
+#define COMPLETE_FUZZY 1    // subsequence matching, ranked by score
+
 typedef struct Completion {
-    char **matches;
+    // Views into the executable index or into strings
+    const char **matches;
     int count;
+    int cap;
+    Arena strings;
+    struct ExecIndex *index;
+    int shared;     // still being filled by the worker
+    int flags;
+    int *scores;    // fuzzy rank of each match while collecting
 } Completion;
 
-Completion *completion_find(const char *prefix);
+Completion *completion_find(const char *prefix, int flags);
 void completion_free(Completion *c);
 
+// Build the executable index for path, or rebuild it if stale
+int completion_refresh_index(const char *path);
+// Whether name is an executable on path according to the executable index:
+// 1 if it is, 0 if not, -1 if no fresh index has been built yet
+int completion_has_command(const char *path, const char *name);
+
+// Background completion. A worker thread runs one request at a time and
+// signals completion_notify_fd() as it finishes; starting a new request or
+// calling completion_cancel() abandons the one in flight.
+int completion_start(const char *prefix, int flags);
+int completion_notify_fd(void);
+void completion_cancel(void);
+// Result of the current request once the notify fd fired, else NULL
+Completion *completion_take(void);
+// Copy of the matches found so far by the current request
+Completion *completion_snapshot(void);
+
 #endif
@@ -6,7 +6,17 @@
 // Executes the parsed pipeline. Returns the exit status of the last command (like $?).
 int execute_commands(Pipeline *pipeline);
 
-// Build a heredoc file descriptor from delimiter
-int build_heredoc_fd(const char *delim);
+// Status of the last pipeline run ($?)
+int execute_last_status(void);
+
+// Record the status of a statement that is not run through
+// execute_commands, such as a function definition
+void execute_set_last_status(int status);
+
+// Set by the exit builtin. Function bodies, sourced files and the line
+// being run stop at the next statement, and the shell exits through its
+// normal cleanup with the last status.
+void execute_request_exit(void);
+int execute_exiting(void);
 
 #endif
@@ -0,0 +1,17 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include "arena.h"
+#include "command.h"
+
+// Evaluates each $((expr)), then replaces $name, ${name}, $0..$9, ${N}, $#,
+// $@, $*, $?, ${#name} and the array forms ${a[sub]}, ${a[@]}, ${#a[@]} and
+// ${!a[@]} in the arguments and redirection targets of every stage, with
+// new words taken from arena. A word that is exactly $@, $*, ${a[@]} or
+// ${!a[@]} becomes one word per parameter, element or key; a word that
+// expands to nothing is dropped.
+// Heredoc delimiters and process substitutions are left alone.
+// Returns -1 after reporting an error.
+int expand_pipeline(Pipeline *pipeline, Arena *arena);
+
+#endif
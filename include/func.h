@@ -0,0 +1,46 @@
+#ifndef FUNC_H
+#define FUNC_H
+
+#include <stddef.h>
+
+// Shell functions: name() { list; }. The body is parsed once, when the
+// function is defined, into packed pipelines kept in a hashed table; each
+// call runs copies of them without tokenizing the text again.
+
+// Recognizes a definition at the start of text. Returns 1 once it is
+// defined, with *used set to the length it took up; 0 if text is not a
+// definition; 2 if the closing brace has not arrived yet; -1 after
+// reporting an error, with *used covering the bad definition.
+int func_define(char *text, size_t *used);
+
+int func_exists(const char *name);
+int func_unset(const char *name);
+
+// Run function name with argv[1..argc) as $1..$N; returns its status
+int func_call(const char *name, int argc, char **argv);
+
+// Positional parameters of the innermost call; $0 is the shell
+int func_argc(void);
+const char *func_arg(int n);
+
+// Make name local to the innermost call, its old value coming back on
+// return. Returns -1 outside a function.
+int func_local(const char *name, const char *value);
+
+// Make the innermost call or sourced script return status once its current
+// pipeline is done. Returns -1 outside both.
+int func_return(int status);
+
+// Whether return was used in the innermost call or sourced script
+int func_returning(void);
+
+// Bracket running a sourced script: argv[0] is the script, argv[1..argc)
+// become $1..$N (with none, the caller's stay). Enter returns -1 after
+// reporting too deep a nesting; leave returns the status given to return,
+// or status if there was none.
+int func_enter_source(int argc, char **argv);
+int func_leave_source(int status);
+
+void func_cleanup(void);
+
+#endif
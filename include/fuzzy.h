@@ -0,0 +1,22 @@
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include <stdint.h>
+
+// Fuzzy subsequence matching for completion ("gco" matches "git-checkout").
+// Matching is case-insensitive.
+
+// Bitmask of the character classes present in s: one bit per letter, digit
+// and a few punctuation groups. A candidate can only match a query whose
+// mask is a subset of its own.
+uint64_t fuzzy_mask(const char *s);
+
+// Store in out[] the indexes i in [0, n) with masks[i] containing every bit
+// of need, returning how many there are. Vectorized where the CPU allows.
+int fuzzy_prefilter(const uint64_t *masks, int n, uint64_t need, int *out);
+
+// Score of query as a subsequence of cand, higher is better; -1 if it does
+// not match. Word boundaries and contiguous runs earn bonuses, gaps cost.
+int fuzzy_score(const char *query, const char *cand);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef GAPBUF_H
+#define GAPBUF_H
+
+#include <stddef.h>
+
+// Gap buffer holding the line being edited. The gap sits at the cursor, so
+// inserting or deleting there is O(1) amortized; moving the cursor costs the
+// distance moved.
+typedef struct GapBuf {
+    char *data;
+    size_t cap;
+    size_t gap_start;   // == cursor position
+    size_t gap_end;
+} GapBuf;
+
+int gapbuf_init(GapBuf *gb, size_t cap);
+void gapbuf_free(GapBuf *gb);
+
+static inline size_t gapbuf_len(const GapBuf *gb) {
+    return gb->cap - (gb->gap_end - gb->gap_start);
+}
+
+static inline size_t gapbuf_cursor(const GapBuf *gb) {
+    return gb->gap_start;
+}
+
+// Byte at logical index i (i < gapbuf_len)
+static inline char gapbuf_at(const GapBuf *gb, size_t i) {
+    return i < gb->gap_start ? gb->data[i] : gb->data[i + (gb->gap_end - gb->gap_start)];
+}
+
+// Text after the cursor is data[gap_end..cap)
+static inline const char *gapbuf_tail(const GapBuf *gb, size_t *len) {
+    *len = gb->cap - gb->gap_end;
+    return gb->data + gb->gap_end;
+}
+
+void gapbuf_move_to(GapBuf *gb, size_t pos);
+int gapbuf_insert(GapBuf *gb, const char *s, size_t n);
+// Delete up to n bytes before/after the cursor, returns the number deleted
+size_t gapbuf_delete_back(GapBuf *gb, size_t n);
+size_t gapbuf_delete_forward(GapBuf *gb, size_t n);
+// Replace the whole contents, leaving the cursor at the end
+int gapbuf_set(GapBuf *gb, const char *s, size_t n);
+// Copy logical range [from, to) into dst (not NUL-terminated)
+void gapbuf_copy(const GapBuf *gb, size_t from, size_t to, char *dst);
+
+// NUL-terminated text before the cursor; valid until the next modification
+const char *gapbuf_head(GapBuf *gb);
+// Hand the contents over as a NUL-terminated malloc'd string and reset
+char *gapbuf_detach(GapBuf *gb, size_t *len);
+
+#endif
@@ -10,4 +10,10 @@ void line_editor_destroy(LineEditor *ed);
 // Returns length read, -1 on EOF or error. Allocates *out_line; caller frees.
 int line_editor_read(LineEditor *ed, const char *prompt, char **out_line);
 
+// Optional source of asynchronous prompt updates. While a line is being read
+// and fd becomes readable, refresh(ctx) is called and the prompt it returns
+// replaces the current one in place.
+typedef const char *(*PromptRefresh)(void *ctx);
+void line_editor_set_prompt_hook(LineEditor *ed, int fd, PromptRefresh refresh, void *ctx);
+
 #endif
@@ -0,0 +1,28 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stddef.h>
+
+// Growable output buffer bound to a file descriptor. Output is accumulated in
+// memory and handed to the kernel in a single write when flushed.
+typedef struct OutBuf {
+    int fd;
+    char *data;
+    size_t len;
+    size_t cap;
+} OutBuf;
+
+void outbuf_init(OutBuf *ob, int fd);
+void outbuf_free(OutBuf *ob);
+
+void outbuf_append(OutBuf *ob, const char *s, size_t n);
+void outbuf_puts(OutBuf *ob, const char *s);
+void outbuf_printf(OutBuf *ob, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+// Append n copies of c. Returns 0, or -1 if they could neither be buffered
+// nor written.
+int outbuf_pad(OutBuf *ob, char c, size_t n);
+
+// Write out everything buffered. Returns 0 on success, -1 on error.
+int outbuf_flush(OutBuf *ob);
+
+#endif
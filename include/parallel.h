@@ -0,0 +1,12 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Builtin: parallel [-j jobs] [-0] command [args...] [::: inputs...]
+// Runs command once per input (the ::: list, else lines of stdin, or
+// NUL-separated records with -0), substituting {} in the arguments or
+// appending the input when there is no {}. Up to jobs commands run at once;
+// each job's stdout and stderr are captured and written out in input order.
+// Returns the number of failed jobs, at most 101.
+int builtin_parallel(int argc, char **argv);
+
+#endif
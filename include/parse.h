@@ -7,4 +7,16 @@
 // Returns 1 on success, 0 for empty line, -1 on error (already reported).
 int parse_line(char *line, Pipeline *pipeline);
 
+// Like parse_line, into a pipeline already set up by an earlier parse_line
+// (or init_pipeline), reusing its argument arrays
+int parse_line_again(char *line, Pipeline *pipeline);
+
+// Where the text being parsed and run comes from, for messages; file is
+// NULL for typed input and -c. Errors about it then start with file:line.
+void parse_set_location(const char *file, int line);
+void parse_get_location(const char **file, int *line);
+// Start an error message: "minibash: file:line: ", or just "minibash: "
+// when there is no location
+void parse_error_prefix(void);
+
 #endif
@@ -0,0 +1,33 @@
+#ifndef PIN_H
+#define PIN_H
+
+#include "command.h"
+
+#include <sched.h>
+
+// Placement of a pipeline's stages, from a leading
+//     pin [-n nice] [-b] [auto | cpulist[:cpulist...]] command | ...
+// on its first stage, before or after a timeout prefix. auto (the default)
+// keeps adjacent stages on cores sharing a last-level cache, per
+// /sys/devices/system/cpu: one core each when the cache domain has enough,
+// else the whole domain for all of them. Successive pipelines go to
+// successive domains. Explicit lists are given per stage, the last one
+// covering the stages after it. -n adds to the stages' nice value and -b
+// runs them under SCHED_BATCH. Stages run in the shell itself are not
+// placed.
+typedef struct {
+    int active;
+    cpu_set_t cpus[MAX_CMDS];
+    int nice;
+    int batch;
+} PinPlan;
+
+// Strip a pin prefix from the first stage into plan. Returns -1 after
+// reporting a usage error.
+int pin_take(Pipeline *pipeline, PinPlan *plan);
+
+// Apply plan to stage in its child, before exec. Failures are reported and
+// the stage runs anyway.
+void pin_apply(const PinPlan *plan, int stage);
+
+#endif
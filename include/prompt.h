@@ -0,0 +1,25 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+
+// Prompt engine. The prompt is a template taken from $PS1 (compiled once and
+// recompiled only when it changes) with these directives:
+//   %n  shell name          %w  working directory    %W  its last component
+//   %g  git branch          %s  last exit status     %?  status color
+//   %F{N}  256-color fg     %f  reset attributes     %%  a literal '%'
+//   %{ ... %}  group shown only if every segment inside has a value
+// Expensive segments (git) are computed on a background thread. The prompt
+// waits at most a per-segment budget for them, then draws with the cached
+// value or without the segment; late results are announced on
+// prompt_notify_fd() so the prompt can be redrawn in place.
+
+int prompt_init(void);
+void prompt_cleanup(void);
+
+// Render the prompt for the given exit status. The returned buffer is owned
+// by the engine and rewritten by the next call.
+const char *prompt_render(int last_status);
+// Re-render with the last status after a background segment resolved
+const char *prompt_refresh(void);
+int prompt_notify_fd(void);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef RC_H
+#define RC_H
+
+// Startup file. The rc file is $MINIBASHRC, or ~/.minibashrc when unset.
+// Its lines run through the given callback at startup. When every line only
+// sets variables or aliases, the resulting tables are also written to a
+// binary snapshot ($MINIBASH_SNAPSHOT, default "<rc>.snap"; empty or "0"
+// disables it). The snapshot is mmap'd on later startups and applied
+// directly, without parsing, as long as the rc file's mtime, size and hash
+// still match the ones recorded in it.
+
+typedef int (*RcRunLine)(char *line);
+
+// Returns 0 when there is no rc file or it was loaded, -1 on read errors
+int rc_load(RcRunLine run);
+
+#endif
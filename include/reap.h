@@ -0,0 +1,33 @@
+#ifndef REAP_H
+#define REAP_H
+
+#include <sys/types.h>
+
+// Deadline for a pipeline. With timeout_ms > 0 the stages must share the
+// process group pgid: once the deadline passes the group gets SIGTERM, and
+// SIGKILL kill_ms later if anything is still running.
+typedef struct {
+    long timeout_ms;
+    long kill_ms;
+    pid_t pgid;
+    int zygote;     // stages are children of the zygote, not of the shell
+    int helpers;    // trailing pids that are not stages (process substitutions)
+} ReapLimits;
+
+#define REAP_TIMED_OUT 124
+#define REAP_KILLED (128 + 9)   // still running kill_ms past the deadline
+
+// pidfd for a child, readable once it exits; -1 where the kernel has none
+int reap_pidfd(pid_t pid);
+
+// Waits for every stage in one epoll loop over per-child pidfds, or over the
+// zygote's socket for stages it spawned, plus a timerfd for the deadline.
+// pids[i] <= 0 marks a stage that was not spawned; names[i] is used to
+// report stages still running at the deadline.
+// Helpers are waited for too but do not set the status. Returns the exit
+// status of the last stage, REAP_TIMED_OUT, or REAP_KILLED if SIGKILL had
+// to be sent.
+int reap_pipeline(const pid_t *pids, const char *const *names, int n,
+                  const ReapLimits *limits);
+
+#endif
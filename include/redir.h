@@ -0,0 +1,63 @@
+#ifndef REDIR_H
+#define REDIR_H
+
+#include "command.h"
+
+#define REDIR_SLOTS 16
+
+// What descriptor target becomes in a stage: a copy of the shell's source,
+// or closed when source is -1
+typedef struct {
+    int target;
+    int source;
+    int cloexec;    // source has FD_CLOEXEC, which must go if target == source
+} RedirSlot;
+
+// A stage's descriptor table relative to the shell's, worked out in the
+// shell before the stage starts. Files and heredocs are opened there with
+// O_CLOEXEC, so a child needs only the dup2 calls and nothing else open
+// leaks into what it execs.
+typedef struct {
+    RedirSlot slots[REDIR_SLOTS];
+    int nslots;
+    int owned[REDIR_SLOTS];     // opened for the plan; closed by redir_release
+    int nowned;
+} RedirPlan;
+
+// Descriptors replaced by redir_push, to put back with redir_pop
+typedef struct {
+    int target[REDIR_SLOTS];
+    int saved[REDIR_SLOTS];     // -1: target was closed
+    int cloexec[REDIR_SLOTS];
+    int count;
+} RedirSaved;
+
+// Start a plan with stdin, stdout and stderr taken from in_fd, out_fd and 2
+void redir_plan_init(RedirPlan *plan, int in_fd, int out_fd);
+
+// Add cmd's redirections, opening their files. Returns -1 after reporting
+// an error, with everything the plan opened closed again.
+int redir_plan_command(RedirPlan *plan, const Command *cmd);
+
+// Pass the shell's fd through to the stage under the same number, for a
+// /dev/fd/N path the stage is given. Returns -1 if the plan is full.
+int redir_plan_keep(RedirPlan *plan, int fd);
+
+// The shell descriptor target is a copy of in the stage; -1 if closed
+int redir_plan_source(const RedirPlan *plan, int target);
+
+// Install the plan in a child about to exec. Returns -1 on failure.
+int redir_apply(const RedirPlan *plan);
+
+// Install the plan in the shell itself, saving what it replaces
+int redir_push(const RedirPlan *plan, RedirSaved *saved);
+void redir_pop(RedirSaved *saved);
+
+// Close the descriptors the plan opened
+void redir_release(RedirPlan *plan);
+
+// Read a heredoc up to delim from stdin; returns the read end of a pipe
+// holding it, or -1
+int build_heredoc_fd(const char *delim);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "gapbuf.h"
+#include "outbuf.h"
+
+// Terminal renderer for the line editor. Each frame is composed in one output
+// buffer and flushed with a single write; only the part of the line that
+// changed since the previous frame is sent.
+typedef struct Renderer {
+    OutBuf out;
+    const char *prompt;
+    int prompt_width;
+    // What is currently on screen after the prompt
+    char *shown;
+    int shown_len;
+    int shown_cap;
+    int shown_pos;
+    // Dimmed suggestion drawn after the line
+    char *hint;
+    int hint_len;
+    int hint_cap;
+    int valid;
+    // Row of the terminal cursor, counted from the prompt's first row
+    int cursor_row;
+} Renderer;
+
+void render_init(Renderer *r, int fd);
+void render_free(Renderer *r);
+
+// Start a new input line: draws the prompt and resets the frame state
+void render_begin(Renderer *r, const char *prompt);
+// Swap the prompt; the next render_line redraws the whole line
+void render_set_prompt(Renderer *r, const char *prompt);
+// Bring the screen in line with the buffer and put the cursor where its
+// cursor is. A non-NULL hint is drawn dimmed after the text.
+void render_line(Renderer *r, const GapBuf *gb, const char *hint);
+// Forget the on-screen state so the next render_line redraws everything,
+// starting on the row the cursor is on
+void render_invalidate(Renderer *r);
+// Move the cursor to the end of what is shown, so output that follows goes
+// below every row of the line
+void render_finish(Renderer *r);
+
+// Cached terminal size, refreshed on SIGWINCH
+void render_term_size(int *cols, int *rows);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+// Command server. One warm shell process listens on a Unix domain socket and
+// runs each request in a child forked from it, so the rc file, the
+// executable index and other caches are paid for once.
+//
+// Request: a uint32_t length followed by that many bytes of command line,
+// with the client's stdin, stdout and stderr passed alongside the length as
+// SCM_RIGHTS. Reply: the int32_t exit status once the command finished.
+
+// Serve until the process is killed; returns 1 if the socket cannot be set up
+int server_run(const char *sock_path);
+
+// Run command on the server at sock_path with this process's stdio.
+// Returns its exit status, or 127 if the request could not be made.
+int server_request(const char *sock_path, const char *command);
+
+#endif
@@ -1,6 +1,15 @@
 #ifndef SHELL_H
 #define SHELL_H
 
-void shell_loop(void);
+// Set up shell state, running the rc file unless load_rc is 0
+int shell_init(int load_rc);
+void shell_cleanup(void);
+
+// Runs one input line (commands separated by ';'); modifies line.
+// Returns the status of the last command.
+int shell_run_line(char *line);
+
+// Interactive loop. Returns the status given to exit, or 0 at end of input.
+int shell_loop(void);
 
 #endif
@@ -0,0 +1,18 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+// Builtin: source file [arg...], also spelled .
+// Runs the commands in file in the current shell, with the args as $1..$N
+// while it runs. The file is mapped rather than read and parsed a statement
+// at a time straight from the mapping, so running starts before the rest is
+// parsed. If a statement changes the file, the rest is read from it at the
+// same offset instead. Once a script has run to its end without a parse
+// error its parsed form is cached, keyed on the file's device, inode, mtime
+// and size, and copied out of the file; sourcing it again unchanged runs
+// that without parsing. Errors name file:line.
+// Returns the status of the last command, or the one given to return.
+int builtin_source(int argc, char **argv);
+
+void source_cleanup(void);
+
+#endif
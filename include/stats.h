@@ -0,0 +1,18 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "outbuf.h"
+
+#include <stdint.h>
+
+// Named counters reported by the stats builtin. Names are string constants
+// of the form "subsystem.counter"; a counter exists once first touched.
+void stats_add(const char *name, uint64_t delta);
+void stats_set(const char *name, uint64_t value);
+uint64_t stats_get(const char *name);
+
+// Builtin: stats [subsystem]
+// stats alloc [sites] shows the allocation profile instead
+int builtin_stats(OutBuf *out, OutBuf *err, int argc, char **argv);
+
+#endif
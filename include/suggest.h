@@ -0,0 +1,34 @@
+#ifndef SUGGEST_H
+#define SUGGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Prefix trie over history lines for inline autosuggestions. Every node
+// remembers the highest-ranked line below it, ranked by frecency (use count
+// with exponential decay), so a lookup is a walk down the trie and typing one
+// more character is a single step from the previous node.
+typedef struct SuggestTrie SuggestTrie;
+
+// Position in the trie after consuming a prefix
+typedef struct SuggestCursor {
+    uint32_t node;
+    size_t depth;
+} SuggestCursor;
+
+SuggestTrie *suggest_create(void);
+void suggest_destroy(SuggestTrie *t);
+
+// Record one use of line. Returns the trie's copy of it, shared by every
+// use until as many suggest_release calls drop it, or NULL on failure.
+const char *suggest_record(SuggestTrie *t, const char *line);
+// Drop one use of line, and the line with its last one
+void suggest_release(SuggestTrie *t, const char *line);
+
+void suggest_reset(const SuggestTrie *t, SuggestCursor *cur);
+// Consume one more character of the prefix
+void suggest_step(const SuggestTrie *t, SuggestCursor *cur, char ch);
+// Best completion of the consumed prefix, or NULL
+const char *suggest_best(const SuggestTrie *t, const SuggestCursor *cur);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef TEE_H
+#define TEE_H
+
+// Builtin: tee [-a] [file...]
+// Copies stdin to stdout and to each file (appending with -a). Data is
+// duplicated between pipes inside the kernel with tee(2) and moved out with
+// splice(2); outputs that cannot take a splice are written from a user-space
+// copy. A slow output holds back the input rather than buffering without
+// bound. An output whose reader goes away is dropped; the rest carry on.
+// Returns 1 if a file could not be opened or written, else 0.
+int builtin_tee(int argc, char **argv);
+
+#endif
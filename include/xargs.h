@@ -0,0 +1,13 @@
+#ifndef XARGS_H
+#define XARGS_H
+
+// Builtin: xargs [-0] [-n max-args] [-P procs] [command [initial-args...]]
+// Reads one argument per line of stdin (NUL-separated with -0) and runs
+// command (default echo) with as many arguments per exec as the kernel's
+// argument space allows after the environment, or max-args. With -P up to
+// procs batches run at once (0: one per CPU). Nothing runs on empty input.
+// Returns 0, or 123 if a command failed, 124 if one exited 255, 125 if one
+// was killed, 126/127 if it could not be run, 1 on usage errors.
+int builtin_xargs(int argc, char **argv);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include "redir.h"
+
+#include <sys/types.h>
+
+// Optional spawn helper. zygote_start() forks a helper while the shell is
+// still small; later spawns are sent to it over a socket (argv, environ,
+// and the stage's descriptors plus the working directory as SCM_RIGHTS)
+// and it forks from its own small image, so spawn cost does not grow with
+// the shell's heap.
+// Processes it spawns are its children, not the shell's: their exit
+// statuses come back over the same socket.
+
+int zygote_start(void);
+void zygote_stop(void);
+int zygote_active(void);
+
+// Spawn argv with the descriptors set up as plan says. pgid < 0 keeps the
+// shell's process group, 0 starts a new group led by the child; take_tty
+// hands it the terminal. Returns the pid, or -1 if the zygote could not
+// spawn it.
+pid_t zygote_spawn(char *const argv[], const RedirPlan *plan, pid_t pgid, int take_tty);
+
+// Socket to poll for exit notifications
+int zygote_fd(void);
+// Next exit notification, if one is available (or, with block, once one
+// arrives). Returns its pid with *wstatus filled in, 0 if none is pending,
+// -1 if the zygote is gone.
+pid_t zygote_next_exit(int *wstatus, int block);
+
+#endif
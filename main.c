@@ -1,6 +1,57 @@
 #include "../include/shell.h"
+#include "../include/server.h"
 
-int main(void) {
-    shell_loop();
-    return 0;
+#include <stdio.h>
+#include <string.h>
+
+static void usage(void) {
+    fprintf(stderr, "usage: minibash [--norc] [-c command]\n"
+                    "       minibash [--norc] --serve socket\n"
+                    "       minibash --connect socket -c command\n");
+}
+
+int main(int argc, char **argv) {
+    char *command = NULL;
+    const char *serve = NULL, *connect_to = NULL;
+    int load_rc = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            command = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve = argv[++i];
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            connect_to = argv[++i];
+        } else if (strcmp(argv[i], "--norc") == 0) {
+            load_rc = 0;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    if (connect_to) {
+        if (!command || serve) {
+            usage();
+            return 2;
+        }
+        return server_request(connect_to, command);
+    }
+    if (serve && command) {
+        usage();
+        return 2;
+    }
+
+    if (shell_init(load_rc) != 0) {
+        return 1;
+    }
+    int status = 0;
+    if (serve) {
+        status = server_run(serve);
+    } else if (command) {
+        status = shell_run_line(command);
+    } else {
+        status = shell_loop();
+    }
+    shell_cleanup();
+    return status;
 }
@@ -0,0 +1,286 @@
+#include "alloc.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TABLE_INITIAL_CAP 1024
+#define REPORT_SITES 32
+
+// A live block. The table is keyed on ptr with open addressing, so the
+// blocks themselves carry no header and any pointer can be freed.
+typedef struct {
+    void *ptr;
+    size_t size;
+    const char *file;
+    int line;
+    int tag;
+} Block;
+
+typedef struct {
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t frees;
+    uint64_t live;
+    uint64_t live_bytes;
+    uint64_t peak_bytes;
+} TagCounts;
+
+typedef struct {
+    const char *file;
+    int line;
+    int tag;
+    uint64_t count;
+    uint64_t bytes;
+} Site;
+
+static const char *const tag_names[ALLOC_TAGS] = {
+    "parser", "executor", "completion", "history", "vars", "editor",
+};
+
+static int profiling = 0;
+static pid_t owner;
+// The completion worker allocates too
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static Block *table = NULL;
+static size_t table_cap = 0, table_count = 0;
+static TagCounts counts[ALLOC_TAGS];
+static uint64_t untracked_frees = 0;
+
+static size_t slot_of(const void *p) {
+    return (size_t)(((uintptr_t)p >> 4) * 0x9E3779B97F4A7C15ull) & (table_cap - 1);
+}
+
+static Block *find(const void *p) {
+    if (table_cap == 0) return NULL;
+    for (size_t i = slot_of(p);; i = (i + 1) & (table_cap - 1)) {
+        if (table[i].ptr == p) return &table[i];
+        if (!table[i].ptr) return NULL;
+    }
+}
+
+static void put(const Block *b) {
+    size_t i = slot_of(b->ptr);
+    while (table[i].ptr) i = (i + 1) & (table_cap - 1);
+    table[i] = *b;
+    table_count++;
+}
+
+static int grow(void) {
+    size_t cap = table_cap ? table_cap * 2 : TABLE_INITIAL_CAP;
+    Block *fresh = calloc(cap, sizeof(Block));
+    if (!fresh) return -1;
+    Block *old = table;
+    size_t old_cap = table_cap;
+    table = fresh;
+    table_cap = cap;
+    table_count = 0;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i].ptr) put(&old[i]);
+    }
+    free(old);
+    return 0;
+}
+
+// Remove b, shifting later entries of its probe run back into the hole
+static void erase(Block *b) {
+    size_t hole = (size_t)(b - table);
+    table[hole].ptr = NULL;
+    table_count--;
+    for (size_t i = (hole + 1) & (table_cap - 1); table[i].ptr; i = (i + 1) & (table_cap - 1)) {
+        size_t home = slot_of(table[i].ptr);
+        // Move it unless its home lies cyclically in (hole, i]
+        int stays = hole <= i ? (home > hole && home <= i) : (home > hole || home <= i);
+        if (stays) continue;
+        table[hole] = table[i];
+        table[i].ptr = NULL;
+        hole = i;
+    }
+}
+
+static void drop_locked(Block *b) {
+    if (!b) {
+        untracked_frees++;
+        return;
+    }
+    TagCounts *c = &counts[b->tag];
+    c->frees++;
+    c->live--;
+    c->live_bytes -= b->size;
+    erase(b);
+}
+
+static void track_locked(void *p, size_t size, AllocTag tag, const char *file, int line) {
+    TagCounts *c = &counts[tag];
+    c->calls++;
+    c->bytes += size;
+    // A block freed behind the allocator's back leaves a stale entry
+    Block *stale = find(p);
+    if (stale) drop_locked(stale);
+    if ((table_count + 1) * 4 > table_cap * 3 && grow() != 0) return;
+    Block b = {p, size, file, line, (int)tag};
+    put(&b);
+    c->live++;
+    c->live_bytes += size;
+    if (c->live_bytes > c->peak_bytes) c->peak_bytes = c->live_bytes;
+}
+
+static void track(void *p, size_t size, AllocTag tag, const char *file, int line) {
+    pthread_mutex_lock(&lock);
+    track_locked(p, size, tag, file, line);
+    pthread_mutex_unlock(&lock);
+}
+
+void *alloc_malloc(AllocTag tag, size_t n, const char *file, int line) {
+    void *p = malloc(n);
+    if (p && profiling) track(p, n, tag, file, line);
+    return p;
+}
+
+void *alloc_calloc(AllocTag tag, size_t n, size_t size, const char *file, int line) {
+    void *p = calloc(n, size);
+    if (p && profiling) track(p, n * size, tag, file, line);
+    return p;
+}
+
+void *alloc_realloc(AllocTag tag, void *p, size_t n, const char *file, int line) {
+    if (!profiling) return realloc(p, n);
+    // Held across realloc so another thread cannot be handed the old
+    // address and record it before the old entry is gone
+    pthread_mutex_lock(&lock);
+    Block *old = p ? find(p) : NULL;
+    void *q = realloc(p, n);
+    if (q || n == 0) {
+        if (p) drop_locked(old);
+        if (q) track_locked(q, n, tag, file, line);
+    }
+    pthread_mutex_unlock(&lock);
+    return q;
+}
+
+char *alloc_strndup(AllocTag tag, const char *s, size_t n, const char *file, int line) {
+    size_t len = strnlen(s, n);
+    char *p = alloc_malloc(tag, len + 1, file, line);
+    if (!p) return NULL;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+void xfree(void *p) {
+    if (!p) return;
+    if (profiling) {
+        pthread_mutex_lock(&lock);
+        drop_locked(find(p));
+        pthread_mutex_unlock(&lock);
+    }
+    free(p);
+}
+
+static int by_bytes(const void *a, const void *b) {
+    const Site *x = a, *y = b;
+    return x->bytes < y->bytes ? 1 : x->bytes > y->bytes ? -1 : 0;
+}
+
+// Live blocks grouped by call site, largest first
+static void report_sites(OutBuf *out) {
+    Site *sites = NULL;
+    size_t nsites = 0, cap = 0;
+    for (size_t i = 0; i < table_cap; i++) {
+        const Block *b = &table[i];
+        if (!b->ptr) continue;
+        size_t k = 0;
+        while (k < nsites && (sites[k].line != b->line || sites[k].file != b->file)) k++;
+        if (k == nsites) {
+            if (nsites == cap) {
+                size_t ncap = cap ? cap * 2 : 64;
+                Site *tmp = realloc(sites, ncap * sizeof(Site));
+                if (!tmp) break;
+                sites = tmp;
+                cap = ncap;
+            }
+            sites[nsites++] = (Site){b->file, b->line, b->tag, 0, 0};
+        }
+        sites[k].count++;
+        sites[k].bytes += b->size;
+    }
+    if (nsites > 0) qsort(sites, nsites, sizeof(Site), by_bytes);
+    for (size_t k = 0; k < nsites && k < REPORT_SITES; k++) {
+        char where[64];
+        snprintf(where, sizeof(where), "%s:%d", sites[k].file, sites[k].line);
+        outbuf_printf(out, "  %-28s %-10s %8" PRIu64 " blocks %10" PRIu64 " bytes\n",
+                      where, tag_names[sites[k].tag], sites[k].count, sites[k].bytes);
+    }
+    if (nsites > REPORT_SITES) {
+        outbuf_printf(out, "  ... %zu more sites\n", nsites - REPORT_SITES);
+    }
+    free(sites);
+}
+
+int alloc_report(OutBuf *out, int sites) {
+    if (!profiling) return -1;
+    pthread_mutex_lock(&lock);
+    outbuf_printf(out, "%-12s %10s %12s %10s %10s %12s %12s\n",
+                  "subsystem", "calls", "bytes", "frees", "live", "live bytes", "peak bytes");
+    for (int t = 0; t < ALLOC_TAGS; t++) {
+        const TagCounts *c = &counts[t];
+        outbuf_printf(out, "%-12s %10" PRIu64 " %12" PRIu64 " %10" PRIu64 " %10" PRIu64
+                      " %12" PRIu64 " %12" PRIu64 "\n",
+                      tag_names[t], c->calls, c->bytes, c->frees, c->live,
+                      c->live_bytes, c->peak_bytes);
+    }
+    if (untracked_frees) {
+        outbuf_printf(out, "untracked frees: %" PRIu64 "\n", untracked_frees);
+    }
+    if (sites) report_sites(out);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+// Whatever is still live when the shell exits
+static void dump_leaks(void) {
+    // Forked children run the atexit handlers too
+    if (getpid() != owner) return;
+    // The completion worker may still be allocating
+    pthread_mutex_lock(&lock);
+    uint64_t live = 0, bytes = 0;
+    for (int t = 0; t < ALLOC_TAGS; t++) {
+        live += counts[t].live;
+        bytes += counts[t].live_bytes;
+    }
+    if (live > 0) {
+        OutBuf out;
+        outbuf_init(&out, STDERR_FILENO);
+        outbuf_printf(&out, "minibash: %" PRIu64 " blocks (%" PRIu64 " bytes) still allocated at exit\n",
+                      live, bytes);
+        report_sites(&out);
+        outbuf_flush(&out);
+        outbuf_free(&out);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void fork_prepare(void) {
+    pthread_mutex_lock(&lock);
+}
+
+static void fork_done(void) {
+    pthread_mutex_unlock(&lock);
+}
+
+void alloc_init(void) {
+    const char *env = getenv("MINIBASH_ALLOC_PROFILE");
+    if (!env || strcmp(env, "1") != 0 || profiling) return;
+    profiling = 1;
+    owner = getpid();
+    pthread_atfork(fork_prepare, fork_done, fork_done);
+    atexit(dump_leaks);
+}
+
+int alloc_profiling(void) {
+    return profiling;
+}
@@ -0,0 +1,644 @@
+#include "arith.h"
+#include "alloc.h"
+#include "array.h"
+#include "builtins.h"
+#include "parse.h"
+#include "stats.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARITH_CACHE_SLOTS 256
+#define ARITH_STACK_MAX 128
+#define ARITH_RECURSION_MAX 16
+
+typedef enum {
+    OP_NUM,     // push num
+    OP_LOAD,    // push variable arg
+    OP_STORE,   // variable arg = top, which stays
+    OP_DUP,
+    OP_POP,
+    OP_NEG,
+    OP_NOT,
+    OP_BNOT,
+    OP_BOOL,    // top = top != 0
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_ADD,
+    OP_SUB,
+    OP_SHL,
+    OP_SHR,
+    OP_POW,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_EQ,
+    OP_NE,
+    OP_AND,
+    OP_XOR,
+    OP_OR,
+    OP_JZ,      // pop, jump to arg if zero
+    OP_JNZ,     // pop, jump to arg if not zero
+    OP_JMP
+} OpCode;
+
+typedef struct {
+    int op;
+    int arg;
+    long long num;
+} Insn;
+
+typedef struct {
+    uint64_t hash;
+    char *text;
+    Insn *code;
+    int ncode;
+    char **names;
+    int nnames;
+} Program;
+
+typedef struct {
+    const char *text;
+    const char *p;
+    Insn *code;
+    int ncode;
+    int cap;
+    char **names;
+    int nnames;
+    int names_cap;
+    int sp;             // stack depth where the next instruction runs
+    int lvalue;         // the name a bare variable at code[lvalue_pc] loads
+    int lvalue_pc;
+    const char *error;
+} Compiler;
+
+// Operators, longest first so the lexer takes the longest match
+static const char *const operators[] = {
+    "<<=", ">>=",
+    "**", "++", "--", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||",
+    "+=", "-=", "*=", "/=", "%=", "&=", "^=", "|=",
+    "+", "-", "*", "/", "%", "<", ">", "&", "|", "^", "!", "~", "?", ":", "=", ",", "(", ")",
+};
+
+// Binary operators from loosest to tightest; ** is handled apart
+typedef struct {
+    const char *tok;
+    int op;
+    int level;
+} BinOp;
+
+static const BinOp binops[] = {
+    {"|", OP_OR, 0},
+    {"^", OP_XOR, 1},
+    {"&", OP_AND, 2},
+    {"==", OP_EQ, 3}, {"!=", OP_NE, 3},
+    {"<", OP_LT, 4}, {"<=", OP_LE, 4}, {">", OP_GT, 4}, {">=", OP_GE, 4},
+    {"<<", OP_SHL, 5}, {">>", OP_SHR, 5},
+    {"+", OP_ADD, 6}, {"-", OP_SUB, 6},
+    {"*", OP_MUL, 7}, {"/", OP_DIV, 7}, {"%", OP_MOD, 7},
+};
+#define BINARY_LEVELS 8
+
+// Compound assignments and the operator each applies
+static const BinOp assignops[] = {
+    {"=", -1, 0},
+    {"+=", OP_ADD, 0}, {"-=", OP_SUB, 0}, {"*=", OP_MUL, 0}, {"/=", OP_DIV, 0},
+    {"%=", OP_MOD, 0}, {"<<=", OP_SHL, 0}, {">>=", OP_SHR, 0}, {"&=", OP_AND, 0},
+    {"^=", OP_XOR, 0}, {"|=", OP_OR, 0},
+};
+
+static Program *cache[ARITH_CACHE_SLOTS];
+static int recursion = 0;
+
+static uint64_t fnv1a(const char *s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void program_free(Program *prog) {
+    if (!prog) return;
+    for (int i = 0; i < prog->nnames; i++) xfree(prog->names[i]);
+    xfree(prog->names);
+    xfree(prog->code);
+    xfree(prog->text);
+    xfree(prog);
+}
+
+// Compiling
+
+static void fail(Compiler *c, const char *error) {
+    if (!c->error) c->error = error;
+}
+
+static int stack_effect(int op) {
+    switch (op) {
+    case OP_NUM:
+    case OP_LOAD:
+    case OP_DUP:
+        return 1;
+    case OP_STORE:
+    case OP_NEG:
+    case OP_NOT:
+    case OP_BNOT:
+    case OP_BOOL:
+    case OP_JMP:
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+static int emit(Compiler *c, int op, int arg, long long num) {
+    if (c->ncode == c->cap) {
+        int cap = c->cap ? c->cap * 2 : 16;
+        Insn *tmp = xrealloc(ALLOC_PARSER, c->code, (size_t)cap * sizeof(Insn));
+        if (!tmp) {
+            fail(c, "out of memory");
+            return 0;
+        }
+        c->code = tmp;
+        c->cap = cap;
+    }
+    c->sp += stack_effect(op);
+    if (c->sp > ARITH_STACK_MAX) fail(c, "expression too complex");
+    c->code[c->ncode] = (Insn){op, arg, num};
+    return c->ncode++;
+}
+
+static void patch(Compiler *c, int at) {
+    if (at < c->ncode) c->code[at].arg = c->ncode;
+}
+
+static int intern(Compiler *c, const char *name, size_t len) {
+    for (int i = 0; i < c->nnames; i++) {
+        if (strncmp(c->names[i], name, len) == 0 && c->names[i][len] == '\0') return i;
+    }
+    if (c->nnames == c->names_cap) {
+        int cap = c->names_cap ? c->names_cap * 2 : 4;
+        char **tmp = xrealloc(ALLOC_PARSER, c->names, (size_t)cap * sizeof(char *));
+        if (!tmp) {
+            fail(c, "out of memory");
+            return 0;
+        }
+        c->names = tmp;
+        c->names_cap = cap;
+    }
+    if (!(c->names[c->nnames] = xstrndup(ALLOC_PARSER, name, len))) {
+        fail(c, "out of memory");
+        return 0;
+    }
+    return c->nnames++;
+}
+
+static void skip_space(Compiler *c) {
+    while (isspace((unsigned char)*c->p)) c->p++;
+}
+
+// Length of the operator at the current position, 0 if there is none
+static size_t peek_op(Compiler *c, const char **op) {
+    skip_space(c);
+    for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+        size_t len = strlen(operators[i]);
+        if (strncmp(c->p, operators[i], len) == 0) {
+            *op = operators[i];
+            return len;
+        }
+    }
+    return 0;
+}
+
+static int accept(Compiler *c, const char *tok) {
+    const char *op;
+    size_t len = peek_op(c, &op);
+    if (len == 0 || strcmp(op, tok) != 0) return 0;
+    c->p += len;
+    return 1;
+}
+
+static void comma(Compiler *c);
+static void assignment(Compiler *c);
+static void unary(Compiler *c);
+
+static void primary(Compiler *c) {
+    skip_space(c);
+    if (accept(c, "(")) {
+        comma(c);
+        if (!accept(c, ")")) fail(c, "missing `)'");
+        // (name) is a value, not a variable to assign to
+        c->lvalue_pc = -1;
+        return;
+    }
+    const char *s = c->p;
+    if (isdigit((unsigned char)*s)) {
+        char *end;
+        long long n = (long long)strtoull(s, &end, 0);
+        if (isalnum((unsigned char)*end) || *end == '_') {
+            fail(c, "value too great for base");
+            return;
+        }
+        c->p = end;
+        emit(c, OP_NUM, 0, n);
+        return;
+    }
+    if (isalpha((unsigned char)*s) || *s == '_') {
+        while (isalnum((unsigned char)*c->p) || *c->p == '_') c->p++;
+        c->lvalue = intern(c, s, (size_t)(c->p - s));
+        c->lvalue_pc = emit(c, OP_LOAD, c->lvalue, 0);
+        return;
+    }
+    fail(c, "syntax error: operand expected");
+}
+
+// The code just emitted loads a variable that can be assigned to
+static int at_lvalue(const Compiler *c) {
+    return c->ncode > 0 && c->lvalue_pc == c->ncode - 1 && c->code[c->ncode - 1].op == OP_LOAD;
+}
+
+// name++ and name--: the old value stays on the stack
+static void postfix(Compiler *c) {
+    primary(c);
+    while (at_lvalue(c)) {
+        int op = accept(c, "++") ? OP_ADD : accept(c, "--") ? OP_SUB : -1;
+        if (op < 0) return;
+        int name = c->lvalue;
+        emit(c, OP_DUP, 0, 0);
+        emit(c, OP_NUM, 0, 1);
+        emit(c, op, 0, 0);
+        emit(c, OP_STORE, name, 0);
+        emit(c, OP_POP, 0, 0);
+    }
+}
+
+// Unary operators bind tighter than **, so -2**2 is 4
+static void power(Compiler *c) {
+    unary(c);
+    if (accept(c, "**")) {
+        power(c);
+        emit(c, OP_POW, 0, 0);
+    }
+}
+
+static void unary(Compiler *c) {
+    if (c->error) return;
+    if (accept(c, "+")) {
+        unary(c);
+    } else if (accept(c, "-")) {
+        unary(c);
+        emit(c, OP_NEG, 0, 0);
+    } else if (accept(c, "!")) {
+        unary(c);
+        emit(c, OP_NOT, 0, 0);
+    } else if (accept(c, "~")) {
+        unary(c);
+        emit(c, OP_BNOT, 0, 0);
+    } else if (accept(c, "++") || accept(c, "--")) {
+        int op = c->p[-1] == '+' ? OP_ADD : OP_SUB;
+        unary(c);
+        if (!at_lvalue(c)) {
+            fail(c, "attempted assignment to non-variable");
+            return;
+        }
+        int name = c->lvalue;
+        emit(c, OP_NUM, 0, 1);
+        emit(c, op, 0, 0);
+        emit(c, OP_STORE, name, 0);
+    } else {
+        postfix(c);
+    }
+}
+
+static const BinOp *binop_at(Compiler *c, int level) {
+    const char *op;
+    size_t len = peek_op(c, &op);
+    if (len == 0) return NULL;
+    for (size_t i = 0; i < sizeof(binops) / sizeof(binops[0]); i++) {
+        if (binops[i].level == level && strcmp(binops[i].tok, op) == 0) {
+            c->p += len;
+            return &binops[i];
+        }
+    }
+    return NULL;
+}
+
+static void binary(Compiler *c, int level) {
+    if (level == BINARY_LEVELS) {
+        power(c);
+        return;
+    }
+    binary(c, level + 1);
+    const BinOp *b;
+    while (!c->error && (b = binop_at(c, level))) {
+        binary(c, level + 1);
+        emit(c, b->op, 0, 0);
+    }
+}
+
+// a && b and a || b evaluate b only when a does not settle it
+static void logical(Compiler *c, int is_or) {
+    if (is_or) logical(c, 0);
+    else binary(c, 0);
+    while (!c->error && accept(c, is_or ? "||" : "&&")) {
+        int skip = emit(c, is_or ? OP_JNZ : OP_JZ, 0, 0);
+        if (is_or) logical(c, 0);
+        else binary(c, 0);
+        emit(c, OP_BOOL, 0, 0);
+        int done = emit(c, OP_JMP, 0, 0);
+        c->sp--;
+        patch(c, skip);
+        emit(c, OP_NUM, 0, is_or);
+        patch(c, done);
+    }
+}
+
+static void conditional(Compiler *c) {
+    logical(c, 1);
+    if (c->error || !accept(c, "?")) return;
+    int skip = emit(c, OP_JZ, 0, 0);
+    comma(c);
+    if (!accept(c, ":")) {
+        fail(c, "`:' expected for conditional expression");
+        return;
+    }
+    int done = emit(c, OP_JMP, 0, 0);
+    c->sp--;
+    patch(c, skip);
+    conditional(c);
+    patch(c, done);
+}
+
+static void assignment(Compiler *c) {
+    conditional(c);
+    if (c->error) return;
+    const char *tok;
+    size_t len = peek_op(c, &tok);
+    const BinOp *a = NULL;
+    for (size_t i = 0; len && i < sizeof(assignops) / sizeof(assignops[0]); i++) {
+        if (strcmp(assignops[i].tok, tok) == 0) a = &assignops[i];
+    }
+    if (!a) return;
+    if (!at_lvalue(c)) {
+        fail(c, "attempted assignment to non-variable");
+        return;
+    }
+    c->p += len;
+    int name = c->lvalue;
+    // Plain = does not read the old value
+    if (a->op < 0) {
+        c->ncode--;
+        c->sp--;
+    }
+    assignment(c);
+    if (a->op >= 0) emit(c, a->op, 0, 0);
+    emit(c, OP_STORE, name, 0);
+}
+
+static void comma(Compiler *c) {
+    assignment(c);
+    while (!c->error && accept(c, ",")) {
+        emit(c, OP_POP, 0, 0);
+        assignment(c);
+    }
+}
+
+static void report(const char *text, const char *error, const char *at) {
+    parse_error_prefix();
+    if (at && *at) fprintf(stderr, "%s: %s (error token is \"%s\")\n", text, error, at);
+    else fprintf(stderr, "%s: %s\n", text, error);
+}
+
+static Program *compile(const char *text) {
+    Compiler c = {0};
+    c.text = c.p = text;
+    c.lvalue_pc = -1;
+    skip_space(&c);
+    if (*c.p) comma(&c);
+    else emit(&c, OP_NUM, 0, 0);
+    skip_space(&c);
+    if (!c.error && *c.p) fail(&c, "syntax error in expression");
+
+    Program *prog = c.error ? NULL : xcalloc(ALLOC_PARSER, 1, sizeof(Program));
+    if (prog && !(prog->text = xstrdup(ALLOC_PARSER, text))) {
+        xfree(prog);
+        prog = NULL;
+        fail(&c, "out of memory");
+    }
+    if (!prog) {
+        report(text, c.error ? c.error : "out of memory", c.p);
+        for (int i = 0; i < c.nnames; i++) xfree(c.names[i]);
+        xfree(c.names);
+        xfree(c.code);
+        return NULL;
+    }
+    prog->hash = fnv1a(text);
+    prog->code = c.code;
+    prog->ncode = c.ncode;
+    prog->names = c.names;
+    prog->nnames = c.nnames;
+    stats_add("arith.compiled", 1);
+    return prog;
+}
+
+// Running
+
+static int eval_uncached(const char *text, long long *result);
+
+static int load(const char *name, long long *value) {
+    const char *v = get_var(name);
+    if (!v) v = array_get(name, "0");
+    if (!v) {
+        *value = 0;
+        return 0;
+    }
+    while (isspace((unsigned char)*v)) v++;
+    char *end;
+    long long n = (long long)strtoull(v, &end, 0);
+    while (isspace((unsigned char)*end)) end++;
+    if (!*end) {
+        *value = end > v ? n : 0;
+        return 0;
+    }
+    // Not a number: an expression of its own
+    if (recursion == ARITH_RECURSION_MAX) {
+        report(v, "expression recursion level exceeded", NULL);
+        return -1;
+    }
+    recursion++;
+    int ret = eval_uncached(v, value);
+    recursion--;
+    return ret;
+}
+
+static void store(const char *name, long long value) {
+    char num[24];
+    snprintf(num, sizeof(num), "%lld", value);
+    set_var(name, num);
+}
+
+static long long ipow(long long base, long long exp) {
+    unsigned long long result = 1, b = (unsigned long long)base;
+    for (; exp > 0; exp >>= 1) {
+        if (exp & 1) result *= b;
+        b *= b;
+    }
+    return (long long)result;
+}
+
+// Signed overflow wraps, as the shell's arithmetic always has in practice
+static int run(const Program *prog, long long *result) {
+    long long stack[ARITH_STACK_MAX + 1];
+    int sp = 0;
+    for (int pc = 0; pc < prog->ncode; pc++) {
+        const Insn *in = &prog->code[pc];
+        unsigned long long a, b;
+        switch (in->op) {
+        case OP_NUM:
+            stack[sp++] = in->num;
+            continue;
+        case OP_LOAD:
+            if (load(prog->names[in->arg], &stack[sp++]) != 0) return -1;
+            continue;
+        case OP_STORE:
+            store(prog->names[in->arg], stack[sp - 1]);
+            continue;
+        case OP_DUP:
+            stack[sp] = stack[sp - 1];
+            sp++;
+            continue;
+        case OP_POP:
+            sp--;
+            continue;
+        case OP_NEG:
+            stack[sp - 1] = (long long)(0 - (unsigned long long)stack[sp - 1]);
+            continue;
+        case OP_NOT:
+            stack[sp - 1] = !stack[sp - 1];
+            continue;
+        case OP_BNOT:
+            stack[sp - 1] = ~stack[sp - 1];
+            continue;
+        case OP_BOOL:
+            stack[sp - 1] = stack[sp - 1] != 0;
+            continue;
+        case OP_JZ:
+            if (stack[--sp] == 0) pc = in->arg - 1;
+            continue;
+        case OP_JNZ:
+            if (stack[--sp] != 0) pc = in->arg - 1;
+            continue;
+        case OP_JMP:
+            pc = in->arg - 1;
+            continue;
+        }
+
+        long long y = stack[--sp], x = stack[sp - 1], r;
+        a = (unsigned long long)x;
+        b = (unsigned long long)y;
+        switch (in->op) {
+        case OP_MUL: r = (long long)(a * b); break;
+        case OP_ADD: r = (long long)(a + b); break;
+        case OP_SUB: r = (long long)(a - b); break;
+        case OP_DIV:
+        case OP_MOD:
+            if (y == 0) {
+                report(prog->text, "division by 0", NULL);
+                return -1;
+            }
+            if (y == -1) r = in->op == OP_DIV ? (long long)(0 - a) : 0;
+            else r = in->op == OP_DIV ? x / y : x % y;
+            break;
+        case OP_SHL: r = (long long)(a << (y & 63)); break;
+        case OP_SHR: r = x >> (y & 63); break;
+        case OP_POW:
+            if (y < 0) {
+                report(prog->text, "exponent less than 0", NULL);
+                return -1;
+            }
+            r = ipow(x, y);
+            break;
+        case OP_LT: r = x < y; break;
+        case OP_LE: r = x <= y; break;
+        case OP_GT: r = x > y; break;
+        case OP_GE: r = x >= y; break;
+        case OP_EQ: r = x == y; break;
+        case OP_NE: r = x != y; break;
+        case OP_AND: r = x & y; break;
+        case OP_XOR: r = x ^ y; break;
+        case OP_OR: r = x | y; break;
+        default: r = 0; break;
+        }
+        stack[sp - 1] = r;
+    }
+    *result = stack[sp - 1];
+    return 0;
+}
+
+// A variable's value is compiled afresh each time: running it from the
+// cache could evict the program that is loading the variable
+static int eval_uncached(const char *text, long long *result) {
+    Program *prog = compile(text);
+    if (!prog) return -1;
+    int ret = run(prog, result);
+    program_free(prog);
+    return ret;
+}
+
+int arith_eval(const char *expr, long long *result) {
+    stats_add("arith.evals", 1);
+    uint64_t h = fnv1a(expr);
+    Program **slot = &cache[h & (ARITH_CACHE_SLOTS - 1)];
+    if (!*slot || (*slot)->hash != h || strcmp((*slot)->text, expr) != 0) {
+        Program *prog = compile(expr);
+        if (!prog) return -1;
+        program_free(*slot);
+        *slot = prog;
+    }
+    return run(*slot, result);
+}
+
+int arith_command(const Command *cmd) {
+    if (cmd->argc == 0 || strncmp(cmd->args[0], "((", 2) != 0) return -1;
+    const char *last = cmd->args[cmd->argc - 1];
+    size_t last_len = strlen(last);
+    if (last_len < 2 || strcmp(last + last_len - 2, "))") != 0 ||
+        (cmd->argc == 1 && last_len < 4)) {
+        return -1;
+    }
+
+    // Words split by an expansion go back together
+    size_t len = 0;
+    for (int i = 0; i < cmd->argc; i++) len += strlen(cmd->args[i]) + 1;
+    char *expr = xmalloc(ALLOC_PARSER, len);
+    if (!expr) {
+        perror("minibash");
+        return 1;
+    }
+    char *p = expr;
+    for (int i = 0; i < cmd->argc; i++) {
+        const char *w = cmd->args[i] + (i == 0 ? 2 : 0);
+        size_t n = strlen(w) - (i == cmd->argc - 1 ? 2 : 0);
+        if (i > 0) *p++ = ' ';
+        memcpy(p, w, n);
+        p += n;
+    }
+    *p = '\0';
+    long long value = 0;
+    int ret = arith_eval(expr, &value);
+    xfree(expr);
+    return ret == 0 && value != 0 ? 0 : 1;
+}
+
+void arith_cleanup(void) {
+    for (int i = 0; i < ARITH_CACHE_SLOTS; i++) {
+        program_free(cache[i]);
+        cache[i] = NULL;
+    }
+}
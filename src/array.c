@@ -0,0 +1,755 @@
+#include "array.h"
+#include "alloc.h"
+#include "builtins.h"
+#include "parse.h"
+#include "stats.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NAME_MAX_LEN 128
+#define ARRAY_INDEX_MAX (1L << 24)
+// Storage is dense, so a subscript may only leave this many unset slots
+// past the end, or as many as there are elements set if that is more
+#define ARRAY_GAP_MIN 4096
+#define ASSOC_SLOTS_INITIAL 16
+#define MAPFILE_CHUNK (64 * 1024)
+// Text is compacted once replaced and unset strings take more than half of
+// it, and at least this much
+#define TEXT_COMPACT_MIN 4096
+#define NO_TEXT SIZE_MAX
+
+typedef struct {
+    uint64_t hash;
+    size_t key;             // NO_TEXT once unset
+    size_t value;
+} Entry;
+
+// Every string of an array, keys included, is NUL-terminated in its one
+// text buffer and referred to by offset.
+typedef struct Array {
+    char *name;
+    int assoc;
+    size_t count;           // elements set
+    char *text;
+    size_t text_len;
+    size_t text_cap;
+    size_t text_dead;       // bytes of strings no longer referred to
+    // Indexed: [0, len) in use, NO_TEXT where unset and from len to cap
+    size_t *values;
+    size_t len;
+    size_t cap;
+    // Associative: entries in insertion order, and slots holding entry
+    // number + 1 (0: empty), probed linearly
+    Entry *entries;
+    size_t nentries;
+    size_t entries_cap;
+    uint32_t *slots;
+    size_t nslots;
+} Array;
+
+static Array **arrays = NULL;
+static size_t narrays = 0, arrays_cap = 0;
+
+static uint64_t fnv1a(const char *s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static size_t name_len(const char *s) {
+    if (!isalpha((unsigned char)*s) && *s != '_') return 0;
+    size_t n = 1;
+    while (isalnum((unsigned char)s[n]) || s[n] == '_') n++;
+    return n;
+}
+
+static Array *find(const char *name) {
+    for (size_t i = 0; i < narrays; i++) {
+        if (strcmp(arrays[i]->name, name) == 0) return arrays[i];
+    }
+    return NULL;
+}
+
+static Array *create(const char *name, int assoc) {
+    if (narrays == arrays_cap) {
+        size_t cap = arrays_cap ? arrays_cap * 2 : 16;
+        Array **tmp = xrealloc(ALLOC_VARS, arrays, cap * sizeof(Array *));
+        if (!tmp) return NULL;
+        arrays = tmp;
+        arrays_cap = cap;
+    }
+    Array *a = xcalloc(ALLOC_VARS, 1, sizeof(Array));
+    if (!a || !(a->name = xstrdup(ALLOC_VARS, name))) {
+        xfree(a);
+        return NULL;
+    }
+    a->assoc = assoc;
+    arrays[narrays++] = a;
+    return a;
+}
+
+// Drop every element, keeping the kind
+static void clear(Array *a) {
+    xfree(a->text);
+    xfree(a->values);
+    xfree(a->entries);
+    xfree(a->slots);
+    a->text = NULL;
+    a->values = NULL;
+    a->entries = NULL;
+    a->slots = NULL;
+    a->text_len = a->text_cap = a->text_dead = 0;
+    a->count = a->len = a->cap = 0;
+    a->nentries = a->entries_cap = a->nslots = 0;
+}
+
+// Text
+
+static const char *text_at(const Array *a, size_t off) {
+    return a->text + off;
+}
+
+static void text_drop(Array *a, size_t off) {
+    a->text_dead += strlen(a->text + off) + 1;
+}
+
+// Copy the live strings to a fresh buffer in element order
+static int compact(Array *a) {
+    size_t live = a->text_len - a->text_dead;
+    char *text = xmalloc(ALLOC_VARS, live ? live : 1);
+    if (!text) return -1;
+    size_t n = 0;
+    for (size_t i = 0; i < a->len; i++) {
+        if (a->values[i] == NO_TEXT) continue;
+        size_t size = strlen(a->text + a->values[i]) + 1;
+        memcpy(text + n, a->text + a->values[i], size);
+        a->values[i] = n;
+        n += size;
+    }
+    for (size_t i = 0; i < a->nentries; i++) {
+        Entry *e = &a->entries[i];
+        if (e->key == NO_TEXT) continue;
+        size_t *offs[2] = {&e->key, &e->value};
+        for (int k = 0; k < 2; k++) {
+            size_t size = strlen(a->text + *offs[k]) + 1;
+            memcpy(text + n, a->text + *offs[k], size);
+            *offs[k] = n;
+            n += size;
+        }
+    }
+    xfree(a->text);
+    a->text = text;
+    a->text_len = a->text_cap = n;
+    a->text_dead = 0;
+    return 0;
+}
+
+// Room for n more bytes, compacting first if that is due. Moves the text
+// and the offsets of the strings in it.
+static int text_reserve(Array *a, size_t n) {
+    if (a->text_dead > TEXT_COMPACT_MIN && a->text_dead * 2 > a->text_len) compact(a);
+    if (a->text_len + n <= a->text_cap) return 0;
+    size_t cap = a->text_cap ? a->text_cap : 256;
+    while (cap < a->text_len + n) cap *= 2;
+    char *tmp = xrealloc(ALLOC_VARS, a->text, cap);
+    if (!tmp) return -1;
+    a->text = tmp;
+    a->text_cap = cap;
+    return 0;
+}
+
+// Append the n bytes at v and a NUL, in room already reserved. Returns the
+// offset.
+static size_t text_put(Array *a, const char *v, size_t n) {
+    size_t off = a->text_len;
+    memcpy(a->text + off, v, n);
+    a->text[off + n] = '\0';
+    a->text_len += n + 1;
+    return off;
+}
+
+static void destroy(Array *a) {
+    clear(a);
+    xfree(a->name);
+    xfree(a);
+}
+
+static void bad_subscript(const Array *a, const char *sub, size_t len) {
+    parse_error_prefix();
+    fprintf(stderr, "%s[%.*s]: bad array subscript\n", a->name, (int)len, sub);
+}
+
+// Indexed arrays
+
+static int parse_index(const Array *a, const char *sub, long *index) {
+    char *end;
+    long i = strtol(sub, &end, 10);
+    if (end == sub || *end) {
+        // A variable holding the index
+        const char *v = name_len(sub) == strlen(sub) ? get_var(sub) : NULL;
+        if (!v) return -1;
+        i = strtol(v, &end, 10);
+        if (end == v || *end) return -1;
+    }
+    if (i < 0) i += (long)a->len;
+    if (i < 0 || i >= ARRAY_INDEX_MAX) return -1;
+    *index = i;
+    return 0;
+}
+
+static int reserve(Array *a, size_t n) {
+    if (n <= a->cap) return 0;
+    size_t cap = a->cap ? a->cap : 8;
+    while (cap < n) cap *= 2;
+    size_t *tmp = xrealloc(ALLOC_VARS, a->values, cap * sizeof(size_t));
+    if (!tmp) return -1;
+    for (size_t i = a->cap; i < cap; i++) tmp[i] = NO_TEXT;
+    a->values = tmp;
+    a->cap = cap;
+    return 0;
+}
+
+static int set_indexed(Array *a, size_t i, const char *v, size_t n) {
+    if (reserve(a, i + 1) != 0 || text_reserve(a, n + 1) != 0) return -1;
+    size_t off = text_put(a, v, n);
+    if (a->values[i] != NO_TEXT) text_drop(a, a->values[i]);
+    else a->count++;
+    a->values[i] = off;
+    if (i >= a->len) a->len = i + 1;
+    return 0;
+}
+
+// Associative arrays
+
+static size_t probe(const Array *a, const char *key, uint64_t h) {
+    size_t mask = a->nslots - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        uint32_t s = a->slots[i];
+        if (!s) return i;
+        const Entry *e = &a->entries[s - 1];
+        if (e->hash == h && strcmp(text_at(a, e->key), key) == 0) return i;
+    }
+}
+
+static Entry *lookup_entry(const Array *a, const char *key) {
+    if (a->nslots == 0) return NULL;
+    uint32_t s = a->slots[probe(a, key, fnv1a(key))];
+    return s ? &a->entries[s - 1] : NULL;
+}
+
+// Size the table for want entries, squeezing out unset ones
+static int rehash(Array *a, size_t want) {
+    size_t n = ASSOC_SLOTS_INITIAL;
+    while (n < want * 2) n *= 2;
+    uint32_t *slots = xcalloc(ALLOC_VARS, n, sizeof(uint32_t));
+    if (!slots) return -1;
+    size_t live = 0;
+    for (size_t i = 0; i < a->nentries; i++) {
+        if (a->entries[i].key != NO_TEXT) a->entries[live++] = a->entries[i];
+    }
+    a->nentries = live;
+    xfree(a->slots);
+    a->slots = slots;
+    a->nslots = n;
+    for (size_t i = 0; i < live; i++) {
+        size_t j = a->entries[i].hash & (n - 1);
+        while (slots[j]) j = (j + 1) & (n - 1);
+        slots[j] = (uint32_t)(i + 1);
+    }
+    return 0;
+}
+
+static int set_assoc(Array *a, const char *key, const char *v, size_t n) {
+    Entry *e = lookup_entry(a, key);
+    if (e) {
+        if (text_reserve(a, n + 1) != 0) return -1;
+        text_drop(a, e->value);
+        e->value = text_put(a, v, n);
+        return 0;
+    }
+    if ((a->nentries + 1) * 4 > a->nslots * 3 && rehash(a, a->count + 1) != 0) return -1;
+    if (a->nentries == a->entries_cap) {
+        size_t cap = a->entries_cap ? a->entries_cap * 2 : 8;
+        Entry *tmp = xrealloc(ALLOC_VARS, a->entries, cap * sizeof(Entry));
+        if (!tmp) return -1;
+        a->entries = tmp;
+        a->entries_cap = cap;
+    }
+    uint64_t h = fnv1a(key);
+    size_t key_len = strlen(key);
+    if (text_reserve(a, key_len + 1 + n + 1) != 0) return -1;
+    size_t k = text_put(a, key, key_len);
+    a->entries[a->nentries] = (Entry){h, k, text_put(a, v, n)};
+    a->slots[probe(a, key, h)] = (uint32_t)++a->nentries;
+    a->count++;
+    return 0;
+}
+
+// Empty slot hole, shifting later slots of its probe run back into it
+static void erase_slot(Array *a, size_t hole) {
+    size_t mask = a->nslots - 1;
+    a->slots[hole] = 0;
+    for (size_t i = (hole + 1) & mask; a->slots[i]; i = (i + 1) & mask) {
+        size_t home = a->entries[a->slots[i] - 1].hash & mask;
+        // Move it unless its home lies cyclically in (hole, i]
+        int stays = hole <= i ? (home > hole && home <= i) : (home > hole || home <= i);
+        if (stays) continue;
+        a->slots[hole] = a->slots[i];
+        a->slots[i] = 0;
+        hole = i;
+    }
+}
+
+// Either kind
+
+static int set_element(Array *a, const char *sub, const char *v, size_t n) {
+    int ret;
+    if (a->assoc) {
+        if (!*sub) {
+            bad_subscript(a, sub, 0);
+            return -1;
+        }
+        ret = set_assoc(a, sub, v, n);
+    } else {
+        long i;
+        if (parse_index(a, sub, &i) != 0) {
+            bad_subscript(a, sub, strlen(sub));
+            return -1;
+        }
+        size_t gap = a->count > ARRAY_GAP_MIN ? a->count : ARRAY_GAP_MIN;
+        if ((size_t)i > a->len + gap) {
+            parse_error_prefix();
+            fprintf(stderr, "%s[%ld]: index too far past the end of the array (at most %zu)\n",
+                    a->name, i, a->len + gap);
+            return -1;
+        }
+        ret = set_indexed(a, (size_t)i, v, n);
+    }
+    if (ret != 0) perror("minibash");
+    return ret;
+}
+
+const char *array_get(const char *name, const char *sub) {
+    const Array *a = find(name);
+    if (!a) return NULL;
+    if (a->assoc) {
+        const Entry *e = lookup_entry(a, sub);
+        return e ? text_at(a, e->value) : NULL;
+    }
+    long i;
+    if (parse_index(a, sub, &i) != 0 || (size_t)i >= a->len || a->values[i] == NO_TEXT) {
+        return NULL;
+    }
+    return text_at(a, a->values[i]);
+}
+
+int array_set(const char *name, const char *sub, const char *value) {
+    Array *a = find(name);
+    if (!a && !(a = create(name, 0))) {
+        perror("minibash");
+        return -1;
+    }
+    return set_element(a, sub, value, strlen(value));
+}
+
+int array_unset(const char *name) {
+    for (size_t i = 0; i < narrays; i++) {
+        if (strcmp(arrays[i]->name, name) == 0) {
+            destroy(arrays[i]);
+            memmove(&arrays[i], &arrays[i + 1], (narrays - i - 1) * sizeof(Array *));
+            narrays--;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int array_unset_element(const char *name, const char *sub) {
+    Array *a = find(name);
+    if (!a) return -1;
+    if (a->assoc) {
+        if (a->nslots == 0) return -1;
+        size_t slot = probe(a, sub, fnv1a(sub));
+        if (!a->slots[slot]) return -1;
+        Entry *e = &a->entries[a->slots[slot] - 1];
+        erase_slot(a, slot);
+        text_drop(a, e->key);
+        text_drop(a, e->value);
+        e->key = e->value = NO_TEXT;
+        a->count--;
+        return 0;
+    }
+    long i;
+    if (parse_index(a, sub, &i) != 0 || (size_t)i >= a->len || a->values[i] == NO_TEXT) return -1;
+    text_drop(a, a->values[i]);
+    a->values[i] = NO_TEXT;
+    a->count--;
+    while (a->len > 0 && a->values[a->len - 1] == NO_TEXT) a->len--;
+    return 0;
+}
+
+long array_count(const char *name) {
+    const Array *a = find(name);
+    return a ? (long)a->count : -1;
+}
+
+int array_iter(const char *name, ArrayIter *it) {
+    it->array = find(name);
+    it->pos = 0;
+    return it->array ? 0 : -1;
+}
+
+int array_next(ArrayIter *it, const char **key, const char **value, char *num, size_t num_size) {
+    const Array *a = it->array;
+    if (a->assoc) {
+        while (it->pos < a->nentries && a->entries[it->pos].key == NO_TEXT) it->pos++;
+        if (it->pos == a->nentries) return 0;
+        const Entry *e = &a->entries[it->pos++];
+        if (key) *key = text_at(a, e->key);
+        if (value) *value = text_at(a, e->value);
+        return 1;
+    }
+    while (it->pos < a->len && a->values[it->pos] == NO_TEXT) it->pos++;
+    if (it->pos == a->len) return 0;
+    if (key) {
+        snprintf(num, num_size, "%zu", it->pos);
+        *key = num;
+    }
+    if (value) *value = text_at(a, a->values[it->pos]);
+    it->pos++;
+    return 1;
+}
+
+// One word of a list: [sub]=value sets that element, anything else the
+// next index
+static int assign_word(Array *a, const char *w, size_t len, size_t *next) {
+    const char *close = w[0] == '[' ? memchr(w, ']', len) : NULL;
+    if (close && close + 1 < w + len && close[1] == '=') {
+        char *sub = xstrndup(ALLOC_VARS, w + 1, (size_t)(close - w - 1));
+        if (!sub) {
+            perror("minibash");
+            return -1;
+        }
+        const char *v = close + 2;
+        int ret = set_element(a, sub, v, (size_t)(w + len - v));
+        long i;
+        if (ret == 0 && !a->assoc && parse_index(a, sub, &i) == 0) *next = (size_t)i + 1;
+        xfree(sub);
+        return ret;
+    }
+    if (a->assoc) {
+        parse_error_prefix();
+        fprintf(stderr, "%s: %.*s: must use subscript when assigning associative array\n",
+                a->name, (int)len, w);
+        return -1;
+    }
+    if (*next >= ARRAY_INDEX_MAX) {
+        bad_subscript(a, "", 0);
+        return -1;
+    }
+    if (set_indexed(a, (*next)++, w, len) != 0) {
+        perror("minibash");
+        return -1;
+    }
+    return 0;
+}
+
+static int no_redirs(const char *name, int nredirs) {
+    if (nredirs == 0) return 1;
+    parse_error_prefix();
+    fprintf(stderr, "%s: redirections are not allowed on an array assignment\n", name);
+    return 0;
+}
+
+// argv[0] starts name=( or name+=( and argv[argc - 1] ends with ), or argv
+// is the single word name[sub]=value. Returns -1 if it is neither.
+static int assign_words(int argc, char **argv, int nredirs) {
+    const char *w = argv[0];
+    size_t nl = name_len(w);
+    if (nl == 0 || nl >= NAME_MAX_LEN) return -1;
+    char name[NAME_MAX_LEN];
+    memcpy(name, w, nl);
+    name[nl] = '\0';
+
+    const char *p = w + nl;
+    if (*p == '[') {
+        const char *close = strchr(p, ']');
+        if (argc != 1 || !close || close[1] != '=') return -1;
+        if (!no_redirs(name, nredirs)) return 1;
+        char *sub = xstrndup(ALLOC_VARS, p + 1, (size_t)(close - p - 1));
+        if (!sub) {
+            perror("minibash");
+            return 1;
+        }
+        int ret = array_set(name, sub, close + 2);
+        xfree(sub);
+        return ret == 0 ? 0 : 1;
+    }
+    int append = *p == '+';
+    if (append) p++;
+    if (p[0] != '=' || p[1] != '(') return -1;
+    const char *last = argv[argc - 1];
+    size_t last_len = strlen(last);
+    if (last_len == 0 || last[last_len - 1] != ')' ||
+        (argc == 1 && last_len < (size_t)(p + 3 - w))) {
+        return -1;
+    }
+    if (!no_redirs(name, nredirs)) return 1;
+
+    Array *a = find(name);
+    if (!a && !(a = create(name, 0))) {
+        perror("minibash");
+        return 1;
+    }
+    size_t next = 0;
+    if (!append) clear(a);
+    else if (!a->assoc) next = a->len;
+
+    // Words are split again at blanks, as an expansion may have put some in
+    int status = 0;
+    for (int i = 0; i < argc; i++) {
+        const char *s = i == 0 ? p + 2 : argv[i];
+        const char *end = s + strlen(s) - (i == argc - 1);
+        while (s < end) {
+            while (s < end && (*s == ' ' || *s == '\t')) s++;
+            const char *word = s;
+            while (s < end && *s != ' ' && *s != '\t') s++;
+            if (s > word && assign_word(a, word, (size_t)(s - word), &next) != 0) status = 1;
+        }
+    }
+    return status;
+}
+
+int array_assignment(const Command *cmd) {
+    if (cmd->argc == 0) return -1;
+    return assign_words(cmd->argc, cmd->args, cmd->nredirs);
+}
+
+static int ends_list(const char *w) {
+    size_t n = strlen(w);
+    return n > 0 && w[n - 1] == ')';
+}
+
+static void print_array(OutBuf *out, const Array *a) {
+    outbuf_printf(out, "declare -%c %s=(", a->assoc ? 'A' : 'a', a->name);
+    ArrayIter it = {a, 0};
+    const char *key, *value;
+    char num[24];
+    int first = 1;
+    while (array_next(&it, &key, &value, num, sizeof(num))) {
+        outbuf_printf(out, "%s[%s]=\"%s\"", first ? "" : " ", key, value);
+        first = 0;
+    }
+    outbuf_puts(out, ")\n");
+}
+
+int builtin_declare(OutBuf *out, OutBuf *err, int argc, char **argv) {
+    int assoc = 0, indexed = 0, print = 0, i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        for (const char *f = argv[i] + 1; *f; f++) {
+            if (*f == 'a') indexed = 1;
+            else if (*f == 'A') assoc = 1;
+            else if (*f == 'p') print = 1;
+            else {
+                outbuf_printf(err, "minibash: declare: -%c: invalid option\n", *f);
+                outbuf_puts(err, "minibash: declare: usage: declare [-a|-A|-p] [name[=value]...]\n");
+                return 2;
+            }
+        }
+    }
+    if (i == argc) {
+        for (size_t k = 0; k < narrays; k++) {
+            if ((assoc && !arrays[k]->assoc) || (indexed && arrays[k]->assoc)) continue;
+            print_array(out, arrays[k]);
+        }
+        return 0;
+    }
+
+    int status = 0;
+    for (; i < argc; i++) {
+        size_t nl = name_len(argv[i]);
+        const char *rest = argv[i] + nl;
+        if (nl == 0 || nl >= NAME_MAX_LEN || (*rest && !strchr("=[+", *rest))) {
+            outbuf_printf(err, "minibash: declare: %s: not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        char name[NAME_MAX_LEN];
+        memcpy(name, argv[i], nl);
+        name[nl] = '\0';
+
+        Array *a = find(name);
+        if (print) {
+            if (a) {
+                print_array(out, a);
+            } else {
+                outbuf_printf(err, "minibash: declare: %s: not found\n", name);
+                status = 1;
+            }
+            continue;
+        }
+        if (a && a->assoc != assoc && (assoc || indexed)) {
+            outbuf_printf(err, "minibash: declare: %s: cannot convert %s array to %s array\n",
+                          name, a->assoc ? "associative" : "indexed",
+                          a->assoc ? "indexed" : "associative");
+            status = 1;
+            continue;
+        }
+        if (!a && (assoc || indexed || *rest == '[' || strstr(rest, "=(")) &&
+            !(a = create(name, assoc))) {
+            outbuf_printf(err, "minibash: declare: %s\n", strerror(errno));
+            return 1;
+        }
+        if (!*rest) continue;
+
+        // A list runs to the word that closes it
+        int n = 1;
+        if (strstr(rest, "=(")) {
+            while (i + n < argc && !ends_list(argv[i + n - 1])) n++;
+        }
+        int ret = assign_words(n, argv + i, 0);
+        if (ret < 0) {
+            // name=value: element 0 of an array, else a plain variable
+            const char *value = strchr(rest, '=') + 1;
+            ret = a ? set_element(a, "0", value, strlen(value)) : set_var(name, value);
+        }
+        if (ret != 0) status = 1;
+        i += n - 1;
+    }
+    return status;
+}
+
+// All of fd, in as few reads as its size allows
+static char *slurp(int fd, size_t *len) {
+    size_t cap = MAPFILE_CHUNK;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        off_t pos = lseek(fd, 0, SEEK_CUR);
+        // One more byte, so the read after the last sees end of file
+        if (pos >= 0 && st.st_size > pos) cap = (size_t)(st.st_size - pos) + 1;
+    }
+    char *buf = xmalloc(ALLOC_VARS, cap);
+    if (!buf) return NULL;
+    *len = 0;
+    for (;;) {
+        if (*len == cap) {
+            char *tmp = xrealloc(ALLOC_VARS, buf, cap * 2);
+            if (!tmp) {
+                xfree(buf);
+                return NULL;
+            }
+            buf = tmp;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, buf + *len, cap - *len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            int saved = errno;
+            xfree(buf);
+            errno = saved;
+            return NULL;
+        }
+        if (n == 0) break;
+        *len += (size_t)n;
+    }
+    return buf;
+}
+
+static int count_arg(const char *arg, long *count) {
+    char *end;
+    long n = arg ? strtol(arg, &end, 10) : -1;
+    if (!arg || end == arg || *end || n < 0) return -1;
+    *count = n;
+    return 0;
+}
+
+int builtin_mapfile(int argc, char **argv) {
+    int trim = 0;
+    long max = 0, skip = 0;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-t") == 0) {
+            trim = 1;
+        } else if ((strcmp(argv[i], "-n") == 0 && count_arg(argv[i + 1], &max) == 0) ||
+                   (strcmp(argv[i], "-s") == 0 && count_arg(argv[i + 1], &skip) == 0)) {
+            i++;
+        } else {
+            fprintf(stderr, "minibash: %s: usage: %s [-t] [-n count] [-s count] [name]\n",
+                    argv[0], argv[0]);
+            return 2;
+        }
+    }
+    const char *name = i < argc ? argv[i] : "MAPFILE";
+    if (name_len(name) != strlen(name) || strlen(name) >= NAME_MAX_LEN) {
+        fprintf(stderr, "minibash: %s: %s: not a valid identifier\n", argv[0], name);
+        return 1;
+    }
+    Array *a = find(name);
+    if (a && a->assoc) {
+        fprintf(stderr, "minibash: %s: %s: not an indexed array\n", argv[0], name);
+        return 1;
+    }
+
+    size_t len;
+    char *data = slurp(STDIN_FILENO, &len);
+    if (!data) {
+        fprintf(stderr, "minibash: %s: read error: %s\n", argv[0], strerror(errno));
+        return 1;
+    }
+    if (!a && !(a = create(name, 0))) goto nomem;
+    clear(a);
+
+    // Size the vector and the text once for all the lines
+    const char *end = data + len;
+    size_t lines = 0;
+    for (const char *p = data; p < end; lines++) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        p = nl ? nl + 1 : end;
+    }
+    size_t want = lines > (size_t)skip ? lines - (size_t)skip : 0;
+    if (max > 0 && want > (size_t)max) want = (size_t)max;
+    if (want > ARRAY_INDEX_MAX) {
+        fprintf(stderr, "minibash: %s: too many lines\n", argv[0]);
+        xfree(data);
+        return 1;
+    }
+    if (reserve(a, want) != 0 || text_reserve(a, len + want) != 0) goto nomem;
+
+    size_t line = 0, kept = 0;
+    for (const char *p = data; p < end && kept < want; line++) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *next = nl ? nl + 1 : end;
+        if (line >= (size_t)skip) {
+            size_t n = (size_t)(next - p) - (trim && nl);
+            if (set_indexed(a, kept++, p, n) != 0) goto nomem;
+        }
+        p = next;
+    }
+    stats_add("mapfile.runs", 1);
+    stats_add("mapfile.lines", kept);
+    stats_add("mapfile.bytes", len);
+    xfree(data);
+    return 0;
+
+nomem:
+    perror("minibash");
+    xfree(data);
+    return 1;
+}
+
+void array_cleanup(void) {
+    for (size_t i = 0; i < narrays; i++) destroy(arrays[i]);
+    xfree(arrays);
+    arrays = NULL;
+    narrays = arrays_cap = 0;
+}
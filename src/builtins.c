@@ -1,5 +1,15 @@
 #include "builtins.h"
-
+#include "alloc.h"
+#include "array.h"
+#include "execute.h"
+#include "func.h"
+#include "parallel.h"
+#include "source.h"
+#include "stats.h"
+#include "tee.h"
+#include "xargs.h"
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,13 +21,14 @@ static Aliases shell_aliases = {0};
 
 int builtins_init(void) {
     shell_vars.cap = 64;
-    shell_vars.names = calloc(shell_vars.cap, sizeof(char *));
-    shell_vars.values = calloc(shell_vars.cap, sizeof(char *));
-    if (!shell_vars.names || !shell_vars.values) return -1;
+    shell_vars.names = xcalloc(ALLOC_VARS, shell_vars.cap, sizeof(char *));
+    shell_vars.values = xcalloc(ALLOC_VARS, shell_vars.cap, sizeof(char *));
+    shell_vars.exported = xcalloc(ALLOC_VARS, shell_vars.cap, 1);
+    if (!shell_vars.names || !shell_vars.values || !shell_vars.exported) return -1;
 
     shell_aliases.cap = 64;
-    shell_aliases.cmds = calloc(shell_aliases.cap, sizeof(char *));
-    shell_aliases.aliases = calloc(shell_aliases.cap, sizeof(char *));
+    shell_aliases.cmds = xcalloc(ALLOC_VARS, shell_aliases.cap, sizeof(char *));
+    shell_aliases.aliases = xcalloc(ALLOC_VARS, shell_aliases.cap, sizeof(char *));
     if (!shell_aliases.cmds || !shell_aliases.aliases) return -1;
 
     return 0;
@@ -25,18 +36,19 @@ int builtins_init(void) {
 
 void builtins_cleanup(void) {
     for (int i = 0; i < shell_vars.count; i++) {
-        free(shell_vars.names[i]);
-        free(shell_vars.values[i]);
+        xfree(shell_vars.names[i]);
+        xfree(shell_vars.values[i]);
     }
-    free(shell_vars.names);
-    free(shell_vars.values);
+    xfree(shell_vars.names);
+    xfree(shell_vars.values);
+    xfree(shell_vars.exported);
 
     for (int i = 0; i < shell_aliases.count; i++) {
-        free(shell_aliases.cmds[i]);
-        free(shell_aliases.aliases[i]);
+        xfree(shell_aliases.cmds[i]);
+        xfree(shell_aliases.aliases[i]);
     }
-    free(shell_aliases.cmds);
-    free(shell_aliases.aliases);
+    xfree(shell_aliases.cmds);
+    xfree(shell_aliases.aliases);
 }
 
 int is_builtin(const char *cmd) {
@@ -49,7 +61,18 @@ int is_builtin(const char *cmd) {
             strcmp(cmd, "unset") == 0 ||
             strcmp(cmd, "alias") == 0 ||
             strcmp(cmd, "unalias") == 0 ||
-            strcmp(cmd, "echo") == 0);
+            strcmp(cmd, "echo") == 0 ||
+            strcmp(cmd, "local") == 0 ||
+            strcmp(cmd, "declare") == 0 ||
+            strcmp(cmd, "mapfile") == 0 ||
+            strcmp(cmd, "readarray") == 0 ||
+            strcmp(cmd, "return") == 0 ||
+            strcmp(cmd, "parallel") == 0 ||
+            strcmp(cmd, "source") == 0 ||
+            strcmp(cmd, ".") == 0 ||
+            strcmp(cmd, "stats") == 0 ||
+            strcmp(cmd, "tee") == 0 ||
+            strcmp(cmd, "xargs") == 0);
 }
 
 const char *get_cwd(void) {
@@ -77,27 +100,41 @@ int set_var(const char *name, const char *value) {
     // Check if already exists
     for (int i = 0; i < shell_vars.count; i++) {
         if (strcmp(shell_vars.names[i], name) == 0) {
-            free(shell_vars.values[i]);
-            shell_vars.values[i] = strdup(value ? value : "");
+            char *copy = xstrdup(ALLOC_VARS, value ? value : "");
+            if (!copy) return -1;
+            xfree(shell_vars.values[i]);
+            shell_vars.values[i] = copy;
             return 0;
         }
     }
 
-    // Add new variable
+    return append_var(name, value, 0);
+}
+
+int append_var(const char *name, const char *value, int exported) {
     if (shell_vars.count >= shell_vars.cap) {
-        shell_vars.cap *= 2;
-        char **tmp_names = realloc(shell_vars.names, shell_vars.cap * sizeof(char *));
-        char **tmp_values = realloc(shell_vars.values, shell_vars.cap * sizeof(char *));
-        if (!tmp_names || !tmp_values) return -1;
-        shell_vars.names = tmp_names;
-        shell_vars.values = tmp_values;
+        // The capacity only grows once all three arrays have
+        int cap = shell_vars.cap * 2;
+        char **tmp_names = xrealloc(ALLOC_VARS, shell_vars.names, cap * sizeof(char *));
+        if (tmp_names) shell_vars.names = tmp_names;
+        char **tmp_values = xrealloc(ALLOC_VARS, shell_vars.values, cap * sizeof(char *));
+        if (tmp_values) shell_vars.values = tmp_values;
+        unsigned char *tmp_exported = xrealloc(ALLOC_VARS, shell_vars.exported, cap);
+        if (tmp_exported) shell_vars.exported = tmp_exported;
+        if (!tmp_names || !tmp_values || !tmp_exported) return -1;
+        shell_vars.cap = cap;
     }
 
-    shell_vars.names[shell_vars.count] = strdup(name);
-    shell_vars.values[shell_vars.count] = strdup(value ? value : "");
-    if (!shell_vars.names[shell_vars.count] || !shell_vars.values[shell_vars.count]) {
+    char *name_copy = xstrdup(ALLOC_VARS, name);
+    char *value_copy = xstrdup(ALLOC_VARS, value ? value : "");
+    if (!name_copy || !value_copy) {
+        xfree(name_copy);
+        xfree(value_copy);
         return -1;
     }
+    shell_vars.names[shell_vars.count] = name_copy;
+    shell_vars.values[shell_vars.count] = value_copy;
+    shell_vars.exported[shell_vars.count] = exported ? 1 : 0;
     shell_vars.count++;
     return 0;
 }
@@ -106,12 +143,14 @@ int unset_var(const char *name) {
     if (!name) return -1;
     for (int i = 0; i < shell_vars.count; i++) {
         if (strcmp(shell_vars.names[i], name) == 0) {
-            free(shell_vars.names[i]);
-            free(shell_vars.values[i]);
+            if (shell_vars.exported[i]) unsetenv(name);
+            xfree(shell_vars.names[i]);
+            xfree(shell_vars.values[i]);
             // Shift remaining
             for (int j = i; j < shell_vars.count - 1; j++) {
                 shell_vars.names[j] = shell_vars.names[j + 1];
                 shell_vars.values[j] = shell_vars.values[j + 1];
+                shell_vars.exported[j] = shell_vars.exported[j + 1];
             }
             shell_vars.count--;
             return 0;
@@ -122,10 +161,24 @@ int unset_var(const char *name) {
 
 int export_var(const char *name, const char *value) {
     if (!name) return -1;
-    set_var(name, value);
+    if (set_var(name, value) != 0) return -1;
+    for (int i = shell_vars.count - 1; i >= 0; i--) {
+        if (strcmp(shell_vars.names[i], name) == 0) {
+            shell_vars.exported[i] = 1;
+            break;
+        }
+    }
     return setenv(name, value ? value : "", 1);
 }
 
+const EnvironmentVars *get_vars(void) {
+    return &shell_vars;
+}
+
+const Aliases *get_aliases(void) {
+    return &shell_aliases;
+}
+
 const char *get_alias(const char *name) {
     if (!name) return NULL;
     for (int i = 0; i < shell_aliases.count; i++) {
@@ -141,26 +194,37 @@ int set_alias(const char *name, const char *cmd) {
 
     for (int i = 0; i < shell_aliases.count; i++) {
         if (strcmp(shell_aliases.cmds[i], name) == 0) {
-            free(shell_aliases.aliases[i]);
-            shell_aliases.aliases[i] = strdup(cmd);
+            char *copy = xstrdup(ALLOC_VARS, cmd);
+            if (!copy) return -1;
+            xfree(shell_aliases.aliases[i]);
+            shell_aliases.aliases[i] = copy;
             return 0;
         }
     }
 
+    return append_alias(name, cmd);
+}
+
+int append_alias(const char *name, const char *cmd) {
     if (shell_aliases.count >= shell_aliases.cap) {
-        shell_aliases.cap *= 2;
-        char **tmp_cmds = realloc(shell_aliases.cmds, shell_aliases.cap * sizeof(char *));
-        char **tmp_aliases = realloc(shell_aliases.aliases, shell_aliases.cap * sizeof(char *));
+        int cap = shell_aliases.cap * 2;
+        char **tmp_cmds = xrealloc(ALLOC_VARS, shell_aliases.cmds, cap * sizeof(char *));
+        if (tmp_cmds) shell_aliases.cmds = tmp_cmds;
+        char **tmp_aliases = xrealloc(ALLOC_VARS, shell_aliases.aliases, cap * sizeof(char *));
+        if (tmp_aliases) shell_aliases.aliases = tmp_aliases;
         if (!tmp_cmds || !tmp_aliases) return -1;
-        shell_aliases.cmds = tmp_cmds;
-        shell_aliases.aliases = tmp_aliases;
+        shell_aliases.cap = cap;
     }
 
-    shell_aliases.cmds[shell_aliases.count] = strdup(name);
-    shell_aliases.aliases[shell_aliases.count] = strdup(cmd);
-    if (!shell_aliases.cmds[shell_aliases.count] || !shell_aliases.aliases[shell_aliases.count]) {
+    char *name_copy = xstrdup(ALLOC_VARS, name);
+    char *cmd_copy = xstrdup(ALLOC_VARS, cmd);
+    if (!name_copy || !cmd_copy) {
+        xfree(name_copy);
+        xfree(cmd_copy);
         return -1;
     }
+    shell_aliases.cmds[shell_aliases.count] = name_copy;
+    shell_aliases.aliases[shell_aliases.count] = cmd_copy;
     shell_aliases.count++;
     return 0;
 }
@@ -169,8 +233,8 @@ int unset_alias(const char *name) {
     if (!name) return -1;
     for (int i = 0; i < shell_aliases.count; i++) {
         if (strcmp(shell_aliases.cmds[i], name) == 0) {
-            free(shell_aliases.cmds[i]);
-            free(shell_aliases.aliases[i]);
+            xfree(shell_aliases.cmds[i]);
+            xfree(shell_aliases.aliases[i]);
             for (int j = i; j < shell_aliases.count - 1; j++) {
                 shell_aliases.cmds[j] = shell_aliases.cmds[j + 1];
                 shell_aliases.aliases[j] = shell_aliases.aliases[j + 1];
@@ -182,46 +246,64 @@ int unset_alias(const char *name) {
     return -1;
 }
 
+// Listings are handed to the kernel in pieces of about this size
+#define BUILTIN_FLUSH_AT (64 * 1024)
+
+static void io_flush(BuiltinIO *io) {
+    if (outbuf_flush(&io->out) != 0 && !io->error) io->error = errno;
+}
+
+// Called after each line of a listing
+static void io_line(BuiltinIO *io) {
+    if (io->out.len >= BUILTIN_FLUSH_AT) io_flush(io);
+}
+
 // Builtin: cd
-static int builtin_cd(int argc, char **argv) {
+static int builtin_cd(BuiltinIO *io, int argc, char **argv) {
     if (argc < 2) {
         const char *home = getenv("HOME");
         if (home && chdir(home) == 0) return 0;
-        fprintf(stderr, "minibash: cd: home directory not set\n");
+        outbuf_puts(&io->err, "minibash: cd: home directory not set\n");
         return 1;
     }
 
     if (chdir(argv[1]) != 0) {
-        fprintf(stderr, "minibash: cd: %s: No such file or directory\n", argv[1]);
+        outbuf_printf(&io->err, "minibash: cd: %s: No such file or directory\n", argv[1]);
         return 1;
     }
     return 0;
 }
 
 // Builtin: pwd
-static int builtin_pwd(int argc, char **argv) {
+static int builtin_pwd(BuiltinIO *io, int argc, char **argv) {
     (void)argc;
     (void)argv;
-    printf("%s\n", get_cwd());
+    outbuf_puts(&io->out, get_cwd());
+    outbuf_append(&io->out, "\n", 1);
     return 0;
 }
 
-// Builtin: exit
+// Builtin: exit. The status becomes the last status as the shell unwinds.
 static int builtin_exit(int argc, char **argv) {
     int code = 0;
     if (argc > 1) {
         code = atoi(argv[1]);
     }
-    exit(code);
+    execute_request_exit();
     return code;
 }
 
 // Builtin: export
-static int builtin_export(int argc, char **argv) {
+static int builtin_export(BuiltinIO *io, int argc, char **argv) {
     if (argc < 2) {
         // List all exported variables
         for (int i = 0; i < shell_vars.count; i++) {
-            printf("export %s=%s\n", shell_vars.names[i], shell_vars.values[i]);
+            outbuf_puts(&io->out, "export ");
+            outbuf_puts(&io->out, shell_vars.names[i]);
+            outbuf_append(&io->out, "=", 1);
+            outbuf_puts(&io->out, shell_vars.values[i]);
+            outbuf_append(&io->out, "\n", 1);
+            io_line(io);
         }
         return 0;
     }
@@ -238,11 +320,15 @@ static int builtin_export(int argc, char **argv) {
 }
 
 // Builtin: set
-static int builtin_set(int argc, char **argv) {
+static int builtin_set(BuiltinIO *io, int argc, char **argv) {
     if (argc < 2) {
         // List all variables
         for (int i = 0; i < shell_vars.count; i++) {
-            printf("%s=%s\n", shell_vars.names[i], shell_vars.values[i]);
+            outbuf_puts(&io->out, shell_vars.names[i]);
+            outbuf_append(&io->out, "=", 1);
+            outbuf_puts(&io->out, shell_vars.values[i]);
+            outbuf_append(&io->out, "\n", 1);
+            io_line(io);
         }
         return 0;
     }
@@ -258,20 +344,64 @@ static int builtin_set(int argc, char **argv) {
 }
 
 // Builtin: unset
-static int builtin_unset(int argc, char **argv) {
+static int builtin_unset(BuiltinIO *io, int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "-f") == 0) {
+        return func_unset(argv[2]) == 0 ? 0 : 1;
+    }
     if (argc < 2) {
-        fprintf(stderr, "minibash: unset: usage: unset name\n");
+        outbuf_puts(&io->err, "minibash: unset: usage: unset [-f] name\n");
         return 1;
     }
-    return unset_var(argv[1]);
+    char *open = strchr(argv[1], '[');
+    size_t len = strlen(argv[1]);
+    if (open && argv[1][len - 1] == ']') {
+        argv[1][len - 1] = '\0';
+        *open = '\0';
+        int ret = array_unset_element(argv[1], open + 1);
+        *open = '[';
+        argv[1][len - 1] = ']';
+        return ret;
+    }
+    int ret = unset_var(argv[1]);
+    return array_unset(argv[1]) == 0 ? 0 : ret;
+}
+
+// Builtin: local
+static int builtin_local(BuiltinIO *io, int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        char *eq = strchr(argv[i], '=');
+        if (eq) *eq = '\0';
+        int ret = func_local(argv[i], eq ? eq + 1 : NULL);
+        if (eq) *eq = '=';
+        if (ret != 0) {
+            outbuf_puts(&io->err, "minibash: local: can only be used in a function\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Builtin: return
+static int builtin_return(BuiltinIO *io, int argc, char **argv) {
+    int status = argc > 1 ? atoi(argv[1]) & 0xff : execute_last_status();
+    if (func_return(status) != 0) {
+        outbuf_puts(&io->err, "minibash: return: can only return from a function or sourced script\n");
+        return 1;
+    }
+    return status;
 }
 
 // Builtin: alias
-static int builtin_alias(int argc, char **argv) {
+static int builtin_alias(BuiltinIO *io, int argc, char **argv) {
     if (argc < 2) {
         // List all aliases
         for (int i = 0; i < shell_aliases.count; i++) {
-            printf("alias %s='%s'\n", shell_aliases.cmds[i], shell_aliases.aliases[i]);
+            outbuf_puts(&io->out, "alias ");
+            outbuf_puts(&io->out, shell_aliases.cmds[i]);
+            outbuf_append(&io->out, "='", 2);
+            outbuf_puts(&io->out, shell_aliases.aliases[i]);
+            outbuf_append(&io->out, "'\n", 2);
+            io_line(io);
         }
         return 0;
     }
@@ -287,36 +417,92 @@ static int builtin_alias(int argc, char **argv) {
 }
 
 // Builtin: unalias
-static int builtin_unalias(int argc, char **argv) {
+static int builtin_unalias(BuiltinIO *io, int argc, char **argv) {
     if (argc < 2) {
-        fprintf(stderr, "minibash: unalias: usage: unalias name\n");
+        outbuf_puts(&io->err, "minibash: unalias: usage: unalias name\n");
         return 1;
     }
     return unset_alias(argv[1]);
 }
 
 // Builtin: echo
-static int builtin_echo(int argc, char **argv) {
+static int builtin_echo(BuiltinIO *io, int argc, char **argv) {
     for (int i = 1; i < argc; i++) {
-        printf("%s", argv[i]);
-        if (i < argc - 1) printf(" ");
+        outbuf_puts(&io->out, argv[i]);
+        if (i < argc - 1) outbuf_append(&io->out, " ", 1);
     }
-    printf("\n");
+    outbuf_append(&io->out, "\n", 1);
     return 0;
 }
 
-int execute_builtin(const char *cmd, int argc, char **argv) {
-    if (!cmd) return 1;
+int builtin_needs_fds(const char *cmd) {
+    return cmd && (strcmp(cmd, "parallel") == 0 ||
+                   strcmp(cmd, "mapfile") == 0 ||
+                   strcmp(cmd, "readarray") == 0 ||
+                   strcmp(cmd, "source") == 0 ||
+                   strcmp(cmd, ".") == 0 ||
+                   strcmp(cmd, "tee") == 0 ||
+                   strcmp(cmd, "xargs") == 0);
+}
 
-    if (strcmp(cmd, "cd") == 0) return builtin_cd(argc, argv);
-    if (strcmp(cmd, "pwd") == 0) return builtin_pwd(argc, argv);
-    if (strcmp(cmd, "exit") == 0) return builtin_exit(argc, argv);
-    if (strcmp(cmd, "export") == 0) return builtin_export(argc, argv);
-    if (strcmp(cmd, "set") == 0) return builtin_set(argc, argv);
-    if (strcmp(cmd, "unset") == 0) return builtin_unset(argc, argv);
-    if (strcmp(cmd, "alias") == 0) return builtin_alias(argc, argv);
-    if (strcmp(cmd, "unalias") == 0) return builtin_unalias(argc, argv);
-    if (strcmp(cmd, "echo") == 0) return builtin_echo(argc, argv);
+int builtin_is_filter(const char *cmd) {
+    return cmd && (strcmp(cmd, "echo") == 0 ||
+                   strcmp(cmd, "pwd") == 0 ||
+                   strcmp(cmd, "stats") == 0 ||
+                   strcmp(cmd, "parallel") == 0 ||
+                   strcmp(cmd, "mapfile") == 0 ||
+                   strcmp(cmd, "readarray") == 0 ||
+                   strcmp(cmd, "tee") == 0 ||
+                   strcmp(cmd, "xargs") == 0);
+}
 
+static int dispatch(BuiltinIO *io, const char *cmd, int argc, char **argv) {
+    if (strcmp(cmd, "cd") == 0) return builtin_cd(io, argc, argv);
+    if (strcmp(cmd, "pwd") == 0) return builtin_pwd(io, argc, argv);
+    if (strcmp(cmd, "exit") == 0) return builtin_exit(argc, argv);
+    if (strcmp(cmd, "export") == 0) return builtin_export(io, argc, argv);
+    if (strcmp(cmd, "set") == 0) return builtin_set(io, argc, argv);
+    if (strcmp(cmd, "unset") == 0) return builtin_unset(io, argc, argv);
+    if (strcmp(cmd, "alias") == 0) return builtin_alias(io, argc, argv);
+    if (strcmp(cmd, "unalias") == 0) return builtin_unalias(io, argc, argv);
+    if (strcmp(cmd, "echo") == 0) return builtin_echo(io, argc, argv);
+    if (strcmp(cmd, "local") == 0) return builtin_local(io, argc, argv);
+    if (strcmp(cmd, "declare") == 0) return builtin_declare(&io->out, &io->err, argc, argv);
+    if (strcmp(cmd, "return") == 0) return builtin_return(io, argc, argv);
+    if (strcmp(cmd, "stats") == 0) return builtin_stats(&io->out, &io->err, argc, argv);
     return 1;
 }
+
+int execute_builtin_io(const char *cmd, int argc, char **argv, int out_fd, int err_fd) {
+    if (!cmd) return 1;
+
+    BuiltinIO io;
+    outbuf_init(&io.out, out_fd);
+    outbuf_init(&io.err, err_fd);
+    io.error = 0;
+    int ret = dispatch(&io, cmd, argc, argv);
+    io_flush(&io);
+    if (io.error) {
+        outbuf_printf(&io.err, "minibash: %s: write error: %s\n", cmd, strerror(io.error));
+        ret = 1;
+    }
+    outbuf_flush(&io.err);
+    outbuf_free(&io.out);
+    outbuf_free(&io.err);
+    return ret;
+}
+
+int execute_builtin(const char *cmd, int argc, char **argv) {
+    if (!cmd) return 1;
+
+    if (strcmp(cmd, "parallel") == 0) return builtin_parallel(argc, argv);
+    if (strcmp(cmd, "source") == 0 || strcmp(cmd, ".") == 0) return builtin_source(argc, argv);
+    if (strcmp(cmd, "mapfile") == 0 || strcmp(cmd, "readarray") == 0) {
+        return builtin_mapfile(argc, argv);
+    }
+    if (strcmp(cmd, "tee") == 0) return builtin_tee(argc, argv);
+    if (strcmp(cmd, "xargs") == 0) return builtin_xargs(argc, argv);
+    // Whatever stdio holds must come out before the builtin's own writes
+    fflush(stdout);
+    return execute_builtin_io(cmd, argc, argv, STDOUT_FILENO, STDERR_FILENO);
+}
@@ -1,29 +1,29 @@
 #include "command.h"
+#include "alloc.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 void init_command(Command *cmd) {
-    cmd->args = calloc(MAX_ARGS, sizeof(char *));
+    cmd->args = cmd->arg_store = xcalloc(ALLOC_PARSER, MAX_ARGS, sizeof(char *));
     if (!cmd->args) {
         perror("calloc");
         exit(EXIT_FAILURE);
     }
     cmd->argc = 0;
     cmd->name = NULL;
-    cmd->redirect_path = NULL;
-    cmd->input_path = NULL;
-    cmd->heredoc_delim = NULL;
+    cmd->nredirs = 0;
+    cmd->nsubs = 0;
     cmd->output_type = OUTPUT_NONE;
 }
 
 void free_command(Command *cmd) {
-    free(cmd->args);
-    cmd->args = NULL;
+    xfree(cmd->arg_store);
+    cmd->args = cmd->arg_store = NULL;
     cmd->name = NULL;
-    cmd->redirect_path = NULL;
-    cmd->input_path = NULL;
-    cmd->heredoc_delim = NULL;
+    cmd->nredirs = 0;
+    cmd->nsubs = 0;
     cmd->argc = 0;
     cmd->output_type = OUTPUT_NONE;
 }
@@ -41,3 +41,61 @@ void free_pipeline(Pipeline *pipeline) {
     }
     pipeline->count = 0;
 }
+
+void reset_pipeline(Pipeline *pipeline) {
+    for (int i = 0; i < MAX_CMDS; i++) {
+        Command *cmd = &pipeline->cmds[i];
+        cmd->args = cmd->arg_store;
+        cmd->argc = 0;
+        cmd->name = NULL;
+        cmd->nredirs = 0;
+        cmd->nsubs = 0;
+        cmd->output_type = OUTPUT_NONE;
+    }
+    pipeline->count = 0;
+}
+
+static void *copy_to(Arena *arena, const void *src, size_t size) {
+    if (size == 0) return NULL;
+    void *p = arena_alloc(arena, size);
+    if (p) memcpy(p, src, size);
+    return p;
+}
+
+int pack_pipeline(PackedPipeline *dst, const Pipeline *src, Arena *arena) {
+    dst->count = src->count;
+    dst->cmds = arena_alloc(arena, (size_t)src->count * sizeof(PackedCommand));
+    if (!dst->cmds) return -1;
+    for (int i = 0; i < src->count; i++) {
+        const Command *cmd = &src->cmds[i];
+        PackedCommand *pc = &dst->cmds[i];
+        pc->argc = cmd->argc;
+        pc->nredirs = cmd->nredirs;
+        pc->nsubs = cmd->nsubs;
+        pc->output_type = cmd->output_type;
+        pc->args = copy_to(arena, cmd->args, (size_t)(cmd->argc + 1) * sizeof(char *));
+        pc->redirs = copy_to(arena, cmd->redirs, (size_t)cmd->nredirs * sizeof(Redir));
+        pc->subs = copy_to(arena, cmd->subs, (size_t)cmd->nsubs * sizeof(ProcSub));
+        if (!pc->args || (cmd->nredirs && !pc->redirs) || (cmd->nsubs && !pc->subs)) return -1;
+    }
+    return 0;
+}
+
+int unpack_pipeline(Pipeline *dst, char **args[], const PackedPipeline *src, Arena *arena) {
+    dst->count = src->count;
+    for (int i = 0; i < src->count; i++) {
+        const PackedCommand *pc = &src->cmds[i];
+        Command *cmd = &dst->cmds[i];
+        if (!args[i] && !(args[i] = arena_alloc(arena, MAX_ARGS * sizeof(char *)))) return -1;
+        cmd->args = cmd->arg_store = args[i];
+        memcpy(cmd->args, pc->args, (size_t)(pc->argc + 1) * sizeof(char *));
+        cmd->argc = pc->argc;
+        cmd->name = cmd->args[0];
+        cmd->output_type = pc->output_type;
+        cmd->nredirs = pc->nredirs;
+        if (pc->nredirs) memcpy(cmd->redirs, pc->redirs, (size_t)pc->nredirs * sizeof(Redir));
+        cmd->nsubs = pc->nsubs;
+        if (pc->nsubs) memcpy(cmd->subs, pc->subs, (size_t)pc->nsubs * sizeof(ProcSub));
+    }
+    return 0;
+}
@@ -1,140 +1,637 @@
 #include "completion.h"
+#include "alloc.h"
+#include "fuzzy.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/eventfd.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
-static int is_executable(const char *path) {
-    struct stat st;
-    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+// Sorted, de-duplicated names of the executables on $PATH. Rebuilt only when
+// $PATH changes or one of its directories is modified; completions hold a
+// reference so their views stay valid across a rebuild.
+typedef struct ExecIndex {
+    atomic_int refs;
+    char *path;
+    int ndirs;
+    struct timespec *mtimes;
+    Arena names;
+    const char **sorted;
+    uint64_t *masks;    // fuzzy_mask() of each name
+    int count;
+} ExecIndex;
+
+// Shared by the completion worker and command lookups in execute.c
+static ExecIndex *exec_index = NULL;
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Background completion state. Bumping completion_gen cancels whatever the
+// worker is doing; it checks between directory entries.
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int started;
+    int efd;
+    char *prefix;           // queued request, NULL if none
+    char *path;
+    int flags;
+    unsigned req_gen;
+    Completion *building;   // guarded by lock while shared
+    Completion *ready;
+    unsigned ready_gen;
+} worker = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .efd = -1,
+};
+
+static atomic_uint completion_gen;
+static _Thread_local unsigned active_gen;
+
+static int cancelled(void) {
+    return active_gen != 0 && atomic_load(&completion_gen) != active_gen;
+}
+
+static void exec_index_release(ExecIndex *idx) {
+    if (!idx || atomic_fetch_sub(&idx->refs, 1) > 1) return;
+    xfree(idx->path);
+    xfree(idx->mtimes);
+    xfree(idx->sorted);
+    xfree(idx->masks);
+    arena_free(&idx->names);
+    xfree(idx);
+}
+
+static int count_dirs(const char *path) {
+    int n = 1;
+    for (const char *p = path; *p; p++) {
+        if (*p == ':') n++;
+    }
+    return n;
 }
 
-static void add_match(Completion *c, const char *match) {
-    if (c->count == 0) {
-        c->matches = malloc(16 * sizeof(char *));
-    } else if ((c->count % 16) == 0) {
-        c->matches = realloc(c->matches, (c->count + 16) * sizeof(char *));
+// Fill mtimes[] for each entry in path; missing directories get zero
+static void dir_mtimes(const char *path, struct timespec *mtimes, int ndirs) {
+    const char *p = path;
+    for (int i = 0; i < ndirs; i++) {
+        const char *end = strchr(p, ':');
+        size_t n = end ? (size_t)(end - p) : strlen(p);
+        char dir[PATH_MAX];
+        struct stat st;
+        mtimes[i].tv_sec = 0;
+        mtimes[i].tv_nsec = 0;
+        if (n > 0 && n < sizeof(dir)) {
+            memcpy(dir, p, n);
+            dir[n] = '\0';
+            if (stat(dir, &st) == 0) mtimes[i] = st.st_mtim;
+        }
+        p = end ? end + 1 : p + n;
     }
-    if (!c->matches) return;
-    c->matches[c->count++] = strdup(match);
 }
 
-static void complete_from_path(Completion *c, const char *prefix) {
-    char *path = getenv("PATH");
-    if (!path) return;
+static int exec_index_fresh(const ExecIndex *idx, const char *path) {
+    if (strcmp(idx->path, path) != 0) return 0;
+    struct timespec *now = xmalloc(ALLOC_COMPLETION, (size_t)idx->ndirs * sizeof(struct timespec));
+    if (!now) return 0;
+    dir_mtimes(path, now, idx->ndirs);
+    int fresh = 1;
+    for (int i = 0; i < idx->ndirs; i++) {
+        if (now[i].tv_sec != idx->mtimes[i].tv_sec || now[i].tv_nsec != idx->mtimes[i].tv_nsec) {
+            fresh = 0;
+            break;
+        }
+    }
+    xfree(now);
+    return fresh;
+}
 
-    char *dup = strdup(path);
-    if (!dup) return;
+static int cmp_matches(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
 
+static int is_executable_at(int dfd, const struct dirent *ent) {
+    if (ent->d_type != DT_REG) {
+        if (ent->d_type != DT_LNK && ent->d_type != DT_UNKNOWN) return 0;
+        struct stat st;
+        if (fstatat(dfd, ent->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)) return 0;
+    }
+    return faccessat(dfd, ent->d_name, X_OK, 0) == 0;
+}
+
+static ExecIndex *exec_index_build(const char *path) {
+    ExecIndex *idx = xcalloc(ALLOC_COMPLETION, 1, sizeof(ExecIndex));
+    if (!idx) return NULL;
+    idx->refs = 1;
+    arena_init(&idx->names);
+    idx->path = xstrdup(ALLOC_COMPLETION, path);
+    idx->ndirs = count_dirs(path);
+    idx->mtimes = xcalloc(ALLOC_COMPLETION, (size_t)idx->ndirs, sizeof(struct timespec));
+    if (!idx->path || !idx->mtimes) {
+        exec_index_release(idx);
+        return NULL;
+    }
+    // Take the mtimes first so a change made while scanning forces a rebuild
+    dir_mtimes(path, idx->mtimes, idx->ndirs);
+
+    int cap = 1024;
+    idx->sorted = xmalloc(ALLOC_COMPLETION, (size_t)cap * sizeof(char *));
+    if (!idx->sorted) {
+        exec_index_release(idx);
+        return NULL;
+    }
+
+    char *dup = xstrdup(ALLOC_COMPLETION, path);
     char *saveptr = NULL;
-    char *dir = strtok_r(dup, ":", &saveptr);
+    char *dir = dup ? strtok_r(dup, ":", &saveptr) : NULL;
     while (dir) {
         DIR *d = opendir(dir);
-        if (!d) {
-            dir = strtok_r(NULL, ":", &saveptr);
-            continue;
-        }
-        struct dirent *ent;
-        while ((ent = readdir(d)) != NULL) {
-            if (ent->d_name[0] == '.') continue;
-            if (strncmp(ent->d_name, prefix, strlen(prefix)) == 0) {
-                char candidate[512];
-                snprintf(candidate, sizeof(candidate), "%s/%s", dir, ent->d_name);
-                if (is_executable(candidate)) {
-                    int exists = 0;
-                    for (int i = 0; i < c->count; i++) {
-                        if (strcmp(c->matches[i], ent->d_name) == 0) {
-                            exists = 1;
-                            break;
-                        }
-                    }
-                    if (!exists) {
-                        add_match(c, ent->d_name);
-                    }
+        if (d) {
+            int dfd = dirfd(d);
+            struct dirent *ent;
+            while ((ent = readdir(d)) != NULL) {
+                if (ent->d_name[0] == '.') continue;
+                if (!is_executable_at(dfd, ent)) continue;
+                if (idx->count == cap) {
+                    const char **tmp = xrealloc(ALLOC_COMPLETION, idx->sorted, (size_t)cap * 2 * sizeof(char *));
+                    if (!tmp) break;
+                    idx->sorted = tmp;
+                    cap *= 2;
                 }
+                const char *name = arena_strdup(&idx->names, ent->d_name);
+                if (!name) break;
+                idx->sorted[idx->count++] = name;
             }
+            closedir(d);
         }
-        closedir(d);
         dir = strtok_r(NULL, ":", &saveptr);
     }
+    xfree(dup);
 
-    free(dup);
+    qsort(idx->sorted, (size_t)idx->count, sizeof(char *), cmp_matches);
+    int unique = 0;
+    for (int i = 0; i < idx->count; i++) {
+        if (unique == 0 || strcmp(idx->sorted[unique - 1], idx->sorted[i]) != 0) {
+            idx->sorted[unique++] = idx->sorted[i];
+        }
+    }
+    idx->count = unique;
+
+    idx->masks = xmalloc(ALLOC_COMPLETION, (size_t)(idx->count ? idx->count : 1) * sizeof(uint64_t));
+    if (!idx->masks) {
+        exec_index_release(idx);
+        return NULL;
+    }
+    for (int i = 0; i < idx->count; i++) {
+        idx->masks[i] = fuzzy_mask(idx->sorted[i]);
+    }
+    return idx;
 }
 
-static void complete_from_fs(Completion *c, const char *prefix) {
-    const char *sep = strrchr(prefix, '/');
-    const char *dir_part = ".";
-    const char *file_part = prefix;
-
-    char dir_buf[512] = {0};
-    if (sep) {
-        int dir_len = (int)(sep - prefix);
-        if (dir_len == 0) {
-            dir_part = "/";
+// Published index with a reference taken for the caller, or NULL. Only
+// ever held for the pointer: lookups and forks must not wait on a scan.
+static ExecIndex *exec_index_current(void) {
+    pthread_mutex_lock(&index_lock);
+    ExecIndex *idx = exec_index;
+    if (idx) atomic_fetch_add(&idx->refs, 1);
+    pthread_mutex_unlock(&index_lock);
+    return idx;
+}
+
+// Up-to-date index with a reference taken for the caller, or NULL. A scan
+// once started is finished and published even if the completion that
+// asked for it is cancelled, so a slow $PATH is only scanned once.
+static ExecIndex *exec_index_acquire(const char *path) {
+    if (!path) return NULL;
+    ExecIndex *cur = exec_index_current();
+    if (cur && exec_index_fresh(cur, path)) return cur;
+
+    ExecIndex *fresh = exec_index_build(path);
+    if (!fresh) {
+        exec_index_release(cur);
+        return NULL;
+    }
+    pthread_mutex_lock(&index_lock);
+    if (exec_index == cur) {
+        exec_index_release(exec_index);
+        exec_index = fresh;
+        atomic_fetch_add(&fresh->refs, 1);
+    } else {
+        // Another thread published a newer scan meanwhile
+        exec_index_release(fresh);
+        fresh = exec_index;
+        if (fresh) atomic_fetch_add(&fresh->refs, 1);
+    }
+    pthread_mutex_unlock(&index_lock);
+    exec_index_release(cur);
+    return fresh;
+}
+
+// First position whose name does not sort before prefix or, with
+// past_prefix, the first past every name starting with prefix
+static int lower_bound(const ExecIndex *idx, const char *prefix, size_t plen, int past_prefix) {
+    int lo = 0, hi = idx->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int cmp = past_prefix ? strncmp(idx->sorted[mid], prefix, plen) : strcmp(idx->sorted[mid], prefix);
+        if (cmp < 0 || (past_prefix && cmp == 0)) {
+            lo = mid + 1;
         } else {
-            strncpy(dir_buf, prefix, (size_t)dir_len);
-            dir_part = dir_buf;
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int completion_refresh_index(const char *path) {
+    ExecIndex *idx = exec_index_acquire(path);
+    if (!idx) return -1;
+    exec_index_release(idx);
+    return 0;
+}
+
+int completion_has_command(const char *path, const char *name) {
+    if (!path) return -1;
+    int found = -1;
+    ExecIndex *idx = exec_index_current();
+    if (idx && exec_index_fresh(idx, path)) {
+        int i = lower_bound(idx, name, strlen(name), 0);
+        found = i < idx->count && strcmp(idx->sorted[i], name) == 0;
+    }
+    exec_index_release(idx);
+    return found;
+}
+
+static int reserve_matches(Completion *c, int extra) {
+    if (c->count + extra <= c->cap) return 0;
+    int cap = c->cap ? c->cap : 16;
+    while (cap < c->count + extra) cap *= 2;
+    const char **tmp = xrealloc(ALLOC_COMPLETION, c->matches, (size_t)cap * sizeof(char *));
+    if (!tmp) return -1;
+    c->matches = tmp;
+    if (c->flags & COMPLETE_FUZZY) {
+        int *scores = xrealloc(ALLOC_COMPLETION, c->scores, (size_t)cap * sizeof(int));
+        if (!scores) return -1;
+        c->scores = scores;
+    }
+    c->cap = cap;
+    return 0;
+}
+
+static void complete_from_path(Completion *c, const char *prefix, const char *path) {
+    ExecIndex *idx = exec_index_acquire(path);
+    if (!idx) return;
+
+    size_t plen = strlen(prefix);
+    int lo = lower_bound(idx, prefix, plen, 0);
+    int hi = lower_bound(idx, prefix, plen, 1);
+
+    if (c->shared) pthread_mutex_lock(&worker.lock);
+    c->index = idx;
+    if (hi > lo && reserve_matches(c, hi - lo) == 0) {
+        memcpy(c->matches + c->count, idx->sorted + lo, (size_t)(hi - lo) * sizeof(char *));
+        c->count += hi - lo;
+    }
+    if (c->shared) pthread_mutex_unlock(&worker.lock);
+}
+
+// Fuzzy variant: every name in the index whose character classes cover the
+// query's is scored, the rest are rejected by the vectorized prefilter.
+static void fuzzy_from_path(Completion *c, const char *query, const char *path) {
+    ExecIndex *idx = exec_index_acquire(path);
+    if (!idx) return;
+    if (c->shared) pthread_mutex_lock(&worker.lock);
+    c->index = idx;
+    if (c->shared) pthread_mutex_unlock(&worker.lock);
+
+    int *hits = xmalloc(ALLOC_COMPLETION, (size_t)(idx->count ? idx->count : 1) * sizeof(int));
+    if (!hits) return;
+    int n = fuzzy_prefilter(idx->masks, idx->count, fuzzy_mask(query), hits);
+    for (int i = 0; i < n && !cancelled(); i++) {
+        const char *name = idx->sorted[hits[i]];
+        int score = fuzzy_score(query, name);
+        if (score < 0) continue;
+        if (c->shared) pthread_mutex_lock(&worker.lock);
+        if (reserve_matches(c, 1) == 0) {
+            c->scores[c->count] = score;
+            c->matches[c->count++] = name;
         }
-        file_part = sep + 1;
+        if (c->shared) pthread_mutex_unlock(&worker.lock);
     }
+    xfree(hits);
+}
+
+// Appends dir_part + name (+ "/" for directories) as one arena string. The
+// lock is only taken while the main thread may be snapshotting.
+static void add_fs_match(Completion *c, const char *dir_part, size_t dir_len,
+                         const char *name, int is_dir, int score) {
+    size_t name_len = strlen(name);
+    if (c->shared) pthread_mutex_lock(&worker.lock);
+    char *m = reserve_matches(c, 1) == 0 ? arena_alloc(&c->strings, dir_len + name_len + 2) : NULL;
+    if (m) {
+        memcpy(m, dir_part, dir_len);
+        memcpy(m + dir_len, name, name_len);
+        size_t n = dir_len + name_len;
+        if (is_dir) m[n++] = '/';
+        m[n] = '\0';
+        if (c->scores) c->scores[c->count] = score;
+        c->matches[c->count++] = m;
+    }
+    if (c->shared) pthread_mutex_unlock(&worker.lock);
+}
+
+// Whether ent is a directory, from d_type where the filesystem provides it.
+// Only unknown types and symlinks (which may point at directories) cost an
+// fstatat() relative to the already open directory.
+static int entry_is_dir(int dfd, const struct dirent *ent) {
+    if (ent->d_type == DT_DIR) return 1;
+    if (ent->d_type != DT_UNKNOWN && ent->d_type != DT_LNK) return 0;
+    struct stat st;
+    return fstatat(dfd, ent->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void complete_from_fs(Completion *c, const char *prefix) {
+    const char *sep = strrchr(prefix, '/');
+    const char *file_part = sep ? sep + 1 : prefix;
+    // Matches keep the prefix's directory text exactly as typed
+    size_t dir_len = sep ? (size_t)(sep - prefix) + 1 : 0;
 
-    DIR *d = opendir(dir_part);
+    DIR *d;
+    if (!sep) {
+        d = opendir(".");
+    } else {
+        char *dir = xstrndup(ALLOC_COMPLETION, prefix, dir_len);
+        if (!dir) return;
+        d = opendir(dir);
+        xfree(dir);
+    }
     if (!d) return;
 
+    int dfd = dirfd(d);
+    size_t file_len = strlen(file_part);
+    int fuzzy = (c->flags & COMPLETE_FUZZY) && file_len > 0;
+    uint64_t need = fuzzy ? fuzzy_mask(file_part) : 0;
     struct dirent *ent;
-    while ((ent = readdir(d)) != NULL) {
+    while ((ent = readdir(d)) != NULL && !cancelled()) {
         if (ent->d_name[0] == '.') continue;
-        if (strncmp(ent->d_name, file_part, strlen(file_part)) != 0) continue;
-
-        char candidate[512];
-        snprintf(candidate, sizeof(candidate), "%s/%s", dir_part, ent->d_name);
-        
-        struct stat st;
-        if (stat(candidate, &st) == 0) {
-            char match[512];
-            if (sep) {
-                snprintf(match, sizeof(match), "%s/%s", dir_part, ent->d_name);
-            } else {
-                snprintf(match, sizeof(match), "%s", ent->d_name);
-            }
-            if (S_ISDIR(st.st_mode)) {
-                char match_dir[512];
-                snprintf(match_dir, sizeof(match_dir), "%s/", match);
-                add_match(c, match_dir);
-            } else {
-                add_match(c, match);
-            }
+        int score = 0;
+        if (fuzzy) {
+            if ((fuzzy_mask(ent->d_name) & need) != need) continue;
+            score = fuzzy_score(file_part, ent->d_name);
+            if (score < 0) continue;
+        } else if (strncmp(ent->d_name, file_part, file_len) != 0) {
+            continue;
         }
+        add_fs_match(c, prefix, dir_len, ent->d_name, entry_is_dir(dfd, ent), score);
     }
     closedir(d);
 }
 
-Completion *completion_find(const char *prefix) {
-    Completion *c = calloc(1, sizeof(Completion));
-    if (!c) return NULL;
+// Sort the matches and drop duplicates (a command also present in the
+// current directory)
+static void sort_matches(Completion *c) {
+    if (c->shared) pthread_mutex_lock(&worker.lock);
+    qsort(c->matches, (size_t)c->count, sizeof(char *), cmp_matches);
+    int unique = 0;
+    for (int i = 0; i < c->count; i++) {
+        if (unique == 0 || strcmp(c->matches[unique - 1], c->matches[i]) != 0) {
+            c->matches[unique++] = c->matches[i];
+        }
+    }
+    c->count = unique;
+    if (c->shared) pthread_mutex_unlock(&worker.lock);
+}
+
+typedef struct Ranked {
+    const char *match;
+    int score;
+} Ranked;
+
+static int cmp_ranked(const void *a, const void *b) {
+    const Ranked *x = a, *y = b;
+    if (x->score != y->score) return y->score - x->score;
+    size_t lx = strlen(x->match), ly = strlen(y->match);
+    if (lx != ly) return lx < ly ? -1 : 1;
+    return strcmp(x->match, y->match);
+}
+
+// Order fuzzy matches best first (shorter, then alphabetical on ties)
+static void rank_matches(Completion *c) {
+    Ranked *r = xmalloc(ALLOC_COMPLETION, (size_t)(c->count ? c->count : 1) * sizeof(Ranked));
+    if (!r) return;
+    for (int i = 0; i < c->count; i++) {
+        r[i].match = c->matches[i];
+        r[i].score = c->scores[i];
+    }
+    qsort(r, (size_t)c->count, sizeof(Ranked), cmp_ranked);
 
-    if (!prefix || !*prefix) {
-        return c;
+    if (c->shared) pthread_mutex_lock(&worker.lock);
+    int unique = 0;
+    for (int i = 0; i < c->count; i++) {
+        if (unique > 0 && strcmp(c->matches[unique - 1], r[i].match) == 0) continue;
+        c->matches[unique] = r[i].match;
+        c->scores[unique] = r[i].score;
+        unique++;
     }
+    c->count = unique;
+    if (c->shared) pthread_mutex_unlock(&worker.lock);
+    xfree(r);
+}
+
+static Completion *completion_new(int flags) {
+    Completion *c = xcalloc(ALLOC_COMPLETION, 1, sizeof(Completion));
+    if (!c) return NULL;
+    c->flags = flags;
+    arena_init(&c->strings);
+    return c;
+}
+
+static void complete_into(Completion *c, const char *prefix, const char *path) {
+    if (!prefix || !*prefix) return;
 
     if (strchr(prefix, '/')) {
         complete_from_fs(c, prefix);
     } else {
-        complete_from_path(c, prefix);
-        complete_from_fs(c, prefix);
+        if (c->flags & COMPLETE_FUZZY) {
+            fuzzy_from_path(c, prefix, path);
+        } else {
+            complete_from_path(c, prefix, path);
+        }
+        if (!cancelled()) complete_from_fs(c, prefix);
+    }
+    if (cancelled()) return;
+    if (c->flags & COMPLETE_FUZZY) {
+        rank_matches(c);
+    } else {
+        sort_matches(c);
     }
+}
 
+Completion *completion_find(const char *prefix, int flags) {
+    Completion *c = completion_new(flags);
+    if (c) complete_into(c, prefix, getenv("PATH"));
     return c;
 }
 
 void completion_free(Completion *c) {
     if (!c) return;
-    for (int i = 0; i < c->count; i++) {
-        free(c->matches[i]);
+    xfree(c->matches);
+    xfree(c->scores);
+    arena_free(&c->strings);
+    exec_index_release(c->index);
+    xfree(c);
+}
+
+static void notify(void) {
+    uint64_t one = 1;
+    ssize_t w = write(worker.efd, &one, sizeof(one));
+    (void)w;
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&worker.lock);
+    while (1) {
+        while (!worker.prefix) pthread_cond_wait(&worker.wake, &worker.lock);
+        char *prefix = worker.prefix;
+        char *path = worker.path;
+        int flags = worker.flags;
+        unsigned gen = worker.req_gen;
+        worker.prefix = worker.path = NULL;
+
+        Completion *c = completion_new(flags);
+        if (c) c->shared = 1;
+        worker.building = c;
+        pthread_mutex_unlock(&worker.lock);
+
+        active_gen = gen;
+        if (c) complete_into(c, prefix, path);
+        xfree(prefix);
+        xfree(path);
+
+        pthread_mutex_lock(&worker.lock);
+        worker.building = NULL;
+        if (c && atomic_load(&completion_gen) == gen) {
+            c->shared = 0;
+            completion_free(worker.ready);
+            worker.ready = c;
+            worker.ready_gen = gen;
+            notify();
+        } else {
+            completion_free(c);
+        }
+    }
+    return NULL;
+}
+
+// A shell forked while the worker publishes the index (for a process
+// substitution) goes on to look commands up in it; it must not inherit
+// index_lock held
+static void fork_prepare(void) {
+    pthread_mutex_lock(&index_lock);
+}
+
+static void fork_done(void) {
+    pthread_mutex_unlock(&index_lock);
+}
+
+static int worker_start(void) {
+    if (worker.started) return 0;
+    worker.efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (worker.efd == -1) return -1;
+    static int atfork_set;
+    if (!atfork_set && pthread_atfork(fork_prepare, fork_done, fork_done) == 0) {
+        atfork_set = 1;
+    }
+
+    // The worker must never take signals meant for the shell
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t tid;
+    int err = pthread_create(&tid, NULL, worker_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+        close(worker.efd);
+        worker.efd = -1;
+        return -1;
+    }
+    pthread_detach(tid);
+    worker.started = 1;
+    return 0;
+}
+
+int completion_notify_fd(void) {
+    return worker.efd;
+}
+
+int completion_start(const char *prefix, int flags) {
+    if (worker_start() != 0) return -1;
+    const char *path = getenv("PATH");
+    char *p = xstrdup(ALLOC_COMPLETION, prefix ? prefix : "");
+    char *pp = path ? xstrdup(ALLOC_COMPLETION, path) : NULL;
+    if (!p || (path && !pp)) {
+        xfree(p);
+        xfree(pp);
+        return -1;
+    }
+
+    pthread_mutex_lock(&worker.lock);
+    xfree(worker.prefix);
+    xfree(worker.path);
+    worker.prefix = p;
+    worker.path = pp;
+    worker.flags = flags;
+    worker.req_gen = atomic_fetch_add(&completion_gen, 1) + 1;
+    completion_free(worker.ready);
+    worker.ready = NULL;
+    pthread_cond_signal(&worker.wake);
+    pthread_mutex_unlock(&worker.lock);
+    return 0;
+}
+
+void completion_cancel(void) {
+    atomic_fetch_add(&completion_gen, 1);
+}
+
+Completion *completion_take(void) {
+    uint64_t n;
+    while (read(worker.efd, &n, sizeof(n)) == -1 && errno == EINTR) {}
+
+    pthread_mutex_lock(&worker.lock);
+    Completion *c = NULL;
+    if (worker.ready && worker.ready_gen == atomic_load(&completion_gen)) {
+        c = worker.ready;
+        worker.ready = NULL;
+    }
+    pthread_mutex_unlock(&worker.lock);
+    return c;
+}
+
+Completion *completion_snapshot(void) {
+    Completion *snap = completion_new(0);
+    if (!snap) return NULL;
+
+    pthread_mutex_lock(&worker.lock);
+    Completion *c = worker.building;
+    if (c && reserve_matches(snap, c->count) == 0) {
+        // Copy the strings: the worker keeps appending to its own arena
+        for (int i = 0; i < c->count; i++) {
+            const char *copy = arena_strdup(&snap->strings, c->matches[i]);
+            if (!copy) break;
+            snap->matches[snap->count++] = copy;
+        }
     }
-    free(c->matches);
-    free(c);
+    pthread_mutex_unlock(&worker.lock);
+    return snap;
 }
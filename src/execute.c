@@ -1,7 +1,23 @@
+#define _GNU_SOURCE
+
 #include "execute.h"
+#include "alloc.h"
+#include "arena.h"
+#include "arith.h"
+#include "array.h"
 #include "builtins.h"
-
+#include "completion.h"
+#include "expand.h"
+#include "func.h"
+#include "parse.h"
+#include "pin.h"
+#include "redir.h"
+#include "reap.h"
+#include "zygote.h"
+
+#include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,46 +26,24 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <limits.h>
-
-int build_heredoc_fd(const char *delim) {
-    int pipefd[2];
-    if (pipe(pipefd) == -1) {
-        perror("pipe");
-        return -1;
-    }
-
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t nread;
-    while (1) {
-        fprintf(stdout, "heredoc> ");
-        fflush(stdout);
-        nread = getline(&line, &len, stdin);
-        if (nread == -1) {
-            break;
-        }
-
-        if (nread > 0 && line[nread - 1] == '\n') {
-            line[nread - 1] = '\0';
-            if (strcmp(line, delim) == 0) {
-                break;
-            }
-            line[nread - 1] = '\n';
-        }
-
-        if (write(pipefd[1], line, nread) == -1) {
-            perror("write");
-            free(line);
-            close(pipefd[0]);
-            close(pipefd[1]);
-            return -1;
-        }
-    }
-
-    free(line);
-    close(pipefd[1]);
-    return pipefd[0];
-}
+#include <termios.h>
+
+#define TIMEOUT_KILL_AFTER_MS 2000
+#define PROCSUB_FD_BASE 60
+#define MAX_PIPELINE_PROCSUBS 16
+
+// Process substitutions of one pipeline. Each runs in a forked copy of the
+// shell; fds[i] is the shell's end of its pipe, open until stage[i] has
+// started.
+typedef struct {
+    pid_t pids[MAX_PIPELINE_PROCSUBS];
+    const char *names[MAX_PIPELINE_PROCSUBS];
+    int fds[MAX_PIPELINE_PROCSUBS];
+    int stage[MAX_PIPELINE_PROCSUBS];
+    int keep[MAX_PIPELINE_PROCSUBS];    // an argument, so the stage needs fds[i]
+    char paths[MAX_PIPELINE_PROCSUBS][24];
+    int count;
+} ProcSubs;
 
 static int is_executable(const char *path) {
     struct stat st;
@@ -60,7 +54,7 @@ static int path_lookup(const char *name) {
     char *path = getenv("PATH");
     if (!path) return -1;
 
-    char *dup = strdup(path);
+    char *dup = xstrdup(ALLOC_EXECUTOR, path);
     if (!dup) return -1;
 
     char *saveptr = NULL;
@@ -69,13 +63,13 @@ static int path_lookup(const char *name) {
         char candidate[PATH_MAX];
         snprintf(candidate, sizeof(candidate), "%s/%s", dir, name);
         if (is_executable(candidate)) {
-            free(dup);
+            xfree(dup);
             return 0;
         }
         dir = strtok_r(NULL, ":", &saveptr);
     }
 
-    free(dup);
+    xfree(dup);
     return -1;
 }
 
@@ -105,7 +99,7 @@ static void find_suggestion(const char *name, char *suggestion, size_t size) {
     char *path = getenv("PATH");
     if (!path) return;
 
-    char *dup = strdup(path);
+    char *dup = xstrdup(ALLOC_EXECUTOR, path);
     if (!dup) return;
 
     int best_score = 4; // only suggest if reasonably close
@@ -134,7 +128,7 @@ static void find_suggestion(const char *name, char *suggestion, size_t size) {
         dir = strtok_r(NULL, ":", &saveptr);
     }
 
-    free(dup);
+    xfree(dup);
 }
 
 static int validate_commands(Pipeline *pipeline, char *suggestion, size_t sugg_size) {
@@ -142,6 +136,7 @@ static int validate_commands(Pipeline *pipeline, char *suggestion, size_t sugg_s
     for (int i = 0; i < pipeline->count; i++) {
         Command *cmd = &pipeline->cmds[i];
         if (!cmd->name) return -1;
+        if (func_exists(cmd->name) || is_builtin(cmd->name)) continue;
 
         if (strchr(cmd->name, '/')) {
             if (is_executable(cmd->name)) {
@@ -151,7 +146,10 @@ static int validate_commands(Pipeline *pipeline, char *suggestion, size_t sugg_s
             return i;
         }
 
-        if (path_lookup(cmd->name) == 0) {
+        // Once built, the executable index answers most lookups without
+        // probing every PATH directory; a miss still gets the full scan
+        if (completion_has_command(getenv("PATH"), cmd->name) == 1 ||
+            path_lookup(cmd->name) == 0) {
             continue;
         }
 
@@ -161,68 +159,276 @@ static int validate_commands(Pipeline *pipeline, char *suggestion, size_t sugg_s
     return -1;
 }
 
-int execute_commands(Pipeline *pipeline) {
-    if (pipeline->count <= 0) {
-        return 0;
+// "1.5", "30s", "2m", "1h" or "1d" in milliseconds; -1 if malformed
+static long parse_duration(const char *s) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || v < 0) return -1;
+    double scale = 1000;
+    if (*end == 'm') scale = 60 * 1000;
+    else if (*end == 'h') scale = 3600 * 1000;
+    else if (*end == 'd') scale = 86400 * 1000;
+    else if (*end != 's' && *end != '\0') return -1;
+    if (*end && end[1]) return -1;
+    v *= scale;
+    if (v > (double)LONG_MAX / 2) return -1;
+    // Round up so tiny durations still arm the timer
+    long ms = (long)v;
+    return (v > ms) ? ms + 1 : ms;
+}
+
+// A leading `timeout [-k KILL_AFTER] DURATION` on the first stage applies to
+// the whole pipeline and is stripped from it. Returns -1 on usage errors.
+static int take_timeout(Pipeline *pipeline, ReapLimits *limits) {
+    Command *cmd = &pipeline->cmds[0];
+    if (!cmd->name || strcmp(cmd->name, "timeout") != 0) return 0;
+
+    int skip = 1;
+    limits->kill_ms = TIMEOUT_KILL_AFTER_MS;
+    if (cmd->argc > 2 && strcmp(cmd->args[1], "-k") == 0) {
+        limits->kill_ms = parse_duration(cmd->args[2]);
+        if (limits->kill_ms < 0) {
+            fprintf(stderr, "minibash: timeout: invalid time interval '%s'\n", cmd->args[2]);
+            return -1;
+        }
+        skip = 3;
     }
+    if (cmd->argc < skip + 2) {
+        fprintf(stderr, "minibash: timeout: usage: timeout [-k duration] duration command\n");
+        return -1;
+    }
+    limits->timeout_ms = parse_duration(cmd->args[skip]);
+    if (limits->timeout_ms < 0) {
+        fprintf(stderr, "minibash: timeout: invalid time interval '%s'\n", cmd->args[skip]);
+        return -1;
+    }
+    skip++;
+
+    memmove(cmd->args, cmd->args + skip, (cmd->argc - skip + 1) * sizeof(char *));
+    cmd->argc -= skip;
+    for (int i = 0; i < cmd->nsubs; i++) {
+        if (cmd->subs[i].arg >= 0) cmd->subs[i].arg -= skip;
+    }
+    cmd->name = cmd->args[0];
+    return 0;
+}
 
-    // Handle builtins (only if no pipes)
-    if (pipeline->count == 1) {
-        Command *cmd = &pipeline->cmds[0];
-        if (is_builtin(cmd->name)) {
-            // Handle redirections for builtins
-            int orig_stdin = -1, orig_stdout = -1;
-            if (cmd->heredoc_delim) {
-                orig_stdin = dup(STDIN_FILENO);
-                int fd = build_heredoc_fd(cmd->heredoc_delim);
-                if (fd == -1) return 1;
-                dup2(fd, STDIN_FILENO);
+static void warn_unpinned(const char *name) {
+    fprintf(stderr, "minibash: pin: %s runs in the shell and is not placed\n", name);
+}
+
+// Hand the terminal to pgid (0: back to the shell). Only used when the
+// shell owns the terminal; SIGTTOU is blocked around tcsetpgrp since the
+// caller may be in a background group.
+static void set_foreground(pid_t pgid) {
+    sigset_t ttou, old;
+    sigemptyset(&ttou);
+    sigaddset(&ttou, SIGTTOU);
+    sigprocmask(SIG_BLOCK, &ttou, &old);
+    tcsetpgrp(STDIN_FILENO, pgid ? pgid : getpgrp());
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+// The parent is done with a stage's pipe ends once the stage has started
+static void close_stage_pipes(int pipes[][2], int i, int last) {
+    if (i > 0) {
+        close(pipes[i - 1][0]);
+        pipes[i - 1][0] = -1;
+    }
+    if (i < last) {
+        close(pipes[i][1]);
+        pipes[i][1] = -1;
+    }
+}
+
+static int is_target(const RedirPlan *plan, int fd) {
+    for (int i = 0; i < plan->nslots; i++) {
+        if (plan->slots[i].target == fd) return 1;
+    }
+    return 0;
+}
+
+// Close the shell's ends of the substitutions for stage (-1: all)
+static void close_procsubs(ProcSubs *subs, int stage) {
+    for (int i = 0; i < subs->count; i++) {
+        if (subs->fds[i] >= 0 && (stage < 0 || subs->stage[i] == stage)) {
+            close(subs->fds[i]);
+            subs->fds[i] = -1;
+        }
+    }
+}
+
+static void abort_procsubs(ProcSubs *subs) {
+    close_procsubs(subs, -1);
+    for (int i = 0; i < subs->count; i++) {
+        while (waitpid(subs->pids[i], NULL, 0) == -1 && errno == EINTR) {
+        }
+    }
+}
+
+// Start every <(...) and >(...) in the pipeline, before its own pipes exist
+// so the forked shells hold none of them, and put /dev/fd/N in their place
+static int start_procsubs(Pipeline *pipeline, ProcSubs *subs, ReapLimits *limits,
+                          int own_group) {
+    for (int i = 0; i < pipeline->count; i++) {
+        Command *cmd = &pipeline->cmds[i];
+        for (int j = 0; j < cmd->nsubs; j++) {
+            ProcSub *ps = &cmd->subs[j];
+            if (subs->count == MAX_PIPELINE_PROCSUBS) {
+                fprintf(stderr, "minibash: too many process substitutions\n");
+                return -1;
+            }
+            int p[2];
+            if (pipe2(p, O_CLOEXEC) == -1) {
+                perror("pipe");
+                return -1;
+            }
+            int inner = p[ps->output ? 0 : 1];
+            // Numbered high, clear of descriptors a user would redirect
+            int fd = fcntl(p[ps->output ? 1 : 0], F_DUPFD_CLOEXEC, PROCSUB_FD_BASE);
+            close(p[ps->output ? 1 : 0]);
+            if (fd == -1) {
+                perror("fcntl");
+                close(inner);
+                return -1;
+            }
+
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0) {
+                if (own_group) setpgid(0, limits->pgid);
                 close(fd);
-            } else if (cmd->input_path) {
-                orig_stdin = dup(STDIN_FILENO);
-                int fd = open(cmd->input_path, O_RDONLY);
-                if (fd == -1) {
-                    perror("open");
-                    return 1;
+                for (int k = 0; k < subs->count; k++) {
+                    if (subs->fds[k] >= 0) close(subs->fds[k]);
                 }
-                dup2(fd, STDIN_FILENO);
+                dup2(inner, ps->output ? STDIN_FILENO : STDOUT_FILENO);
+                close(inner);
+                // The zygote's socket belongs to the parent shell
+                zygote_stop();
+                Pipeline sub;
+                int r = parse_line(ps->line, &sub);
+                int status = r > 0 ? execute_commands(&sub) : (r < 0 ? 2 : 0);
+                fflush(stdout);
+                _exit(status);
+            }
+            close(inner);
+            if (pid == -1) {
+                perror("fork");
                 close(fd);
+                return -1;
+            }
+            if (own_group) {
+                if (limits->pgid == 0) limits->pgid = pid;
+                setpgid(pid, limits->pgid);
             }
 
-            if (cmd->output_type == OUTPUT_REDIRECT || cmd->output_type == OUTPUT_REDIRECT_APPEND) {
-                orig_stdout = dup(STDOUT_FILENO);
-                int flags = O_CREAT | O_WRONLY;
-                flags |= (cmd->output_type == OUTPUT_REDIRECT_APPEND) ? O_APPEND : O_TRUNC;
-                int fd = open(cmd->redirect_path, flags, 0644);
-                if (fd == -1) {
-                    perror("open");
-                    if (orig_stdin >= 0) close(orig_stdin);
-                    return 1;
-                }
-                dup2(fd, STDOUT_FILENO);
-                close(fd);
+            int n = subs->count++;
+            subs->pids[n] = pid;
+            subs->names[n] = ps->line;
+            subs->fds[n] = fd;
+            subs->stage[n] = i;
+            subs->keep[n] = ps->arg >= 0;
+            snprintf(subs->paths[n], sizeof(subs->paths[n]), "/dev/fd/%d", fd);
+            if (ps->arg >= 0) {
+                cmd->args[ps->arg] = subs->paths[n];
+                if (ps->arg == 0) cmd->name = cmd->args[0];
+            } else {
+                cmd->redirs[ps->redir].path = subs->paths[n];
             }
+        }
+    }
+    return 0;
+}
 
-            int ret = execute_builtin(cmd->name, cmd->argc, cmd->args);
+static int last_status = 0;
 
-            if (orig_stdin >= 0) {
-                dup2(orig_stdin, STDIN_FILENO);
-                close(orig_stdin);
-            }
-            if (orig_stdout >= 0) {
-                dup2(orig_stdout, STDOUT_FILENO);
-                close(orig_stdout);
-            }
+int execute_last_status(void) {
+    return last_status;
+}
+
+void execute_set_last_status(int status) {
+    last_status = status;
+}
+
+static int exiting = 0;
+
+void execute_request_exit(void) {
+    exiting = 1;
+}
+
+int execute_exiting(void) {
+    return exiting;
+}
+
+// Run a function or builtin in the shell process with its descriptors set
+// up as plan says. Most builtins write straight to the plan's sources; the
+// rest, and functions, get the plan installed on the shell's own
+// descriptors, restored afterwards.
+static int run_here(Command *cmd, const RedirPlan *plan) {
+    RedirSaved saved;
+    fflush(stdout);
+    int func = func_exists(cmd->name);
+    if (!func && !builtin_needs_fds(cmd->name)) {
+        return execute_builtin_io(cmd->name, cmd->argc, cmd->args,
+                                  redir_plan_source(plan, STDOUT_FILENO),
+                                  redir_plan_source(plan, STDERR_FILENO));
+    }
+    if (redir_push(plan, &saved) != 0) return 1;
+    int ret = func ? func_call(cmd->name, cmd->argc, cmd->args)
+                   : execute_builtin(cmd->name, cmd->argc, cmd->args);
+    // Buffered output belongs to the redirect target
+    fflush(stdout);
+    redir_pop(&saved);
+    return ret;
+}
 
-            return ret;
+static int run_pipeline(Pipeline *pipeline) {
+    if (pipeline->count <= 0 || (pipeline->count == 1 && pipeline->cmds[0].argc == 0)) {
+        return 0;
+    }
+    for (int i = 0; i < pipeline->count; i++) {
+        if (pipeline->cmds[i].argc == 0) {
+            fprintf(stderr, "minibash: empty command in pipeline\n");
+            return 1;
+        }
+    }
+
+    // The timeout and pin prefixes may come in either order
+    ReapLimits limits = {0};
+    PinPlan pin = {0};
+    while (1) {
+        const char *name = pipeline->cmds[0].name;
+        int taken;
+        if (limits.timeout_ms == 0 && strcmp(name, "timeout") == 0) {
+            taken = take_timeout(pipeline, &limits);
+        } else if (!pin.active && strcmp(name, "pin") == 0) {
+            taken = pin_take(pipeline, &pin);
+        } else {
+            break;
         }
+        if (taken != 0) return 125;
+    }
+
+    // A lone function or builtin runs in the shell itself, unless a deadline
+    // needs a child to signal
+    Command *only = &pipeline->cmds[0];
+    if (pipeline->count == 1 && only->nsubs == 0 && limits.timeout_ms == 0 &&
+        (func_exists(only->name) || is_builtin(only->name))) {
+        if (pin.active) warn_unpinned(only->name);
+        RedirPlan plan;
+        redir_plan_init(&plan, STDIN_FILENO, STDOUT_FILENO);
+        if (redir_plan_command(&plan, only) != 0) return 1;
+        int ret = run_here(only, &plan);
+        redir_release(&plan);
+        return ret;
     }
 
     char suggestion[128];
     int bad_idx = validate_commands(pipeline, suggestion, sizeof(suggestion));
     if (bad_idx >= 0) {
         const char *name = pipeline->cmds[bad_idx].name;
-        fprintf(stderr, "minibash: command not found: %s", name);
+        parse_error_prefix();
+        fprintf(stderr, "command not found: %s", name);
         if (suggestion[0] && strcmp(suggestion, name) != 0) {
             fprintf(stderr, " (did you mean '%s'?)", suggestion);
         }
@@ -230,114 +436,194 @@ int execute_commands(Pipeline *pipeline) {
         return 127;
     }
 
+    // Under a deadline the stages get their own process group so expiry can
+    // signal all of them (and anything they spawned) at once
+    int own_group = limits.timeout_ms > 0;
+    int take_tty = own_group && isatty(STDIN_FILENO) &&
+                   tcgetpgrp(STDIN_FILENO) == getpgrp();
+    int last_failed = 0, here_status = 0;
+
+    ProcSubs subs;
+    subs.count = 0;
+    if (start_procsubs(pipeline, &subs, &limits, own_group) != 0) {
+        abort_procsubs(&subs);
+        return 1;
+    }
+
+    // Close-on-exec, so no child has to close the ends it does not use
     int pipes[MAX_CMDS - 1][2];
     for (int i = 0; i < pipeline->count - 1; i++) {
-        if (pipe(pipes[i]) == -1) {
+        if (pipe2(pipes[i], O_CLOEXEC) == -1) {
             perror("pipe");
             for (int k = 0; k < i; k++) {
                 close(pipes[k][0]);
                 close(pipes[k][1]);
             }
+            abort_procsubs(&subs);
             return 127;
         }
     }
 
-    pid_t pids[MAX_CMDS];
+    pid_t pids[MAX_CMDS + MAX_PIPELINE_PROCSUBS] = {0};
+    const char *names[MAX_CMDS + MAX_PIPELINE_PROCSUBS] = {0};
     int spawned = 0;
-    int status_code = 0;
+
+    // A function or filter builtin at the end of the pipeline runs in the
+    // shell, reading the previous stage, so it can change shell state; other
+    // such stages run in forked children (which the zygote cannot provide, nor
+    // can it wait for substitutions, which are children of the shell)
+    int last = pipeline->count - 1;
+    const char *last_name = pipeline->cmds[last].name;
+    int here = !own_group && (func_exists(last_name) || builtin_is_filter(last_name));
+    if (here && pin.active) warn_unpinned(last_name);
+    // Pinned stages set their placement between fork and exec
+    limits.zygote = zygote_active() && subs.count == 0 && !pin.active;
+    for (int i = 0; i < pipeline->count - here; i++) {
+        const char *name = pipeline->cmds[i].name;
+        if (func_exists(name) || is_builtin(name)) limits.zygote = 0;
+    }
+    // Nothing buffered may be flushed again by a forked builtin
+    fflush(stdout);
 
     for (int i = 0; i < pipeline->count; i++) {
         Command *cmd = &pipeline->cmds[i];
         int in_fd = (i > 0) ? pipes[i - 1][0] : STDIN_FILENO;
-        int out_fd = (i < pipeline->count - 1) ? pipes[i][1] : STDOUT_FILENO;
-
-        pid_t pid = fork();
-        if (pid == -1) {
-            perror("fork");
+        int out_fd = (i < last) ? pipes[i][1] : STDOUT_FILENO;
+        RedirPlan plan;
+        redir_plan_init(&plan, in_fd, out_fd);
+        int planned = redir_plan_command(&plan, cmd);
+        for (int k = 0; k < subs.count && planned == 0; k++) {
+            if (subs.stage[k] == i && subs.keep[k] && redir_plan_keep(&plan, subs.fds[k]) != 0) {
+                fprintf(stderr, "minibash: too many redirections\n");
+                redir_release(&plan);
+                planned = -1;
+            }
+        }
+        if (planned != 0) {
+            // Like a stage that failed to start: the rest still runs
+            if (i == last) {
+                last_failed = 1;
+                here = 0;
+            }
+            names[spawned] = cmd->name;
+            pids[spawned++] = 0;
+            close_stage_pipes(pipes, i, last);
+            close_procsubs(&subs, i);
+            continue;
+        }
+        if (i == last && here) {
+            here_status = run_here(cmd, &plan);
+            redir_release(&plan);
+            close_stage_pipes(pipes, i, last);
+            close_procsubs(&subs, i);
             break;
         }
 
-        if (pid == 0) {
-            int keep_read = cmd->heredoc_delim ? -1 : (i - 1);
-            int keep_write = (i < pipeline->count - 1) ? i : -1;
-
-            for (int k = 0; k < pipeline->count - 1; k++) {
-                if (k != keep_read) close(pipes[k][0]);
-                if (k != keep_write) close(pipes[k][1]);
+        pid_t pid = -1;
+        if (limits.zygote) {
+            pid = zygote_spawn(cmd->args, &plan, own_group ? limits.pgid : -1, take_tty);
+            if (pid > 0) {
+                if (own_group && limits.pgid == 0) limits.pgid = pid;
+                if (take_tty && spawned == 0) set_foreground(limits.pgid);
+            } else if (spawned == 0) {
+                // One pipeline is reaped one way: fork this one unless some
+                // stage already went through the zygote
+                limits.zygote = 0;
+            } else {
+                fprintf(stderr, "minibash: %s: cannot start stage\n", cmd->name);
             }
-
-            // Handle input redirection
-            if (cmd->heredoc_delim) {
-                int fd = build_heredoc_fd(cmd->heredoc_delim);
-                if (fd == -1) {
-                    exit(EXIT_FAILURE);
-                }
-                in_fd = fd;
-            } else if (cmd->input_path) {
-                int fd = open(cmd->input_path, O_RDONLY);
-                if (fd == -1) {
-                    perror("open");
-                    exit(EXIT_FAILURE);
+        }
+        if (!limits.zygote) {
+            pid = fork();
+            if (pid == 0) {
+                if (own_group) {
+                    setpgid(0, limits.pgid);
+                    if (take_tty) set_foreground(limits.pgid ? limits.pgid : getpid());
                 }
-                in_fd = fd;
-            }
-
-            if (in_fd != STDIN_FILENO) {
-                if (dup2(in_fd, STDIN_FILENO) == -1) {
-                    perror("dup2");
-                    exit(EXIT_FAILURE);
+                pin_apply(&pin, i);
+                if (redir_apply(&plan) != 0) _exit(EXIT_FAILURE);
+                int func = func_exists(cmd->name);
+                if (func || is_builtin(cmd->name)) {
+                    // No exec to drop the pipe ends; readers would never
+                    // see EOF while this process holds write ends
+                    for (int k = 0; k < last; k++) {
+                        for (int e = 0; e < 2; e++) {
+                            if (pipes[k][e] >= 0 && !is_target(&plan, pipes[k][e])) {
+                                close(pipes[k][e]);
+                            }
+                        }
+                    }
+                    for (int k = 0; k < subs.count; k++) {
+                        if (subs.fds[k] >= 0 && !is_target(&plan, subs.fds[k])) {
+                            close(subs.fds[k]);
+                        }
+                    }
+                    // Functions and sourced scripts start commands of
+                    // their own, which must not go to the shell's zygote
+                    zygote_stop();
+                    int status = func ? func_call(cmd->name, cmd->argc, cmd->args)
+                                      : execute_builtin(cmd->name, cmd->argc, cmd->args);
+                    fflush(stdout);
+                    // Not exit(): handlers registered by the shell are not
+                    // this child's to run
+                    _exit(status);
                 }
-                close(in_fd);
+                execvp(cmd->name, cmd->args);
+                perror("execvp");
+                _exit(EXIT_FAILURE);
             }
-
-            // Handle output redirection (overrides pipe output)
-            if (cmd->output_type == OUTPUT_REDIRECT || cmd->output_type == OUTPUT_REDIRECT_APPEND) {
-                int flags = O_CREAT | O_WRONLY;
-                flags |= (cmd->output_type == OUTPUT_REDIRECT_APPEND) ? O_APPEND : O_TRUNC;
-                int fd = open(cmd->redirect_path, flags, 0644);
-                if (fd == -1) {
-                    perror("open");
-                    exit(EXIT_FAILURE);
-                }
-                out_fd = fd;
-            }
-
-            if (out_fd != STDOUT_FILENO) {
-                if (dup2(out_fd, STDOUT_FILENO) == -1) {
-                    perror("dup2");
-                    exit(EXIT_FAILURE);
-                }
-                close(out_fd);
+            if (pid == -1) perror("fork");
+            if (pid > 0 && own_group) {
+                if (limits.pgid == 0) limits.pgid = pid;
+                setpgid(pid, limits.pgid);
+                if (take_tty && spawned == 0) set_foreground(limits.pgid);
             }
-
-            execvp(cmd->name, cmd->args);
-            perror("execvp");
-            exit(EXIT_FAILURE);
         }
-
+        redir_release(&plan);
+        close_stage_pipes(pipes, i, last);
+        close_procsubs(&subs, i);
+        if (pid <= 0) {
+            here = 0;
+            last_failed = 1;
+            break;
+        }
+        names[spawned] = cmd->name;
         pids[spawned++] = pid;
     }
+    // Ends left over when a stage could not be started
+    for (int i = 0; i < last; i++) {
+        if (pipes[i][0] >= 0) close(pipes[i][0]);
+        if (pipes[i][1] >= 0) close(pipes[i][1]);
+    }
+    close_procsubs(&subs, -1);
 
-    for (int i = 0; i < pipeline->count - 1; i++) {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
+    // Substitutions are reaped with the stages, after them in the list
+    for (int k = 0; k < subs.count; k++) {
+        names[spawned + k] = subs.names[k];
+        pids[spawned + k] = subs.pids[k];
     }
+    limits.helpers = subs.count;
+    spawned += subs.count;
 
-    for (int i = 0; i < spawned; i++) {
-        int wstatus = 0;
-        if (waitpid(pids[i], &wstatus, 0) == -1) {
-            perror("waitpid");
-            status_code = 127;
-            continue;
-        }
-        if (i == spawned - 1) {
-            if (WIFEXITED(wstatus)) {
-                status_code = WEXITSTATUS(wstatus);
-            } else if (WIFSIGNALED(wstatus)) {
-                status_code = 128 + WTERMSIG(wstatus);
-            }
+    int status_code = reap_pipeline(pids, names, spawned, &limits);
+    if (take_tty) set_foreground(0);
+    if (here) return here_status;
+    return last_failed ? 1 : status_code;
+}
+
+int execute_commands(Pipeline *pipeline) {
+    Arena arena;
+    arena_init(&arena);
+    int status = 1;
+    if (expand_pipeline(pipeline, &arena) == 0) {
+        // ((expr)), name=(...) and name[sub]=value are not commands
+        if (pipeline->count != 1 ||
+            ((status = arith_command(&pipeline->cmds[0])) < 0 &&
+             (status = array_assignment(&pipeline->cmds[0])) < 0)) {
+            status = run_pipeline(pipeline);
         }
     }
-
-    return status_code;
+    arena_free(&arena);
+    last_status = status;
+    return status;
 }
@@ -0,0 +1,334 @@
+#include "expand.h"
+#include "arith.h"
+#include "array.h"
+#include "builtins.h"
+#include "execute.h"
+#include "func.h"
+#include "parse.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NAME_MAX_LEN 128
+#define SUB_MAX_LEN 256
+
+static int name_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static int name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+// Value of the parameter named by the len bytes at name; numbers are
+// formatted into num. NULL if unset.
+static const char *param(const char *name, size_t len, char *num, size_t num_size) {
+    if (len == 1 && name[0] == '#') {
+        snprintf(num, num_size, "%d", func_argc());
+        return num;
+    }
+    if (len == 1 && name[0] == '?') {
+        snprintf(num, num_size, "%d", execute_last_status());
+        return num;
+    }
+    if (isdigit((unsigned char)name[0])) {
+        int n = 0;
+        for (size_t i = 0; i < len; i++) {
+            if (!isdigit((unsigned char)name[i]) || n > MAX_ARGS) return NULL;
+            n = n * 10 + (name[i] - '0');
+        }
+        return func_arg(n);
+    }
+    char key[NAME_MAX_LEN];
+    if (len == 0 || len >= sizeof(key)) return NULL;
+    memcpy(key, name, len);
+    key[len] = '\0';
+    // $a of an array is ${a[0]}
+    const char *v = get_var(key);
+    return v ? v : array_get(key, "0");
+}
+
+static size_t put(char *out, size_t n, const char *s) {
+    size_t len = strlen(s);
+    if (out) memcpy(out + n, s, len);
+    return n + len;
+}
+
+static size_t expand_word(const char *w, char *out);
+
+// ${name[sub]}, ${#name[sub]}, ${!name[@]} and ${#name}, ref being the len
+// bytes between the braces. Subscripts @ and * give every element (or key),
+// joined by spaces. Appends to out as expand_word does.
+static size_t reference(const char *ref, size_t len, char *out, size_t n) {
+    char op = *ref == '#' || *ref == '!' ? *ref : 0;
+    if (op) {
+        ref++;
+        len--;
+    }
+    char num[24];
+    const char *open = memchr(ref, '[', len);
+    if (!open) {
+        const char *v = op == '#' ? param(ref, len, num, sizeof(num)) : NULL;
+        snprintf(num, sizeof(num), "%zu", v ? strlen(v) : 0);
+        return op == '#' ? put(out, n, num) : n;
+    }
+
+    char name[NAME_MAX_LEN], sub[SUB_MAX_LEN];
+    size_t name_len = (size_t)(open - ref);
+    if (ref[len - 1] != ']' || name_len == 0 || name_len >= sizeof(name) ||
+        len - name_len - 2 >= sizeof(sub)) {
+        return n;
+    }
+    memcpy(name, ref, name_len);
+    name[name_len] = '\0';
+    memcpy(sub, open + 1, len - name_len - 2);
+    sub[len - name_len - 2] = '\0';
+    if (strchr(sub, '$')) {
+        char raw[SUB_MAX_LEN];
+        memcpy(raw, sub, sizeof(raw));
+        if (expand_word(raw, NULL) >= sizeof(sub)) return n;
+        sub[expand_word(raw, sub)] = '\0';
+    }
+
+    if (strcmp(sub, "@") == 0 || strcmp(sub, "*") == 0) {
+        if (op == '#') {
+            long count = array_count(name);
+            snprintf(num, sizeof(num), "%ld", count < 0 ? 0 : count);
+            return put(out, n, num);
+        }
+        ArrayIter it;
+        if (array_iter(name, &it) != 0) return n;
+        const char *key, *value;
+        for (int first = 1; array_next(&it, &key, &value, num, sizeof(num)); first = 0) {
+            if (!first) n = put(out, n, " ");
+            n = put(out, n, op == '!' ? key : value);
+        }
+        return n;
+    }
+    const char *v = array_get(name, sub);
+    if (op == '#') {
+        snprintf(num, sizeof(num), "%zu", v ? strlen(v) : 0);
+        return put(out, n, num);
+    }
+    return v && !op ? put(out, n, v) : n;
+}
+
+// Whether w is exactly ${name[@]}, ${name[*]} or ${!name[@]}, which become
+// one word per element
+static int list_reference(const char *w, char *name, size_t size, int *keys) {
+    if (w[0] != '$' || w[1] != '{') return 0;
+    w += 2;
+    *keys = *w == '!';
+    w += *keys;
+    size_t len = 0;
+    while (name_char(w[len])) len++;
+    if (len == 0 || len >= size || !name_start(w[0])) return 0;
+    if (strcmp(w + len, "[@]}") != 0 && strcmp(w + len, "[*]}") != 0) return 0;
+    memcpy(name, w, len);
+    name[len] = '\0';
+    return 1;
+}
+
+// Writes the expansion of w to out when out is not NULL; returns its length
+static size_t expand_word(const char *w, char *out) {
+    size_t n = 0;
+    const char *p = w;
+    while (*p) {
+        const char *name = p + 1, *next = NULL;
+        size_t len = 1;
+        if (p[0] != '$') {
+            name = NULL;
+        } else if (p[1] == '{') {
+            const char *close = strchr(p + 2, '}');
+            if (close) {
+                name = p + 2;
+                len = (size_t)(close - name);
+                next = close + 1;
+            } else {
+                name = NULL;
+            }
+        } else if (name_start(p[1])) {
+            while (name_char(name[len])) len++;
+            next = name + len;
+        } else if (p[1] && (isdigit((unsigned char)p[1]) || strchr("#?@*", p[1]))) {
+            next = p + 2;
+        } else {
+            name = NULL;
+        }
+        if (!name) {
+            if (out) out[n] = *p;
+            n++;
+            p++;
+            continue;
+        }
+
+        if (next == name + len + 1 && (memchr(name, '[', len) || (len > 1 && *name == '#'))) {
+            n = reference(name, len, out, n);
+        } else if (len == 1 && (*name == '@' || *name == '*')) {
+            for (int i = 1; i <= func_argc(); i++) {
+                if (i > 1) n = put(out, n, " ");
+                n = put(out, n, func_arg(i));
+            }
+        } else {
+            char num[24];
+            const char *v = param(name, len, num, sizeof(num));
+            if (v) n = put(out, n, v);
+        }
+        p = next;
+    }
+    return n;
+}
+
+static char *expand_dup(const char *w, Arena *arena) {
+    size_t len = expand_word(w, NULL);
+    char *e = arena_alloc(arena, len + 1);
+    if (!e) return NULL;
+    expand_word(w, e);
+    e[len] = '\0';
+    return e;
+}
+
+// w with each $((expr)) replaced by its value, left to right and inner ones
+// first; w itself if it has none. NULL after reporting an error.
+static char *expand_arith(char *w, Arena *arena) {
+    char *start = strstr(w, "$((");
+    if (!start) return w;
+    int depth = 0;
+    char *close = start + 1;
+    for (; *close; close++) {
+        if (*close == '(') depth++;
+        else if (*close == ')' && --depth == 0) break;
+    }
+    if (!*close || close[-1] != ')' || close - 1 < start + 3) {
+        parse_error_prefix();
+        fprintf(stderr, "%s: bad arithmetic expansion\n", start);
+        return NULL;
+    }
+
+    char *expr = arena_strndup(arena, start + 3, (size_t)(close - 1 - (start + 3)));
+    if (!expr) goto nomem;
+    if (!(expr = expand_arith(expr, arena))) return NULL;
+    if (strchr(expr, '$') && !(expr = expand_dup(expr, arena))) goto nomem;
+    long long value;
+    if (arith_eval(expr, &value) != 0) return NULL;
+
+    char *rest = expand_arith(close + 1, arena);
+    if (!rest) return NULL;
+    char num[24];
+    int num_len = snprintf(num, sizeof(num), "%lld", value);
+    size_t head = (size_t)(start - w), tail = strlen(rest);
+    char *out = arena_alloc(arena, head + (size_t)num_len + tail + 1);
+    if (!out) goto nomem;
+    memcpy(out, w, head);
+    memcpy(out + head, num, (size_t)num_len);
+    memcpy(out + head + num_len, rest, tail + 1);
+    return out;
+
+nomem:
+    perror("minibash");
+    return NULL;
+}
+
+static int procsub_arg(const Command *cmd, int arg) {
+    for (int k = 0; k < cmd->nsubs; k++) {
+        if (cmd->subs[k].arg == arg) return k;
+    }
+    return -1;
+}
+
+static int procsub_redir(const Command *cmd, int redir) {
+    for (int k = 0; k < cmd->nsubs; k++) {
+        if (cmd->subs[k].redir == redir) return 1;
+    }
+    return 0;
+}
+
+// Room in words for one more and the NULL. Past MAX_ARGS, which a list
+// such as ${a[@]} can take a command to, they move to the arena.
+static int room(char ***words, int argc, int *cap, Arena *arena) {
+    if (argc < *cap - 1) return 0;
+    char **grown = arena_alloc(arena, (size_t)*cap * 2 * sizeof(char *));
+    if (!grown) return -1;
+    memcpy(grown, *words, (size_t)argc * sizeof(char *));
+    *words = grown;
+    *cap *= 2;
+    return 0;
+}
+
+static int expand_command(Command *cmd, Arena *arena) {
+    char *local[MAX_ARGS];
+    char **words = local;
+    int argc = 0, cap = MAX_ARGS;
+    for (int i = 0; i < cmd->argc; i++) {
+        char *w = cmd->args[i];
+        int sub = procsub_arg(cmd, i);
+        if (sub < 0 && !(w = expand_arith(w, arena))) return -1;
+        if (sub >= 0 || !strchr(w, '$')) {
+            if (room(&words, argc, &cap, arena) != 0) goto nomem;
+            // Words removed or added before it move the placeholder
+            if (sub >= 0) cmd->subs[sub].arg = argc;
+            words[argc++] = w;
+            continue;
+        }
+        char name[NAME_MAX_LEN];
+        int keys;
+        if (list_reference(w, name, sizeof(name), &keys)) {
+            ArrayIter it;
+            const char *key, *value;
+            char num[24];
+            if (array_iter(name, &it) != 0) continue;
+            while (array_next(&it, &key, &value, num, sizeof(num))) {
+                // Copied: the command may change the array while it runs
+                char *word = arena_strdup(arena, keys ? key : value);
+                if (!word || room(&words, argc, &cap, arena) != 0) goto nomem;
+                words[argc++] = word;
+            }
+            continue;
+        }
+        if (strcmp(w, "$@") == 0 || strcmp(w, "$*") == 0) {
+            for (int k = 1; k <= func_argc(); k++) {
+                if (room(&words, argc, &cap, arena) != 0) goto nomem;
+                words[argc++] = (char *)func_arg(k);
+            }
+            continue;
+        }
+        char *e = expand_dup(w, arena);
+        if (!e) goto nomem;
+        if (!*e) continue;
+        if (room(&words, argc, &cap, arena) != 0) goto nomem;
+        words[argc++] = e;
+    }
+    if (words != local) cmd->args = words;
+    else memcpy(cmd->args, words, (size_t)argc * sizeof(char *));
+    cmd->args[argc] = NULL;
+    cmd->argc = argc;
+    cmd->name = argc > 0 ? cmd->args[0] : NULL;
+
+    for (int i = 0; i < cmd->nredirs; i++) {
+        Redir *r = &cmd->redirs[i];
+        if (!r->path || r->type == REDIR_HEREDOC || procsub_redir(cmd, i)) continue;
+        if (!(r->path = expand_arith(r->path, arena))) return -1;
+        if (!strchr(r->path, '$')) continue;
+        char *e = expand_dup(r->path, arena);
+        if (!e) goto nomem;
+        if (!*e) {
+            parse_error_prefix();
+            fprintf(stderr, "%s: ambiguous redirect\n", r->path);
+            return -1;
+        }
+        r->path = e;
+    }
+    return 0;
+
+nomem:
+    perror("minibash");
+    return -1;
+}
+
+int expand_pipeline(Pipeline *pipeline, Arena *arena) {
+    for (int i = 0; i < pipeline->count; i++) {
+        if (expand_command(&pipeline->cmds[i], arena) != 0) return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,387 @@
+#include "func.h"
+#include "alloc.h"
+#include "arena.h"
+#include "builtins.h"
+#include "execute.h"
+#include "parse.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FUNC_DEPTH_MAX 256
+#define FUNC_BUCKETS_INITIAL 64
+
+typedef struct Function {
+    struct Function *next;
+    uint64_t hash;
+    char *name;
+    char *text;         // the body; statements point into it
+    Arena arena;        // the statements
+    PackedPipeline *stmts;
+    int nstmts;
+    int refs;           // calls running it
+    int dead;           // replaced or unset while running
+} Function;
+
+// One call: $1..$N are argv[1..argc), and the locals it made start at
+// index locals of the saved-value stack. A sourced script gets a frame too,
+// so return stops it, but its locals belong to the function around it.
+typedef struct {
+    int argc;
+    char **argv;
+    size_t locals;
+    int returning;
+    int status;
+    int source;
+} Frame;
+
+// A variable's value from before a local shadowed it
+typedef struct {
+    char *name;
+    char *old;          // NULL: was not a shell variable
+} Local;
+
+static Function **buckets = NULL;
+static size_t nbuckets = 0, nfuncs = 0;
+static Frame frames[FUNC_DEPTH_MAX];
+static int depth = 0;
+static Local *locals = NULL;
+static size_t nlocals = 0, locals_cap = 0;
+
+static uint64_t fnv1a(const char *s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static Function **find_slot(const char *name) {
+    if (nbuckets == 0) return NULL;
+    uint64_t h = fnv1a(name);
+    Function **slot = &buckets[h & (nbuckets - 1)];
+    while (*slot && ((*slot)->hash != h || strcmp((*slot)->name, name) != 0)) {
+        slot = &(*slot)->next;
+    }
+    return slot;
+}
+
+static Function *lookup(const char *name) {
+    if (!name || nfuncs == 0) return NULL;
+    Function **slot = find_slot(name);
+    return slot ? *slot : NULL;
+}
+
+static void destroy(Function *fn) {
+    arena_free(&fn->arena);
+    xfree(fn->stmts);
+    xfree(fn->text);
+    xfree(fn->name);
+    xfree(fn);
+}
+
+// Take fn out of the table; a running call frees it when it returns
+static void unlink_function(Function **slot) {
+    Function *fn = *slot;
+    *slot = fn->next;
+    nfuncs--;
+    if (fn->refs > 0) fn->dead = 1;
+    else destroy(fn);
+}
+
+static int grow_buckets(void) {
+    size_t n = nbuckets ? nbuckets * 2 : FUNC_BUCKETS_INITIAL;
+    Function **fresh = xcalloc(ALLOC_PARSER, n, sizeof(Function *));
+    if (!fresh) return -1;
+    for (size_t i = 0; i < nbuckets; i++) {
+        Function *fn = buckets[i];
+        while (fn) {
+            Function *next = fn->next;
+            fn->next = fresh[fn->hash & (n - 1)];
+            fresh[fn->hash & (n - 1)] = fn;
+            fn = next;
+        }
+    }
+    xfree(buckets);
+    buckets = fresh;
+    nbuckets = n;
+    return 0;
+}
+
+// Parse the body's statements, separated by ';' or newlines, each packed
+// into the function's arena
+static int parse_body(Function *fn) {
+    Pipeline *p = xmalloc(ALLOC_PARSER, sizeof(Pipeline));
+    if (!p) {
+        perror("minibash");
+        return -1;
+    }
+    init_pipeline(p);
+    int cap = 0, ret = 0;
+    char *saveptr = NULL;
+    for (char *s = strtok_r(fn->text, ";\n", &saveptr); s; s = strtok_r(NULL, ";\n", &saveptr)) {
+        int r = parse_line_again(s, p);
+        if (r < 0) {
+            ret = -1;
+            break;
+        }
+        if (r == 0) continue;
+        if (fn->nstmts == cap) {
+            cap = cap ? cap * 2 : 4;
+            PackedPipeline *tmp = xrealloc(ALLOC_PARSER, fn->stmts, (size_t)cap * sizeof(PackedPipeline));
+            if (!tmp) {
+                perror("minibash");
+                ret = -1;
+                break;
+            }
+            fn->stmts = tmp;
+        }
+        if (pack_pipeline(&fn->stmts[fn->nstmts], p, &fn->arena) != 0) {
+            perror("minibash");
+            ret = -1;
+            break;
+        }
+        fn->nstmts++;
+    }
+    free_pipeline(p);
+    xfree(p);
+    return ret;
+}
+
+static int name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '-';
+}
+
+int func_define(char *text, size_t *used) {
+    const char *p = text;
+    if (!isalpha((unsigned char)*p) && *p != '_') return 0;
+    while (name_char(*p)) p++;
+    size_t name_len = (size_t)(p - text);
+    while (*p == ' ' || *p == '\t') p++;
+    if (p[0] != '(' || p[1] != ')') return 0;
+    p += 2;
+    while (isspace((unsigned char)*p)) p++;
+    if (!*p) return 2;
+    if (*p != '{' || (p[1] && !isspace((unsigned char)p[1]))) {
+        parse_error_prefix();
+        fprintf(stderr, "%.*s: function body must be a { list; }\n", (int)name_len, text);
+        *used = strlen(text);
+        return -1;
+    }
+
+    // The body ends at the first } that starts a command
+    const char *body = p + 1, *q = body, *end = NULL;
+    int at_start = 1;
+    while (*q && !end) {
+        if (*q == ';' || *q == '\n') {
+            at_start = 1;
+            q++;
+        } else if (*q == ' ' || *q == '\t') {
+            q++;
+        } else {
+            const char *w = q;
+            while (*q && !strchr(" \t;\n", *q)) q++;
+            if (at_start && q - w == 1 && *w == '}') end = w;
+            at_start = 0;
+        }
+    }
+    if (!end) return 2;
+    *used = (size_t)(end + 1 - text);
+    if (end[1] && !strchr(" \t;\n", end[1])) {
+        parse_error_prefix();
+        fprintf(stderr, "%.*s: unexpected text after function body\n", (int)name_len, text);
+        *used += strcspn(end + 1, ";\n");
+        return -1;
+    }
+    if (body + strspn(body, " \t;\n") == end) {
+        parse_error_prefix();
+        fprintf(stderr, "%.*s: empty function body\n", (int)name_len, text);
+        return -1;
+    }
+
+    Function *fn = xcalloc(ALLOC_PARSER, 1, sizeof(Function));
+    if (fn) arena_init(&fn->arena);
+    if (!fn || !(fn->name = xstrndup(ALLOC_PARSER, text, name_len)) ||
+        !(fn->text = xstrndup(ALLOC_PARSER, body, (size_t)(end - body)))) {
+        perror("minibash");
+        if (fn) destroy(fn);
+        return -1;
+    }
+    if (parse_body(fn) != 0 || (nfuncs >= nbuckets && grow_buckets() != 0)) {
+        destroy(fn);
+        return -1;
+    }
+    fn->hash = fnv1a(fn->name);
+    Function **slot = find_slot(fn->name);
+    if (*slot) unlink_function(slot);
+    fn->next = buckets[fn->hash & (nbuckets - 1)];
+    buckets[fn->hash & (nbuckets - 1)] = fn;
+    nfuncs++;
+    return 1;
+}
+
+int func_exists(const char *name) {
+    return lookup(name) != NULL;
+}
+
+int func_unset(const char *name) {
+    if (nfuncs == 0) return -1;
+    Function **slot = find_slot(name);
+    if (!*slot) return -1;
+    unlink_function(slot);
+    return 0;
+}
+
+static int is_shell_var(const char *name, const char **value) {
+    const EnvironmentVars *vars = get_vars();
+    for (int i = 0; i < vars->count; i++) {
+        if (strcmp(vars->names[i], name) == 0) {
+            *value = vars->values[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// The innermost function call, looking through sourced scripts
+static Frame *call_frame(void) {
+    for (int i = depth - 1; i >= 0; i--) {
+        if (!frames[i].source) return &frames[i];
+    }
+    return NULL;
+}
+
+int func_local(const char *name, const char *value) {
+    Frame *frame = call_frame();
+    if (!frame) return -1;
+    for (size_t i = frame->locals; i < nlocals; i++) {
+        if (strcmp(locals[i].name, name) == 0) return set_var(name, value ? value : "");
+    }
+    if (nlocals == locals_cap) {
+        size_t cap = locals_cap ? locals_cap * 2 : 16;
+        Local *tmp = xrealloc(ALLOC_VARS, locals, cap * sizeof(Local));
+        if (!tmp) return -1;
+        locals = tmp;
+        locals_cap = cap;
+    }
+    const char *old = NULL;
+    Local *l = &locals[nlocals];
+    l->name = xstrdup(ALLOC_VARS, name);
+    l->old = is_shell_var(name, &old) ? xstrdup(ALLOC_VARS, old) : NULL;
+    if (!l->name || (old && !l->old)) {
+        xfree(l->name);
+        xfree(l->old);
+        return -1;
+    }
+    nlocals++;
+    return set_var(name, value ? value : "");
+}
+
+// Put back what the locals above base shadowed, newest first
+static void unwind_locals(size_t base) {
+    while (nlocals > base) {
+        Local *l = &locals[--nlocals];
+        if (l->old) set_var(l->name, l->old);
+        else unset_var(l->name);
+        xfree(l->name);
+        xfree(l->old);
+    }
+}
+
+int func_return(int status) {
+    if (depth == 0) return -1;
+    frames[depth - 1].returning = 1;
+    frames[depth - 1].status = status;
+    return 0;
+}
+
+int func_argc(void) {
+    return depth > 0 ? frames[depth - 1].argc - 1 : 0;
+}
+
+const char *func_arg(int n) {
+    if (n == 0) return "minibash";
+    if (depth == 0 || n >= frames[depth - 1].argc) return NULL;
+    return frames[depth - 1].argv[n];
+}
+
+int func_returning(void) {
+    return depth > 0 && frames[depth - 1].returning;
+}
+
+int func_enter_source(int argc, char **argv) {
+    if (depth == FUNC_DEPTH_MAX) {
+        parse_error_prefix();
+        fprintf(stderr, "%s: maximum nesting level exceeded (%d)\n",
+                argv[0], FUNC_DEPTH_MAX);
+        return -1;
+    }
+    // Without arguments of its own a script sees its caller's
+    if (argc <= 1 && depth > 0) {
+        argc = frames[depth - 1].argc;
+        argv = frames[depth - 1].argv;
+    }
+    frames[depth++] = (Frame){argc, argv, nlocals, 0, 0, 1};
+    return 0;
+}
+
+int func_leave_source(int status) {
+    Frame *frame = &frames[--depth];
+    return frame->returning ? frame->status : status;
+}
+
+int func_call(const char *name, int argc, char **argv) {
+    Function *fn = lookup(name);
+    if (!fn) return 127;
+    if (depth == FUNC_DEPTH_MAX) {
+        fprintf(stderr, "minibash: %s: maximum function nesting level exceeded (%d)\n",
+                name, FUNC_DEPTH_MAX);
+        return 1;
+    }
+
+    Arena arena;
+    arena_init(&arena);
+    Pipeline *work = arena_alloc(&arena, sizeof(Pipeline));
+    if (!work) {
+        perror("minibash");
+        return 1;
+    }
+    char **args[MAX_CMDS] = {0};
+
+    fn->refs++;
+    Frame *frame = &frames[depth++];
+    *frame = (Frame){argc, argv, nlocals, 0, 0, 0};
+    int status = 0;
+    for (int i = 0; i < fn->nstmts && !frame->returning && !execute_exiting(); i++) {
+        // The executor rewrites what it runs, so each statement runs from
+        // a copy whose argument arrays live in the call's arena
+        if (unpack_pipeline(work, args, &fn->stmts[i], &arena) != 0) {
+            perror("minibash");
+            status = 1;
+            break;
+        }
+        status = execute_commands(work);
+    }
+    if (frame->returning) status = frame->status;
+    unwind_locals(frame->locals);
+    depth--;
+    arena_free(&arena);
+    if (--fn->refs == 0 && fn->dead) destroy(fn);
+    return status;
+}
+
+void func_cleanup(void) {
+    unwind_locals(0);
+    xfree(locals);
+    locals = NULL;
+    locals_cap = 0;
+    for (size_t i = 0; i < nbuckets; i++) {
+        while (buckets[i]) unlink_function(&buckets[i]);
+    }
+    xfree(buckets);
+    buckets = NULL;
+    nbuckets = 0;
+}
@@ -0,0 +1,164 @@
+#include "fuzzy.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define SCORE_MATCH 16
+#define BONUS_BOUNDARY 10
+#define BONUS_FIRST_CHAR 12
+#define BONUS_CONSECUTIVE 8
+#define PENALTY_GAP_START 3
+#define PENALTY_GAP_EXTEND 1
+
+static int fold(int c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static int char_bit(int c) {
+    c = fold(c);
+    if (c >= 'a' && c <= 'z') return c - 'a';
+    if (c >= '0' && c <= '9') return 26 + (c - '0');
+    switch (c) {
+    case '-': return 36;
+    case '_': return 37;
+    case '.': return 38;
+    case '/': return 39;
+    case '+': return 40;
+    }
+    return 41 + (c & 15);
+}
+
+uint64_t fuzzy_mask(const char *s) {
+    uint64_t m = 0;
+    for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+        m |= (uint64_t)1 << char_bit(*p);
+    }
+    return m;
+}
+
+static int prefilter_scalar(const uint64_t *masks, int from, int n, uint64_t need, int *out) {
+    int k = 0;
+    for (int i = from; i < n; i++) {
+        if ((masks[i] & need) == need) out[k++] = i;
+    }
+    return k;
+}
+
+#if defined(__x86_64__)
+// SSE2 has no 64-bit compare: compare the 32-bit halves and require both
+static int prefilter_sse2(const uint64_t *masks, int n, uint64_t need, int *out) {
+    const __m128i vneed = _mm_set1_epi64x((long long)need);
+    int k = 0;
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(masks + i));
+        __m128i eq = _mm_cmpeq_epi32(_mm_and_si128(v, vneed), vneed);
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        int bits = _mm_movemask_pd(_mm_castsi128_pd(eq));
+        if (bits & 1) out[k++] = i;
+        if (bits & 2) out[k++] = i + 1;
+    }
+    return k + prefilter_scalar(masks, i, n, need, out + k);
+}
+
+__attribute__((target("avx2")))
+static int prefilter_avx2(const uint64_t *masks, int n, uint64_t need, int *out) {
+    const __m256i vneed = _mm256_set1_epi64x((long long)need);
+    int k = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(masks + i));
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_and_si256(v, vneed), vneed);
+        int bits = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        // Most candidates are rejected, so the common case is one test
+        while (bits) {
+            int b = __builtin_ctz((unsigned)bits);
+            out[k++] = i + b;
+            bits &= bits - 1;
+        }
+    }
+    return k + prefilter_scalar(masks, i, n, need, out + k);
+}
+#endif
+
+int fuzzy_prefilter(const uint64_t *masks, int n, uint64_t need, int *out) {
+#if defined(__x86_64__)
+    static int use_avx2 = -1;
+    if (use_avx2 < 0) use_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    if (use_avx2) return prefilter_avx2(masks, n, need, out);
+    return prefilter_sse2(masks, n, need, out);
+#else
+    return prefilter_scalar(masks, 0, n, need, out);
+#endif
+}
+
+static int is_boundary(const char *cand, int i) {
+    if (i == 0) return 1;
+    char prev = cand[i - 1];
+    char cur = cand[i];
+    if (prev == '-' || prev == '_' || prev == '.' || prev == '/' || prev == ' ') return 1;
+    // camelCase and letter/digit transitions
+    if (prev >= 'a' && prev <= 'z' && cur >= 'A' && cur <= 'Z') return 1;
+    if (!(prev >= '0' && prev <= '9') && cur >= '0' && cur <= '9') return 1;
+    return 0;
+}
+
+int fuzzy_score(const char *query, const char *cand) {
+    int qlen = (int)strlen(query);
+    int clen = (int)strlen(cand);
+    if (qlen == 0) return 0;
+    if (qlen > clen) return -1;
+
+    // Forward pass: earliest position where the whole query has matched
+    int qi = 0;
+    int end = -1;
+    for (int i = 0; i < clen; i++) {
+        if (fold((unsigned char)cand[i]) == fold((unsigned char)query[qi])) {
+            if (++qi == qlen) {
+                end = i;
+                break;
+            }
+        }
+    }
+    if (end < 0) return -1;
+
+    // Backward pass from there: the shortest window holding the match
+    int start = end;
+    qi = qlen - 1;
+    for (int i = end; i >= 0; i--) {
+        if (fold((unsigned char)cand[i]) == fold((unsigned char)query[qi])) {
+            if (--qi < 0) {
+                start = i;
+                break;
+            }
+        }
+    }
+
+    // Score the window, matching left to right again
+    int score = 0;
+    int prev = -2;
+    int run = 0;
+    qi = 0;
+    for (int i = start; i <= end && qi < qlen; i++) {
+        if (fold((unsigned char)cand[i]) != fold((unsigned char)query[qi])) continue;
+        score += SCORE_MATCH;
+        if (is_boundary(cand, i)) score += i == 0 ? BONUS_FIRST_CHAR : BONUS_BOUNDARY;
+        if (prev == i - 1) {
+            run++;
+            score += BONUS_CONSECUTIVE * run;
+        } else {
+            run = 0;
+            if (prev >= 0) {
+                int gap = i - prev - 1;
+                score -= PENALTY_GAP_START + PENALTY_GAP_EXTEND * (gap - 1);
+            }
+        }
+        prev = i;
+        qi++;
+    }
+    if (score < 0) score = 0;
+    return score;
+}
@@ -0,0 +1,109 @@
+#include "gapbuf.h"
+#include "alloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int gapbuf_init(GapBuf *gb, size_t cap) {
+    if (cap < 16) cap = 16;
+    gb->data = xmalloc(ALLOC_EDITOR, cap);
+    if (!gb->data) return -1;
+    gb->cap = cap;
+    gb->gap_start = 0;
+    gb->gap_end = cap;
+    return 0;
+}
+
+void gapbuf_free(GapBuf *gb) {
+    xfree(gb->data);
+    gb->data = NULL;
+    gb->cap = gb->gap_start = gb->gap_end = 0;
+}
+
+// Make room for at least n more bytes while keeping one spare byte in the
+// gap, which gapbuf_head() uses for its terminator.
+static int reserve(GapBuf *gb, size_t n) {
+    size_t gap = gb->gap_end - gb->gap_start;
+    if (gap > n) return 0;
+
+    size_t tail = gb->cap - gb->gap_end;
+    size_t cap = gb->cap * 2;
+    while (cap - gapbuf_len(gb) <= n) cap *= 2;
+    char *tmp = xrealloc(ALLOC_EDITOR, gb->data, cap);
+    if (!tmp) return -1;
+    memmove(tmp + cap - tail, tmp + gb->gap_end, tail);
+    gb->data = tmp;
+    gb->gap_end = cap - tail;
+    gb->cap = cap;
+    return 0;
+}
+
+void gapbuf_move_to(GapBuf *gb, size_t pos) {
+    size_t len = gapbuf_len(gb);
+    if (pos > len) pos = len;
+    size_t gap = gb->gap_end - gb->gap_start;
+    if (pos < gb->gap_start) {
+        size_t n = gb->gap_start - pos;
+        memmove(gb->data + gb->gap_end - n, gb->data + pos, n);
+    } else if (pos > gb->gap_start) {
+        size_t n = pos - gb->gap_start;
+        memmove(gb->data + gb->gap_start, gb->data + gb->gap_end, n);
+    }
+    gb->gap_start = pos;
+    gb->gap_end = pos + gap;
+}
+
+int gapbuf_insert(GapBuf *gb, const char *s, size_t n) {
+    if (n == 0) return 0;
+    if (reserve(gb, n) != 0) return -1;
+    memcpy(gb->data + gb->gap_start, s, n);
+    gb->gap_start += n;
+    return 0;
+}
+
+size_t gapbuf_delete_back(GapBuf *gb, size_t n) {
+    if (n > gb->gap_start) n = gb->gap_start;
+    gb->gap_start -= n;
+    return n;
+}
+
+size_t gapbuf_delete_forward(GapBuf *gb, size_t n) {
+    size_t tail = gb->cap - gb->gap_end;
+    if (n > tail) n = tail;
+    gb->gap_end += n;
+    return n;
+}
+
+int gapbuf_set(GapBuf *gb, const char *s, size_t n) {
+    gb->gap_start = 0;
+    gb->gap_end = gb->cap;
+    return gapbuf_insert(gb, s, n);
+}
+
+void gapbuf_copy(const GapBuf *gb, size_t from, size_t to, char *dst) {
+    if (from < gb->gap_start) {
+        size_t end = to < gb->gap_start ? to : gb->gap_start;
+        memcpy(dst, gb->data + from, end - from);
+        dst += end - from;
+        from = end;
+    }
+    if (from < to) {
+        size_t gap = gb->gap_end - gb->gap_start;
+        memcpy(dst, gb->data + from + gap, to - from);
+    }
+}
+
+const char *gapbuf_head(GapBuf *gb) {
+    gb->data[gb->gap_start] = '\0';
+    return gb->data;
+}
+
+char *gapbuf_detach(GapBuf *gb, size_t *len) {
+    gapbuf_move_to(gb, gapbuf_len(gb));
+    char *s = gb->data;
+    s[gb->gap_start] = '\0';
+    if (len) *len = gb->gap_start;
+    gb->data = NULL;
+    gb->cap = gb->gap_start = gb->gap_end = 0;
+    return s;
+}
@@ -1,5 +1,10 @@
 #include "line_edit.h"
+#include "alloc.h"
+#include "builtins.h"
 #include "completion.h"
+#include "gapbuf.h"
+#include "render.h"
+#include "suggest.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,17 +12,56 @@
 #include <termios.h>
 #include <unistd.h>
 #include <ctype.h>
-#include <sys/ioctl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/types.h>
-#include <sys/uio.h>
-#include <signal.h>
+
+#define INPUT_BUF_SIZE 4096
+#define COMPLETION_TIMEOUT_MS 250
+// How long the rest of an escape sequence may lag its ESC; terminals send
+// them in one write, so a longer gap means ESC was pressed on its own
+#define ESC_TIMEOUT_MS 50
+// History lines kept unless HISTSIZE says otherwise
+#define HISTSIZE_DEFAULT 1000
+
+// Decoded keys that do not map to a single byte
+enum {
+    KEY_UP = 1000,
+    KEY_DOWN,
+    KEY_RIGHT,
+    KEY_LEFT,
+    KEY_HOME,
+    KEY_END,
+    KEY_DELETE,
+    KEY_WORD_LEFT,
+    KEY_WORD_RIGHT,
+    KEY_PASTE_START,
+    KEY_UNKNOWN
+};
 
 struct LineEditor {
     struct termios orig;
     int raw_enabled;
-    char **history;
+    // Oldest first; the strings belong to the suggestion trie
+    const char **history;
     int hist_count;
     int hist_cap;
+    SuggestTrie *suggest;
+    Renderer render;
+    // Bytes read from the terminal but not consumed yet
+    unsigned char in[INPUT_BUF_SIZE];
+    int in_len;
+    int in_pos;
+    // Pasted text not entered yet, NUL-terminated
+    char *paste;
+    size_t paste_pos;
+    // Last killed text, for Ctrl-Y
+    char *kill;
+    size_t kill_len;
+    int prompt_fd;
+    PromptRefresh prompt_refresh;
+    void *prompt_ctx;
 };
 
 static int enable_raw(LineEditor *ed) {
@@ -35,41 +79,75 @@ static int enable_raw(LineEditor *ed) {
     raw.c_cc[VTIME] = 0;
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) return -1;
     ed->raw_enabled = 1;
+    // Ask the terminal to bracket pasted text with ESC[200~ ... ESC[201~
+    outbuf_puts(&ed->render.out, "\033[?2004h");
+    outbuf_flush(&ed->render.out);
     return 0;
 }
 
 static void disable_raw(LineEditor *ed) {
     if (!ed->raw_enabled) return;
+    outbuf_puts(&ed->render.out, "\033[?2004l");
+    outbuf_flush(&ed->render.out);
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &ed->orig);
     ed->raw_enabled = 0;
 }
 
 LineEditor *line_editor_create(void) {
-    LineEditor *ed = calloc(1, sizeof(LineEditor));
+    LineEditor *ed = xcalloc(ALLOC_EDITOR, 1, sizeof(LineEditor));
     if (!ed) return NULL;
     ed->hist_cap = 128;
-    ed->history = calloc(ed->hist_cap, sizeof(char *));
+    ed->history = xcalloc(ALLOC_HISTORY, ed->hist_cap, sizeof(char *));
     if (!ed->history) {
-        free(ed);
+        xfree(ed);
         return NULL;
     }
+    ed->suggest = suggest_create();
+    ed->prompt_fd = -1;
+    render_init(&ed->render, STDOUT_FILENO);
     return ed;
 }
 
+void line_editor_set_prompt_hook(LineEditor *ed, int fd, PromptRefresh refresh, void *ctx) {
+    ed->prompt_fd = refresh ? fd : -1;
+    ed->prompt_refresh = refresh;
+    ed->prompt_ctx = ctx;
+}
+
 void line_editor_destroy(LineEditor *ed) {
     if (!ed) return;
     disable_raw(ed);
-    for (int i = 0; i < ed->hist_count; i++) {
-        free(ed->history[i]);
-    }
-    free(ed->history);
-    free(ed);
+    xfree(ed->history);
+    xfree(ed->paste);
+    xfree(ed->kill);
+    suggest_destroy(ed->suggest);
+    render_free(&ed->render);
+    xfree(ed);
+}
+
+static int history_size(void) {
+    const char *v = get_var("HISTSIZE");
+    int n = v ? atoi(v) : 0;
+    return n > 0 ? n : HISTSIZE_DEFAULT;
 }
 
 static void history_add(LineEditor *ed, const char *line) {
     if (!line || !*line) return;
-    if (ed->hist_count == ed->hist_cap) return;
-    ed->history[ed->hist_count++] = strdup(line);
+    int max = history_size();
+    // Past HISTSIZE the oldest lines go, down to room for this one
+    while (ed->hist_count > 0 && ed->hist_count >= max) {
+        suggest_release(ed->suggest, ed->history[0]);
+        ed->hist_count--;
+        memmove(ed->history, ed->history + 1, (size_t)ed->hist_count * sizeof(char *));
+    }
+    if (ed->hist_count == ed->hist_cap) {
+        const char **tmp = xrealloc(ALLOC_HISTORY, ed->history, (size_t)ed->hist_cap * 2 * sizeof(char *));
+        if (!tmp) return;
+        ed->history = tmp;
+        ed->hist_cap *= 2;
+    }
+    const char *shared = suggest_record(ed->suggest, line);
+    if (shared) ed->history[ed->hist_count++] = shared;
 }
 
 static const char *history_get(LineEditor *ed, int index) {
@@ -77,114 +155,359 @@ static const char *history_get(LineEditor *ed, int index) {
     return ed->history[index];
 }
 
-static int prompt_display_len(const char *prompt) {
-    int len = 0;
-    for (const char *p = prompt; *p; p++) {
-        if (*p == '\033') {
-            while (*p && *p != 'm') {
-                p++;
-            }
-            continue;
-        }
-        len++;
+// Returns the next input byte, refilling the buffer with everything the
+// terminal has available in one read() when it runs dry.
+static int read_byte(LineEditor *ed) {
+    if (ed->in_pos == ed->in_len) {
+        ssize_t n;
+        do {
+            n = read(STDIN_FILENO, ed->in, sizeof(ed->in));
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) return -1;
+        ed->in_len = (int)n;
+        ed->in_pos = 0;
     }
-    return len;
+    return ed->in[ed->in_pos++];
+}
+
+static int input_pending(const LineEditor *ed) {
+    return ed->in_pos < ed->in_len;
 }
 
-static void line_refresh(const char *prompt, const char *buf, int len, int pos) {
-    fputs("\r", stdout);
-    fputs(prompt, stdout);
-    fwrite(buf, 1, (size_t)len, stdout);
-    fputs("\033[K", stdout);
-    int prompt_len = prompt_display_len(prompt);
-    int target = prompt_len + pos;
-    int current = prompt_len + len;
-    if (current > target) {
-        char seq[32];
-        snprintf(seq, sizeof(seq), "\033[%dD", current - target);
-        fputs(seq, stdout);
+// Blocks until the terminal has input. Returns 1 if the prompt hook fired
+// first, 0 when input is ready.
+static int wait_input(LineEditor *ed) {
+    if (input_pending(ed) || ed->prompt_fd < 0) return 0;
+    struct pollfd fds[2] = {
+        { .fd = STDIN_FILENO, .events = POLLIN },
+        { .fd = ed->prompt_fd, .events = POLLIN },
+    };
+    while (poll(fds, 2, -1) < 0) {
+        if (errno != EINTR) return 0;
     }
-    fflush(stdout);
+    return fds[0].revents == 0 && fds[1].revents != 0;
 }
 
-static int read_key(void) {
-    unsigned char c;
-    if (read(STDIN_FILENO, &c, 1) != 1) return -1;
-    return c;
+// Whether input arrives within ms
+static int input_within(LineEditor *ed, int ms) {
+    if (input_pending(ed)) return 1;
+    struct pollfd fd = { .fd = STDIN_FILENO, .events = POLLIN };
+    int n;
+    while ((n = poll(&fd, 1, ms)) < 0 && errno == EINTR) {
+    }
+    return n != 0;
 }
 
-static void get_term_size(int *cols, int *rows) {
-    struct winsize ws;
-    int c = 80, r = 24;
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0) {
-        if (ws.ws_col > 0) c = ws.ws_col;
-        if (ws.ws_row > 0) r = ws.ws_row;
+// Reads one key, decoding escape sequences into KEY_* codes. A lone ESC is
+// returned as 27.
+static int read_key(LineEditor *ed) {
+    int c = read_byte(ed);
+    if (c != 27) return c;
+    if (!input_within(ed, ESC_TIMEOUT_MS)) return 27;
+
+    int c1 = read_byte(ed);
+    if (c1 == -1) return -1;
+    if (c1 == 'b') return KEY_WORD_LEFT;
+    if (c1 == 'f') return KEY_WORD_RIGHT;
+    if (c1 != '[' && c1 != 'O') return KEY_UNKNOWN;
+
+    // CSI: numeric parameters followed by a final byte
+    int params[2] = {0, 0};
+    int nparams = 0;
+    int f;
+    while ((f = read_byte(ed)) != -1) {
+        if (f >= '0' && f <= '9') {
+            if (nparams == 0) nparams = 1;
+            if (nparams <= 2) params[nparams - 1] = params[nparams - 1] * 10 + (f - '0');
+        } else if (f == ';') {
+            nparams++;
+        } else {
+            break;
+        }
+    }
+    if (f == -1) return -1;
+
+    switch (f) {
+    case 'A': return KEY_UP;
+    case 'B': return KEY_DOWN;
+    case 'C': return params[1] == 5 ? KEY_WORD_RIGHT : KEY_RIGHT;
+    case 'D': return params[1] == 5 ? KEY_WORD_LEFT : KEY_LEFT;
+    case 'H': return KEY_HOME;
+    case 'F': return KEY_END;
+    case '~':
+        switch (params[0]) {
+        case 1: case 7: return KEY_HOME;
+        case 4: case 8: return KEY_END;
+        case 3: return KEY_DELETE;
+        case 200: return KEY_PASTE_START;
+        }
+        break;
     }
-    if (cols) *cols = c;
-    if (rows) *rows = r;
+    return KEY_UNKNOWN;
 }
 
-static void print_completions_table(Completion *comp) {
-    if (!comp || comp->count == 0) return;
+static int paste_put(char **paste, int *len, int *cap, int c) {
+    // Control bytes other than tabs and line breaks cannot be shown
+    if ((c < 32 && c != '\t' && c != '\n' && c != '\r') || c == 127) return 0;
+    if (*len + 1 >= *cap) {
+        char *tmp = xrealloc(ALLOC_EDITOR, *paste, (size_t)*cap * 2);
+        if (!tmp) return -1;
+        *paste = tmp;
+        *cap *= 2;
+    }
+    (*paste)[(*len)++] = (char)c;
+    return 0;
+}
 
-    int term_cols = 80, term_rows = 24;
-    get_term_size(&term_cols, &term_rows);
+// Collects bracketed paste content up to the closing ESC[201~, unchanged
+// but for control bytes. Returns NULL for an empty paste.
+static char *read_paste(LineEditor *ed) {
+    static const char end_seq[] = "\033[201~";
+    const int end_len = (int)sizeof(end_seq) - 1;
+
+    int cap = 1024;
+    int len = 0;
+    char *paste = xmalloc(ALLOC_EDITOR, (size_t)cap);
+    if (!paste) return NULL;
+
+    int matched = 0;
+    while (matched < end_len) {
+        int c = read_byte(ed);
+        if (c == -1) break;
+        if (c == end_seq[matched]) {
+            matched++;
+            continue;
+        }
+        // False alarm: the partial terminator was pasted text
+        int failed = 0;
+        for (int i = 0; i < matched; i++) failed |= paste_put(&paste, &len, &cap, end_seq[i]);
+        matched = 0;
+        if (c == end_seq[0]) matched = 1;
+        else failed |= paste_put(&paste, &len, &cap, c);
+        if (failed) {
+            xfree(paste);
+            return NULL;
+        }
+    }
+
+    if (len == 0) {
+        xfree(paste);
+        return NULL;
+    }
+    paste[len] = '\0';
+    return paste;
+}
+
+// Inserts pasted text up to the next line break. Returns '\r' if there was
+// one, so the line is entered as if typed, or 0 once the paste is used up.
+static int take_paste(LineEditor *ed, GapBuf *gb) {
+    const char *p = ed->paste + ed->paste_pos;
+    size_t n = strcspn(p, "\r\n");
+    gapbuf_insert(gb, p, n);
+    int c = 0;
+    if (p[n]) {
+        c = '\r';
+        n += p[n] == '\r' && p[n + 1] == '\n' ? 2 : 1;
+    }
+    ed->paste_pos += n;
+    if (!ed->paste[ed->paste_pos]) {
+        xfree(ed->paste);
+        ed->paste = NULL;
+        ed->paste_pos = 0;
+    }
+    return c;
+}
+
+// Lays out one page of the table starting at item start, looking only at
+// items that could fit on screen. Sets the column count and width and
+// returns the number of items on the page.
+static int layout_page(Completion *comp, int start, int rows, int term_cols,
+                       int *cols, int *col_width) {
+    int avail = comp->count - start;
+    int max_cols = term_cols / 4;
+    if (max_cols < 1) max_cols = 1;
+    int candidates = rows * max_cols < avail ? rows * max_cols : avail;
 
-    // Compute max item width
     int max_width = 0;
-    for (int i = 0; i < comp->count; i++) {
-        int l = (int)strlen(comp->matches[i]);
+    for (int i = 0; i < candidates; i++) {
+        int l = (int)strlen(comp->matches[start + i]);
         if (l > max_width) max_width = l;
     }
-    int col_width = max_width + 2;
-    if (col_width < 4) col_width = 4;
-    if (col_width > term_cols) col_width = term_cols;
+    int width = max_width + 2;
+    if (width < 4) width = 4;
+    if (width > term_cols) width = term_cols;
+
+    *col_width = width;
+    *cols = term_cols / width;
+    if (*cols < 1) *cols = 1;
+    return rows * *cols < avail ? rows * *cols : avail;
+}
+
+static void print_completions_table(LineEditor *ed, Completion *comp, int partial) {
+    if (!comp || comp->count == 0) return;
+    OutBuf *out = &ed->render.out;
 
-    int cols = term_cols / col_width;
-    if (cols < 1) cols = 1;
-    int total_rows = (comp->count + cols - 1) / cols;
+    int term_cols = 80, term_rows = 24;
+    render_term_size(&term_cols, &term_rows);
 
     // Leave space for pager prompt and prompt redraw
     int page_rows_max = term_rows - 3;
     if (page_rows_max < 1) page_rows_max = 1;
 
+    // Start of every page shown so far, for paging back
+    int page_cap = 16;
+    int *page_starts = xmalloc(ALLOC_EDITOR, (size_t)page_cap * sizeof(int));
+    if (!page_starts) return;
+    int page = 0;
+    page_starts[0] = 0;
+
     // Separate suggestions from the current input line
-    fputs("\r\n", stdout);
+    outbuf_puts(out, "\r\n");
 
-    int start_row = 0;
-    while (start_row < total_rows) {
-        int end_row = start_row + page_rows_max;
-        if (end_row > total_rows) end_row = total_rows;
+    while (1) {
+        int start = page_starts[page];
+        int cols, col_width;
+        int n = layout_page(comp, start, page_rows_max, term_cols, &cols, &col_width);
+        int rows = (n + cols - 1) / cols;
 
-        for (int r = start_row; r < end_row; r++) {
+        for (int r = 0; r < rows; r++) {
             for (int c = 0; c < cols; c++) {
-                int idx = c * total_rows + r;
-                if (idx >= comp->count) break;
-                const char *match = comp->matches[idx];
-                fprintf(stdout, "%-*s", col_width, match);
+                int idx = c * rows + r;
+                if (idx >= n) break;
+                const char *match = comp->matches[start + idx];
+                size_t l = strlen(match);
+                outbuf_append(out, match, l);
+                if ((int)l < col_width && outbuf_pad(out, ' ', (size_t)col_width - l) != 0) {
+                    // The terminal is gone; there is no one to page for
+                    goto done;
+                }
             }
-            fputs("\r\n", stdout);
+            outbuf_puts(out, "\r\n");
         }
 
-        if (end_row < total_rows) {
-            fputs("-- More (Space next, b back, q quit) --\r\n", stdout);
-            fflush(stdout);
-            int k = read_key();
-            if (k == 'q' || k == 'Q' || k == 27) {
-                break;
-            } else if (k == 'b' || k == 'B') {
-                if (start_row >= page_rows_max) {
-                    start_row -= page_rows_max;
-                }
-            } else {
-                start_row += page_rows_max;
-            }
-        } else {
+        if (start + n >= comp->count) break;
+
+        outbuf_puts(out, "-- More (Space next, b back, q quit) --\r\n");
+        outbuf_flush(out);
+        int k = read_key(ed);
+        if (k == 'q' || k == 'Q' || k == 27 || k == -1) {
             break;
+        } else if (k == 'b' || k == 'B') {
+            if (page > 0) page--;
+        } else {
+            if (page + 1 == page_cap) {
+                int *tmp = xrealloc(ALLOC_EDITOR, page_starts, (size_t)page_cap * 2 * sizeof(int));
+                if (!tmp) break;
+                page_starts = tmp;
+                page_cap *= 2;
+            }
+            page_starts[++page] = start + n;
         }
     }
+done:
+    xfree(page_starts);
 
-    fflush(stdout);
+    if (partial) {
+        outbuf_printf(out, "-- completion timed out; showing %d found so far --\r\n", comp->count);
+    }
+}
+
+static int completion_timeout_ms(void) {
+    const char *v = get_var("COMPLETION_TIMEOUT_MS");
+    int ms = v ? atoi(v) : 0;
+    return ms > 0 ? ms : COMPLETION_TIMEOUT_MS;
+}
+
+static long elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000L + (now.tv_nsec - since->tv_nsec) / 1000000L;
+}
+
+// Runs a completion on the worker thread while watching the keyboard. A key
+// arriving first cancels the request and NULL is returned, leaving the key
+// for the editor. When the deadline passes, whatever was found so far is
+// returned with *partial set.
+static Completion *complete_async(LineEditor *ed, const char *prefix, int *partial) {
+    *partial = 0;
+    if (input_pending(ed)) return NULL;
+
+    // COMPLETION_FUZZY=1 switches to ranked subsequence matching
+    const char *fuzzy = get_var("COMPLETION_FUZZY");
+    int flags = (fuzzy && strcmp(fuzzy, "1") == 0) ? COMPLETE_FUZZY : 0;
+    if (completion_start(prefix, flags) != 0) return completion_find(prefix, flags);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int timeout = completion_timeout_ms();
+
+    while (1) {
+        long left = timeout - elapsed_ms(&start);
+        if (left <= 0) {
+            Completion *snap = completion_snapshot();
+            completion_cancel();
+            *partial = 1;
+            return snap;
+        }
+
+        struct pollfd fds[2] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = completion_notify_fd(), .events = POLLIN },
+        };
+        int n = poll(fds, 2, (int)left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            completion_cancel();
+            return NULL;
+        }
+        if (fds[0].revents) {
+            completion_cancel();
+            return NULL;
+        }
+        if (fds[1].revents) {
+            Completion *c = completion_take();
+            if (c) return c;
+        }
+    }
+}
+
+// Start of the space-delimited word before pos
+static size_t word_start(const GapBuf *gb, size_t pos) {
+    while (pos > 0 && gapbuf_at(gb, pos - 1) == ' ') pos--;
+    while (pos > 0 && gapbuf_at(gb, pos - 1) != ' ') pos--;
+    return pos;
+}
+
+// End of the space-delimited word after pos
+static size_t word_end(const GapBuf *gb, size_t pos) {
+    size_t len = gapbuf_len(gb);
+    while (pos < len && gapbuf_at(gb, pos) == ' ') pos++;
+    while (pos < len && gapbuf_at(gb, pos) != ' ') pos++;
+    return pos;
+}
+
+// Copy [from, to) of the buffer into the kill slot
+static void kill_save(LineEditor *ed, const GapBuf *gb, size_t from, size_t to) {
+    char *tmp = xrealloc(ALLOC_EDITOR, ed->kill, to - from);
+    if (!tmp) return;
+    gapbuf_copy(gb, from, to, tmp);
+    ed->kill = tmp;
+    ed->kill_len = to - from;
+}
+
+// Suggestion suffix for the current line, or NULL. The trie cursor is
+// advanced only over text appended since the previous call; edits anywhere
+// else reset it, and the next call walks the line again.
+static const char *current_hint(LineEditor *ed, const GapBuf *gb, SuggestCursor *sc) {
+    size_t len = gapbuf_len(gb);
+    if (len == 0 || gapbuf_cursor(gb) != len) return NULL;
+    if (sc->depth > len) suggest_reset(ed->suggest, sc);
+    while (sc->depth < len) {
+        suggest_step(ed->suggest, sc, gapbuf_at(gb, sc->depth));
+    }
+    const char *best = suggest_best(ed->suggest, sc);
+    if (!best || !best[len]) return NULL;
+    return best + len;
 }
 
 int line_editor_read(LineEditor *ed, const char *prompt, char **out_line) {
@@ -212,180 +535,184 @@ int line_editor_read(LineEditor *ed, const char *prompt, char **out_line) {
         return -1;
     }
 
-    // No ncurses: we'll manage output manually
-    
-    int cap = 256;
-    char *buf = malloc((size_t)cap);
-    if (!buf) {
+    GapBuf gb;
+    if (gapbuf_init(&gb, 256) != 0) {
+        disable_raw(ed);
         return -1;
     }
-    int len = 0;
-    int pos = 0;
     int hist_pos = ed->hist_count;
+    SuggestCursor sc;
+    suggest_reset(ed->suggest, &sc);
+    const char *hint = NULL;
 
-    fputs(prompt, stdout);
-    fflush(stdout);
+    Renderer *rd = &ed->render;
+    render_begin(rd, prompt);
+    int dirty = 0;
 
     while (1) {
-        int c = read_key();
+        // Redraw once the input that is already buffered has been consumed,
+        // so a burst of keys costs one frame instead of one per byte
+        if (dirty && !input_pending(ed) && !ed->paste) {
+            hint = current_hint(ed, &gb, &sc);
+            render_line(rd, &gb, hint);
+            dirty = 0;
+        }
+
+        int c;
+        if (ed->paste) {
+            // A multi-line paste runs a line at a time
+            c = take_paste(ed, &gb);
+            suggest_reset(ed->suggest, &sc);
+            dirty = 1;
+            if (c == 0) continue;
+        } else if (wait_input(ed)) {
+            render_set_prompt(rd, ed->prompt_refresh(ed->prompt_ctx));
+            dirty = 1;
+            continue;
+        } else {
+            c = read_key(ed);
+        }
         if (c == -1) {
-            free(buf);
+            gapbuf_free(&gb);
             disable_raw(ed);
             return -1;
         }
 
         if (c == '\r' || c == '\n') {
-            fputs("\r\n", stdout);
-            buf[len] = '\0';
-            history_add(ed, buf);
-            *out_line = buf;
+            // Drop any suggestion from the screen before moving on
+            render_line(rd, &gb, NULL);
+            render_finish(rd);
+            outbuf_puts(&rd->out, "\r\n");
+            outbuf_flush(&rd->out);
+            size_t len = 0;
+            char *line = gapbuf_detach(&gb, &len);
+            history_add(ed, line);
+            *out_line = line;
             disable_raw(ed);
-            return len;
+            return (int)len;
         }
 
         if (c == 4) {
-            if (len == 0) {
-                free(buf);
+            if (gapbuf_len(&gb) == 0) {
+                gapbuf_free(&gb);
                 disable_raw(ed);
                 return -1;
             }
+            dirty |= gapbuf_delete_forward(&gb, 1) > 0;
+            suggest_reset(ed->suggest, &sc);
             continue;
         }
 
         if (c == 127 || c == 8) {
-            if (pos > 0) {
-                memmove(&buf[pos - 1], &buf[pos], (size_t)(len - pos));
-                pos--;
-                len--;
-                line_refresh(prompt, buf, len, pos);
+            dirty |= gapbuf_delete_back(&gb, 1) > 0;
+            suggest_reset(ed->suggest, &sc);
+            continue;
+        }
+
+        if (c == 23 || c == 11 || c == 21) {
+            // Ctrl-W: word before the cursor, Ctrl-K: to end, Ctrl-U: to start
+            size_t cur = gapbuf_cursor(&gb);
+            size_t from = cur, to = cur;
+            if (c == 23) from = word_start(&gb, cur);
+            else if (c == 11) to = gapbuf_len(&gb);
+            else from = 0;
+            if (from == to) continue;
+            kill_save(ed, &gb, from, to);
+            if (to > cur) gapbuf_delete_forward(&gb, to - cur);
+            if (from < cur) gapbuf_delete_back(&gb, cur - from);
+            suggest_reset(ed->suggest, &sc);
+            dirty = 1;
+            continue;
+        }
+
+        if (c == 25) {
+            if (ed->kill_len > 0 && gapbuf_insert(&gb, ed->kill, ed->kill_len) == 0) {
+                suggest_reset(ed->suggest, &sc);
+                dirty = 1;
             }
             continue;
         }
 
+        if (c == KEY_PASTE_START) {
+            ed->paste = read_paste(ed);
+            continue;
+        }
+
         if (c == 9) {
-            buf[len] = '\0';
-            char *word_start = &buf[pos];
-            for (int i = pos - 1; i >= 0; i--) {
-                if (buf[i] == ' ') {
-                    word_start = &buf[i + 1];
-                    break;
-                }
-                if (i == 0) {
-                    word_start = &buf[0];
-                }
-            }
-            const char *prefix = word_start;
-            Completion *comp = completion_find(prefix);
+            const char *head = gapbuf_head(&gb);
+            size_t cur = gapbuf_cursor(&gb);
+            size_t start = cur;
+            while (start > 0 && head[start - 1] != ' ') start--;
+            int partial = 0;
+            Completion *comp = complete_async(ed, head + start, &partial);
             if (comp && comp->count > 0) {
-                if (comp->count == 1) {
+                if (comp->count == 1 && !partial) {
                     const char *match = comp->matches[0];
-                    int prefix_len = (int)(word_start - buf);
-                    int match_len = (int)strlen(match);
-                    int new_len = prefix_len + match_len;
-                    if (new_len >= cap) {
-                        cap = new_len + 64;
-                        char *tmp = realloc(buf, (size_t)cap);
-                        if (!tmp) {
-                            completion_free(comp);
-                            disable_raw(ed);
-                            free(buf);
-                            return -1;
-                        }
-                        buf = tmp;
-                        word_start = &buf[prefix_len];
-                    }
-                    strcpy(word_start, match);
-                    len = new_len;
-                    pos = len;
-                    line_refresh(prompt, buf, len, pos);
+                    gapbuf_delete_back(&gb, cur - start);
+                    gapbuf_insert(&gb, match, strlen(match));
+                    suggest_reset(ed->suggest, &sc);
                 } else {
                     // Show table below and then redraw prompt & current input
-                    print_completions_table(comp);
-                    fputs("\r\n", stdout);
-                    line_refresh(prompt, buf, len, pos);
+                    render_finish(rd);
+                    print_completions_table(ed, comp, partial);
+                    outbuf_puts(&rd->out, "\r\n");
+                    render_invalidate(rd);
                 }
+                dirty = 1;
             }
             completion_free(comp);
             continue;
         }
 
-        if (c == 27) {
-            int c1 = read_key();
-            int c2 = read_key();
-            if (c1 == '[') {
-                if (c2 == 'A') {
-                    if (ed->hist_count > 0 && hist_pos > 0) {
-                        hist_pos--;
-                        const char *h = history_get(ed, hist_pos);
-                        len = (int)strlen(h);
-                        if (len >= cap) {
-                            cap = len + 64;
-                            char *tmp = realloc(buf, (size_t)cap);
-                            if (!tmp) {
-                                disable_raw(ed);
-                                free(buf);
-                                return -1;
-                            }
-                            buf = tmp;
-                        }
-                        memcpy(buf, h, (size_t)len + 1);
-                        pos = len;
-                        line_refresh(prompt, buf, len, pos);
-                    }
-                } else if (c2 == 'B') {
-                    if (hist_pos < ed->hist_count) {
-                        hist_pos++;
-                        if (hist_pos == ed->hist_count) {
-                            len = 0; pos = 0; buf[0] = '\0';
-                        } else {
-                            const char *h = history_get(ed, hist_pos);
-                            len = (int)strlen(h);
-                            if (len >= cap) {
-                                cap = len + 64;
-                                char *tmp = realloc(buf, (size_t)cap);
-                                if (!tmp) {
-                                    disable_raw(ed);
-                                    free(buf);
-                                    return -1;
-                                }
-                                buf = tmp;
-                            }
-                            memcpy(buf, h, (size_t)len + 1);
-                        }
-                        pos = len;
-                        line_refresh(prompt, buf, len, pos);
-                    }
-                } else if (c2 == 'C') {
-                    if (pos < len) {
-                        pos++;
-                        line_refresh(prompt, buf, len, pos);
-                    }
-                } else if (c2 == 'D') {
-                    if (pos > 0) {
-                        pos--;
-                        line_refresh(prompt, buf, len, pos);
-                    }
-                }
+        if (c == KEY_UP || c == KEY_DOWN) {
+            if (c == KEY_UP && hist_pos > 0) {
+                hist_pos--;
+            } else if (c == KEY_DOWN && hist_pos < ed->hist_count) {
+                hist_pos++;
+            } else {
+                continue;
             }
+            const char *h = hist_pos < ed->hist_count ? history_get(ed, hist_pos) : "";
+            gapbuf_set(&gb, h, strlen(h));
+            suggest_reset(ed->suggest, &sc);
+            dirty = 1;
             continue;
         }
 
-        if (isprint(c)) {
-            if (len + 1 >= cap) {
-                cap *= 2;
-                char *tmp = realloc(buf, (size_t)cap);
-                if (!tmp) {
-                    disable_raw(ed);
-                    free(buf);
-                    return -1;
-                }
-                buf = tmp;
-            }
-            memmove(&buf[pos + 1], &buf[pos], (size_t)(len - pos));
-            buf[pos] = (char)c;
-            pos++;
-            len++;
-            line_refresh(prompt, buf, len, pos);
+        size_t cur = gapbuf_cursor(&gb);
+        size_t len = gapbuf_len(&gb);
+
+        // Moving right at the end of the line accepts the suggestion. The
+        // hint drawn last may predate keys read in the same burst.
+        if (dirty) hint = current_hint(ed, &gb, &sc);
+        if (hint && cur == len && (c == KEY_RIGHT || c == 6 || c == KEY_END || c == 5)) {
+            if (gapbuf_insert(&gb, hint, strlen(hint)) == 0) dirty = 1;
+            continue;
+        }
+
+        size_t target = cur;
+        switch (c) {
+        case KEY_LEFT: case 2: if (cur > 0) target = cur - 1; break;
+        case KEY_RIGHT: case 6: if (cur < len) target = cur + 1; break;
+        case KEY_HOME: case 1: target = 0; break;
+        case KEY_END: case 5: target = len; break;
+        case KEY_WORD_LEFT: target = word_start(&gb, cur); break;
+        case KEY_WORD_RIGHT: target = word_end(&gb, cur); break;
+        case KEY_DELETE:
+            dirty |= gapbuf_delete_forward(&gb, 1) > 0;
+            suggest_reset(ed->suggest, &sc);
+            continue;
+        }
+        if (target != cur) {
+            gapbuf_move_to(&gb, target);
+            dirty = 1;
+            continue;
+        }
+
+        if (c < 256 && isprint(c)) {
+            char ch = (char)c;
+            if (gapbuf_insert(&gb, &ch, 1) == 0) dirty = 1;
+            if (cur != len) suggest_reset(ed->suggest, &sc);
             continue;
         }
     }
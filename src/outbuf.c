@@ -0,0 +1,106 @@
+#include "outbuf.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OUTBUF_INITIAL_CAP 4096
+
+static int write_all(int fd, const char *s, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, s, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        s += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+static int reserve(OutBuf *ob, size_t extra) {
+    if (ob->len + extra <= ob->cap) return 0;
+    size_t cap = ob->cap ? ob->cap : OUTBUF_INITIAL_CAP;
+    while (cap < ob->len + extra) cap *= 2;
+    char *tmp = realloc(ob->data, cap);
+    if (!tmp) return -1;
+    ob->data = tmp;
+    ob->cap = cap;
+    return 0;
+}
+
+void outbuf_init(OutBuf *ob, int fd) {
+    ob->fd = fd;
+    ob->data = NULL;
+    ob->len = 0;
+    ob->cap = 0;
+}
+
+void outbuf_free(OutBuf *ob) {
+    free(ob->data);
+    ob->data = NULL;
+    ob->len = 0;
+    ob->cap = 0;
+}
+
+void outbuf_append(OutBuf *ob, const char *s, size_t n) {
+    if (n == 0) return;
+    if (reserve(ob, n) != 0) {
+        // Out of memory: fall back to passing the bytes straight through
+        outbuf_flush(ob);
+        write_all(ob->fd, s, n);
+        return;
+    }
+    memcpy(ob->data + ob->len, s, n);
+    ob->len += n;
+}
+
+void outbuf_puts(OutBuf *ob, const char *s) {
+    outbuf_append(ob, s, strlen(s));
+}
+
+void outbuf_printf(OutBuf *ob, const char *fmt, ...) {
+    char small[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(small, sizeof(small), fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n < sizeof(small)) {
+        outbuf_append(ob, small, (size_t)n);
+        return;
+    }
+    if (reserve(ob, (size_t)n + 1) != 0) return;
+    va_start(ap, fmt);
+    vsnprintf(ob->data + ob->len, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    ob->len += (size_t)n;
+}
+
+int outbuf_pad(OutBuf *ob, char c, size_t n) {
+    if (n == 0) return 0;
+    if (reserve(ob, n) != 0) {
+        // Out of memory: pass the padding straight through, as append does
+        char chunk[256];
+        memset(chunk, c, sizeof(chunk));
+        if (outbuf_flush(ob) != 0) return -1;
+        for (; n > sizeof(chunk); n -= sizeof(chunk)) {
+            if (write_all(ob->fd, chunk, sizeof(chunk)) != 0) return -1;
+        }
+        return write_all(ob->fd, chunk, n);
+    }
+    memset(ob->data + ob->len, c, n);
+    ob->len += n;
+    return 0;
+}
+
+int outbuf_flush(OutBuf *ob) {
+    if (ob->len == 0) return 0;
+    int ret = write_all(ob->fd, ob->data, ob->len);
+    ob->len = 0;
+    return ret;
+}
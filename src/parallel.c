@@ -0,0 +1,490 @@
+#define _GNU_SOURCE
+
+#include "parallel.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SPILL_BYTES (256 * 1024)
+#define FAILURES_SHOWN 10
+#define MAX_STATUS 101
+
+extern char **environ;
+
+// Output of one stream of a job: in memory until it grows past SPILL_BYTES,
+// then in a memfd
+typedef struct {
+    char *buf;
+    size_t len, cap;
+    int memfd;
+} Capture;
+
+typedef struct {
+    const char *input;
+    Capture out, err;
+    int status;
+    int done;
+} Job;
+
+// Job indices queued for one worker. The owner takes from the head (lowest
+// index, so output can be emitted early); thieves take from the tail.
+typedef struct {
+    pthread_mutex_t lock;
+    int *items;
+    int head, tail;
+} Deque;
+
+typedef struct {
+    char **tmpl;
+    int tmpl_argc;
+    int has_placeholder;
+    Job *jobs;
+    int njobs;
+    Deque *deques;
+    int nworkers;
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_cond;
+    atomic_int steals;
+} Run;
+
+typedef struct {
+    Run *run;
+    int self;
+} Worker;
+
+static int write_all(int fd, const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void capture_append(Capture *c, const char *data, size_t n) {
+    if (c->memfd == -1 && c->len + n > SPILL_BYTES) {
+        int fd = memfd_create("minibash-parallel", MFD_CLOEXEC);
+        if (fd != -1 && write_all(fd, c->buf, c->len) == 0) {
+            free(c->buf);
+            c->buf = NULL;
+            c->len = c->cap = 0;
+            c->memfd = fd;
+        } else if (fd != -1) {
+            close(fd);
+        }
+    }
+    if (c->memfd != -1) {
+        write_all(c->memfd, data, n);
+        return;
+    }
+    if (c->len + n > c->cap) {
+        size_t cap = c->cap ? c->cap : 4096;
+        while (cap < c->len + n) cap *= 2;
+        char *tmp = realloc(c->buf, cap);
+        if (!tmp) return;
+        c->buf = tmp;
+        c->cap = cap;
+    }
+    memcpy(c->buf + c->len, data, n);
+    c->len += n;
+}
+
+static void capture_emit(Capture *c, int fd) {
+    if (c->memfd == -1) {
+        write_all(fd, c->buf, c->len);
+    } else {
+        lseek(c->memfd, 0, SEEK_SET);
+        ssize_t n;
+        while ((n = sendfile(fd, c->memfd, NULL, 1 << 20)) > 0) {
+        }
+        if (n == -1) {
+            // Targets sendfile cannot write to (e.g. O_APPEND files)
+            char chunk[65536];
+            while ((n = read(c->memfd, chunk, sizeof(chunk))) > 0) {
+                if (write_all(fd, chunk, (size_t)n) != 0) break;
+            }
+        }
+        close(c->memfd);
+    }
+    free(c->buf);
+    c->buf = NULL;
+}
+
+static int deque_pop(Deque *d) {
+    int idx = -1;
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail) idx = d->items[d->head++];
+    pthread_mutex_unlock(&d->lock);
+    return idx;
+}
+
+static int deque_steal(Deque *d) {
+    int idx = -1;
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail) idx = d->items[--d->tail];
+    pthread_mutex_unlock(&d->lock);
+    return idx;
+}
+
+// argv for one job; strings made here are owned by the returned array's
+// second half so the caller can free them
+static char **job_argv(const Run *run, const char *input) {
+    int argc = run->tmpl_argc + !run->has_placeholder;
+    char **argv = calloc((size_t)argc * 2 + 1, sizeof(char *));
+    if (!argv) return NULL;
+    char **owned = argv + argc + 1;
+    size_t ilen = strlen(input);
+    for (int i = 0; i < run->tmpl_argc; i++) {
+        const char *t = run->tmpl[i];
+        if (!strstr(t, "{}")) {
+            argv[i] = (char *)t;
+            continue;
+        }
+        size_t n = 0;
+        for (const char *p = t; (p = strstr(p, "{}")); p += 2) n++;
+        char *s = malloc(strlen(t) + n * ilen + 1);
+        if (!s) break;
+        char *o = s;
+        for (const char *p = t; *p;) {
+            if (p[0] == '{' && p[1] == '}') {
+                memcpy(o, input, ilen);
+                o += ilen;
+                p += 2;
+            } else {
+                *o++ = *p++;
+            }
+        }
+        *o = '\0';
+        argv[i] = owned[i] = s;
+    }
+    if (!run->has_placeholder) argv[run->tmpl_argc] = (char *)input;
+    return argv;
+}
+
+static void free_job_argv(const Run *run, char **argv) {
+    int argc = run->tmpl_argc + !run->has_placeholder;
+    for (int i = 0; i < argc; i++) free(argv[argc + 1 + i]);
+    free(argv);
+}
+
+static void run_job(Run *run, Job *job, char *chunk, size_t chunk_size) {
+    job->status = 127;
+    char **argv = job_argv(run, job->input);
+    int out[2] = {-1, -1}, err[2] = {-1, -1};
+    if (!argv || pipe2(out, O_CLOEXEC) == -1 || pipe2(err, O_CLOEXEC) == -1) {
+        const char *msg = "minibash: parallel: cannot start job\n";
+        capture_append(&job->err, msg, strlen(msg));
+        goto done;
+    }
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&fa, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, err[1], STDERR_FILENO);
+    // This thread blocks every signal, which a job must not inherit
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t none, dfl;
+    sigemptyset(&none);
+    sigemptyset(&dfl);
+    sigaddset(&dfl, SIGINT);
+    sigaddset(&dfl, SIGQUIT);
+    sigaddset(&dfl, SIGTSTP);
+    sigaddset(&dfl, SIGPIPE);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &dfl);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    pid_t pid;
+    int rc = posix_spawnp(&pid, argv[0], &fa, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    close(out[1]);
+    close(err[1]);
+    out[1] = err[1] = -1;
+    if (rc != 0) {
+        char msg[512];
+        int n = snprintf(msg, sizeof(msg), "minibash: parallel: %s: %s\n", argv[0], strerror(rc));
+        capture_append(&job->err, msg, n < (int)sizeof(msg) ? (size_t)n : sizeof(msg) - 1);
+        goto done;
+    }
+
+    struct pollfd pfds[2] = {{.fd = out[0], .events = POLLIN}, {.fd = err[0], .events = POLLIN}};
+    Capture *caps[2] = {&job->out, &job->err};
+    int open_fds = 2;
+    while (open_fds > 0) {
+        if (poll(pfds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (pfds[i].fd < 0 || !pfds[i].revents) continue;
+            ssize_t n = read(pfds[i].fd, chunk, chunk_size);
+            if (n > 0) {
+                capture_append(caps[i], chunk, (size_t)n);
+            } else if (n == 0 || errno != EINTR) {
+                pfds[i].fd = -1;
+                open_fds--;
+            }
+        }
+    }
+    int wstatus;
+    while (waitpid(pid, &wstatus, 0) == -1 && errno == EINTR) {
+    }
+    if (WIFEXITED(wstatus)) job->status = WEXITSTATUS(wstatus);
+    else if (WIFSIGNALED(wstatus)) job->status = 128 + WTERMSIG(wstatus);
+
+done:
+    for (int i = 0; i < 2; i++) {
+        if (out[i] >= 0) close(out[i]);
+        if (err[i] >= 0) close(err[i]);
+    }
+    if (argv) free_job_argv(run, argv);
+    pthread_mutex_lock(&run->done_lock);
+    job->done = 1;
+    pthread_cond_broadcast(&run->done_cond);
+    pthread_mutex_unlock(&run->done_lock);
+}
+
+static void *worker_main(void *arg) {
+    Worker *w = arg;
+    Run *run = w->run;
+    size_t chunk_size = 65536;
+    char *chunk = malloc(chunk_size);
+    if (!chunk) {
+        // Fail this worker's own queue rather than leave its jobs unfinished
+        const char *msg = "minibash: parallel: cannot start job\n";
+        for (int idx; (idx = deque_pop(&run->deques[w->self])) >= 0;) {
+            Job *job = &run->jobs[idx];
+            job->status = 127;
+            capture_append(&job->err, msg, strlen(msg));
+            pthread_mutex_lock(&run->done_lock);
+            job->done = 1;
+            pthread_cond_broadcast(&run->done_cond);
+            pthread_mutex_unlock(&run->done_lock);
+        }
+        return NULL;
+    }
+    while (1) {
+        int idx = deque_pop(&run->deques[w->self]);
+        for (int k = 1; idx < 0 && k < run->nworkers; k++) {
+            idx = deque_steal(&run->deques[(w->self + k) % run->nworkers]);
+            if (idx >= 0) atomic_fetch_add(&run->steals, 1);
+        }
+        // Jobs are only queued up front, so empty everywhere means done
+        if (idx < 0) break;
+        run_job(run, &run->jobs[idx], chunk, chunk_size);
+    }
+    free(chunk);
+    return NULL;
+}
+
+// Read all of fd into a NUL-terminated buffer
+static char *read_all(int fd, size_t *len) {
+    size_t cap = 65536, n = 0;
+    char *buf = malloc(cap);
+    while (buf) {
+        if (cap - n < 65536) {
+            char *tmp = realloc(buf, cap * 2);
+            if (!tmp) break;
+            buf = tmp;
+            cap *= 2;
+        }
+        ssize_t r = read(fd, buf + n, cap - n - 1);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            buf[n] = '\0';
+            *len = n;
+            return buf;
+        }
+        n += (size_t)r;
+    }
+    free(buf);
+    return NULL;
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int usage(void) {
+    fprintf(stderr, "minibash: parallel: usage: parallel [-j jobs] [-0] command [args...] [::: inputs...]\n");
+    return 1;
+}
+
+int builtin_parallel(int argc, char **argv) {
+    long nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    char delim = '\n';
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(argv[i], "-0") == 0) {
+            delim = '\0';
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            const char *n = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : NULL);
+            nworkers = n ? strtol(n, NULL, 10) : 0;
+            if (nworkers <= 0) return usage();
+        } else {
+            return usage();
+        }
+    }
+
+    Run run = {0};
+    run.tmpl = argv + i;
+    for (; i < argc && strcmp(argv[i], ":::") != 0; i++) run.tmpl_argc++;
+    if (run.tmpl_argc == 0) return usage();
+    for (int k = 0; k < run.tmpl_argc; k++) {
+        if (strstr(run.tmpl[k], "{}")) run.has_placeholder = 1;
+    }
+
+    // Inputs: the ::: list, else records read from stdin
+    char *input = NULL;
+    const char **inputs;
+    int ninputs = 0;
+    if (i < argc) {
+        inputs = (const char **)argv + i + 1;
+        ninputs = argc - i - 1;
+    } else {
+        size_t len;
+        input = read_all(STDIN_FILENO, &len);
+        if (!input) {
+            perror("minibash: parallel");
+            return 1;
+        }
+        int cap = 0;
+        for (size_t k = 0; k < len; k++) cap += input[k] == delim;
+        inputs = malloc(((size_t)cap + 1) * sizeof(char *));
+        if (!inputs) {
+            free(input);
+            return 1;
+        }
+        char *p = input, *end = input + len;
+        while (p < end) {
+            char *e = memchr(p, delim, (size_t)(end - p));
+            if (!e) e = end;
+            *e = '\0';
+            if (e > p) inputs[ninputs++] = p;
+            p = e + 1;
+        }
+    }
+
+    fflush(stdout);
+    double start = now_ms();
+    run.njobs = ninputs;
+    run.jobs = calloc((size_t)(ninputs ? ninputs : 1), sizeof(Job));
+    if (nworkers > ninputs) nworkers = ninputs ? ninputs : 1;
+    run.nworkers = (int)nworkers;
+    run.deques = calloc((size_t)run.nworkers, sizeof(Deque));
+    Worker *workers = calloc((size_t)run.nworkers, sizeof(Worker));
+    pthread_t *tids = calloc((size_t)run.nworkers, sizeof(pthread_t));
+    int failed = 0;
+    if (!run.jobs || !run.deques || !workers || !tids) {
+        perror("minibash: parallel");
+        failed = 1;
+        goto out;
+    }
+
+    // Round-robin, so each worker's queue is in input order
+    int per = (ninputs + run.nworkers - 1) / run.nworkers;
+    for (int w = 0; w < run.nworkers; w++) {
+        run.deques[w].items = malloc((size_t)(per ? per : 1) * sizeof(int));
+        if (!run.deques[w].items) {
+            perror("minibash: parallel");
+            failed = 1;
+            for (int k = 0; k < w; k++) free(run.deques[k].items);
+            goto out;
+        }
+    }
+    for (int w = 0; w < run.nworkers; w++) pthread_mutex_init(&run.deques[w].lock, NULL);
+    for (int j = 0; j < ninputs; j++) {
+        run.jobs[j].input = inputs[j];
+        run.jobs[j].out.memfd = run.jobs[j].err.memfd = -1;
+        Deque *d = &run.deques[j % run.nworkers];
+        d->items[d->tail++] = j;
+    }
+    pthread_mutex_init(&run.done_lock, NULL);
+    pthread_cond_init(&run.done_cond, NULL);
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int started = 0;
+    for (int w = 0; w < run.nworkers; w++) {
+        workers[w].run = &run;
+        workers[w].self = w;
+        if (pthread_create(&tids[started], NULL, worker_main, &workers[w]) == 0) started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (started == 0 && ninputs > 0) {
+        // No threads: run everything here, each queue in turn
+        for (int w = 0; w < run.nworkers; w++) worker_main(&workers[w]);
+    }
+
+    // Emit in input order as jobs finish
+    for (int j = 0; j < ninputs; j++) {
+        Job *job = &run.jobs[j];
+        pthread_mutex_lock(&run.done_lock);
+        while (!job->done) pthread_cond_wait(&run.done_cond, &run.done_lock);
+        pthread_mutex_unlock(&run.done_lock);
+        capture_emit(&job->out, STDOUT_FILENO);
+        capture_emit(&job->err, STDERR_FILENO);
+        if (job->status != 0) failed++;
+    }
+    for (int w = 0; w < started; w++) pthread_join(tids[w], NULL);
+
+    if (failed > 0) {
+        fprintf(stderr, "minibash: parallel: %d of %d jobs failed\n", failed, ninputs);
+        int shown = 0;
+        for (int j = 0; j < ninputs && shown < FAILURES_SHOWN; j++) {
+            if (run.jobs[j].status == 0) continue;
+            fprintf(stderr, "  job %d (%s): exit %d\n", j + 1, run.jobs[j].input, run.jobs[j].status);
+            shown++;
+        }
+        if (failed > shown) fprintf(stderr, "  ...\n");
+    }
+
+    double elapsed = now_ms() - start;
+    stats_add("parallel.runs", 1);
+    stats_add("parallel.jobs", (uint64_t)ninputs);
+    stats_add("parallel.failed", (uint64_t)failed);
+    stats_add("parallel.steals", (uint64_t)atomic_load(&run.steals));
+    stats_set("parallel.last_ms", (uint64_t)elapsed);
+    stats_set("parallel.last_jobs_per_sec", elapsed > 0 ? (uint64_t)(ninputs * 1000.0 / elapsed) : 0);
+
+    for (int w = 0; w < run.nworkers; w++) {
+        pthread_mutex_destroy(&run.deques[w].lock);
+        free(run.deques[w].items);
+    }
+    pthread_mutex_destroy(&run.done_lock);
+    pthread_cond_destroy(&run.done_cond);
+out:
+    free(tids);
+    free(workers);
+    free(run.deques);
+    free(run.jobs);
+    if (input) {
+        free(inputs);
+        free(input);
+    }
+    return failed > MAX_STATUS ? MAX_STATUS : failed;
+}
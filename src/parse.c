@@ -1,10 +1,195 @@
 #include "parse.h"
 
+#include <ctype.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#define REDIR_FD_MAX 255
+
+static const char *location_file = NULL;
+static int location_line = 0;
+
+void parse_set_location(const char *file, int line) {
+    location_file = file;
+    location_line = line;
+}
+
+void parse_get_location(const char **file, int *line) {
+    *file = location_file;
+    *line = location_line;
+}
+
+void parse_error_prefix(void) {
+    if (location_file) fprintf(stderr, "minibash: %s:%d: ", location_file, location_line);
+    else fputs("minibash: ", stderr);
+}
+
+static void parse_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void parse_error(const char *fmt, ...) {
+    parse_error_prefix();
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+// Recognizes a redirection operator at the start of token: [N]<, [N]>,
+// [N]>>, [N]<<, [N]<&, [N]>&, &> or &>>. Returns its length with redir
+// filled in (both set for the &> forms), or 0 for an ordinary word.
+static size_t redir_op(const char *token, Redir *redir, int *both) {
+    const char *p = token;
+    int fd = -1;
+    *both = 0;
+    if (p[0] == '&' && p[1] == '>') {
+        *both = 1;
+        p++;
+    } else if (isdigit((unsigned char)*p)) {
+        fd = 0;
+        while (isdigit((unsigned char)*p)) {
+            if (fd <= REDIR_FD_MAX) fd = fd * 10 + (*p - '0');
+            p++;
+        }
+    }
+
+    if (*p == '<') {
+        if (p[1] == '<') {
+            redir->type = REDIR_HEREDOC;
+            p += 2;
+        } else if (p[1] == '&') {
+            redir->type = REDIR_DUP;
+            p += 2;
+        } else {
+            redir->type = REDIR_IN;
+            p++;
+        }
+        redir->fd = fd >= 0 ? fd : 0;
+    } else if (*p == '>') {
+        if (p[1] == '>') {
+            redir->type = REDIR_APPEND;
+            p += 2;
+        } else if (p[1] == '&' && !*both) {
+            redir->type = REDIR_DUP;
+            p += 2;
+        } else {
+            redir->type = REDIR_OUT;
+            p++;
+        }
+        redir->fd = fd >= 0 ? fd : 1;
+    } else {
+        return 0;
+    }
+    redir->src_fd = -1;
+    redir->path = NULL;
+    return (size_t)(p - token);
+}
+
+static int add_redir(Command *cmd, Redir redir, char *target, int both) {
+    if (cmd->nredirs + both >= MAX_REDIRS) {
+        parse_error("too many redirections\n");
+        return -1;
+    }
+    if (redir.fd > REDIR_FD_MAX) {
+        parse_error("%d: bad file descriptor\n", redir.fd);
+        return -1;
+    }
+    if (redir.type == REDIR_DUP && strcmp(target, "-") == 0) {
+        redir.type = REDIR_CLOSE;
+    } else if (redir.type == REDIR_DUP) {
+        char *end;
+        long fd = strtol(target, &end, 10);
+        if (end == target || *end || fd < 0 || fd > REDIR_FD_MAX) {
+            parse_error("%s: ambiguous redirect\n", target);
+            return -1;
+        }
+        redir.src_fd = (int)fd;
+    } else {
+        redir.path = target;
+    }
+    cmd->redirs[cmd->nredirs++] = redir;
+    if (both) {
+        Redir err = {.type = REDIR_DUP, .fd = 2, .src_fd = 1, .path = NULL};
+        cmd->redirs[cmd->nredirs++] = err;
+    }
+    return 0;
+}
+
+// $((...)) and ((...)) may hold spaces. strtok split them, so the words up
+// to the parens that close them are joined back together.
+static int join_arith(char *word, char **saveptr) {
+    char *p = strstr(word, "$((");
+    if (!p && strncmp(word, "((", 2) != 0) return 0;
+    if (!p) p = word;
+    int depth = 0;
+    while (1) {
+        for (; *p; p++) {
+            if (*p == '(') depth++;
+            else if (*p == ')') depth--;
+        }
+        if (depth <= 0) return 0;
+        char *next = strtok_r(NULL, " \n", saveptr);
+        if (!next) {
+            parse_error("unterminated arithmetic expression\n");
+            return -1;
+        }
+        *p = ' ';
+        p = next;
+    }
+}
+
+static int is_procsub(const char *word) {
+    return (word[0] == '<' || word[0] == '>') && word[1] == '(';
+}
+
+// Records the <(...) or >(...) starting at word, which is argument arg or
+// the target of redirection redir. strtok split it on spaces, so the words
+// up to the matching paren are joined back together.
+static int add_procsub(Command *cmd, char *word, char **saveptr, int arg, int redir) {
+    if (cmd->nsubs == MAX_PROCSUBS || arg >= MAX_ARGS - 1) {
+        parse_error("too many process substitutions\n");
+        return -1;
+    }
+    int depth = 0;
+    char *p = word + 1;
+    while (1) {
+        for (; *p; p++) {
+            if (*p == '(') {
+                depth++;
+            } else if (*p == ')' && --depth == 0) {
+                break;
+            }
+        }
+        if (*p == ')') break;
+        char *next = strtok_r(NULL, " \n", saveptr);
+        if (!next) {
+            parse_error("unterminated process substitution\n");
+            return -1;
+        }
+        *p = ' ';
+        p = next;
+    }
+    if (p[1] != '\0') {
+        parse_error("unexpected text after process substitution\n");
+        return -1;
+    }
+    *p = '\0';
+    ProcSub *sub = &cmd->subs[cmd->nsubs++];
+    sub->line = word + 2;
+    sub->output = word[0] == '>';
+    sub->arg = arg;
+    sub->redir = redir;
+    return 0;
+}
+
 int parse_line(char *line, Pipeline *pipeline) {
     init_pipeline(pipeline);
+    return parse_line_again(line, pipeline);
+}
+
+int parse_line_again(char *line, Pipeline *pipeline) {
+    reset_pipeline(pipeline);
 
     int current = 0;
     pipeline->count = 1;
@@ -12,13 +197,14 @@ int parse_line(char *line, Pipeline *pipeline) {
     char *saveptr = NULL;
     char *token = strtok_r(line, " \n", &saveptr);
     while (token) {
+        if (join_arith(token, &saveptr) != 0) return -1;
         if (strcmp(token, "|") == 0) {
             if (pipeline->cmds[current].argc == 0) {
-                fprintf(stderr, "pipeline missing command before pipe\n");
+                parse_error("pipeline missing command before pipe\n");
                 return -1;
             }
             if (pipeline->count >= MAX_CMDS) {
-                fprintf(stderr, "too many pipeline stages\n");
+                parse_error("too many pipeline stages\n");
                 return -1;
             }
             pipeline->cmds[current].output_type = OUTPUT_PIPE;
@@ -28,41 +214,33 @@ int parse_line(char *line, Pipeline *pipeline) {
             continue;
         }
 
-        if (strcmp(token, ">") == 0 || strcmp(token, ">>") == 0) {
-            int append = strcmp(token, ">>") == 0;
-            char *file = strtok_r(NULL, " \n", &saveptr);
-            if (!file) {
-                fprintf(stderr, "missing filename for redirection\n");
+        Redir redir;
+        int both;
+        size_t oplen = is_procsub(token) ? 0 : redir_op(token, &redir, &both);
+        if (oplen > 0) {
+            Command *cmd = &pipeline->cmds[current];
+            char *target = token[oplen] ? token + oplen : strtok_r(NULL, " \n", &saveptr);
+            if (!target) {
+                parse_error("missing target for redirection\n");
                 return -1;
             }
-            pipeline->cmds[current].output_type = append ? OUTPUT_REDIRECT_APPEND : OUTPUT_REDIRECT;
-            pipeline->cmds[current].redirect_path = file;
-            token = strtok_r(NULL, " \n", &saveptr);
-            continue;
-        }
-
-        if (strcmp(token, "<") == 0) {
-            char *file = strtok_r(NULL, " \n", &saveptr);
-            if (!file) {
-                fprintf(stderr, "missing filename for input redirection\n");
+            if (join_arith(target, &saveptr) != 0) return -1;
+            if (is_procsub(target) &&
+                add_procsub(cmd, target, &saveptr, -1, cmd->nredirs) != 0) {
                 return -1;
             }
-            pipeline->cmds[current].input_path = file;
-            token = strtok_r(NULL, " \n", &saveptr);
-            continue;
-        }
-
-        if (strcmp(token, "<<") == 0) {
-            char *delim = strtok_r(NULL, " \n", &saveptr);
-            if (!delim) {
-                fprintf(stderr, "missing delimiter for heredoc\n");
+            if (add_redir(cmd, redir, target, both) != 0) {
                 return -1;
             }
-            pipeline->cmds[current].heredoc_delim = delim;
             token = strtok_r(NULL, " \n", &saveptr);
             continue;
         }
 
+        if (is_procsub(token) &&
+            add_procsub(&pipeline->cmds[current], token, &saveptr,
+                        pipeline->cmds[current].argc, -1) != 0) {
+            return -1;
+        }
         if (pipeline->cmds[current].argc < MAX_ARGS - 1) {
             pipeline->cmds[current].args[pipeline->cmds[current].argc++] = token;
         }
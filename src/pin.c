@@ -0,0 +1,250 @@
+#define _GNU_SOURCE
+
+#include "pin.h"
+#include "stats.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PIN_MAX_DOMAINS 64
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+// CPUs this shell may run on, grouped by the last-level cache they share.
+// Each CPU's core is named by the lowest allowed CPU among its hyperthread
+// siblings. Read once; without sysfs it is one domain of single-CPU cores.
+static struct {
+    int loaded;
+    cpu_set_t allowed;
+    cpu_set_t domains[PIN_MAX_DOMAINS];
+    int ndomains;
+    short core[CPU_SETSIZE];
+} topo;
+
+// Successive auto pipelines, spread over domains and then cores
+static unsigned placed;
+
+// Parse a list like "0-3,8,10-11" into set. Returns -1 if it is not one.
+static int parse_cpulist(const char *s, cpu_set_t *set) {
+    CPU_ZERO(set);
+    while (*s && *s != '\n') {
+        char *end;
+        if (!isdigit((unsigned char)*s)) return -1;
+        long lo = strtol(s, &end, 10);
+        long hi = lo;
+        if (*end == '-') {
+            if (!isdigit((unsigned char)end[1])) return -1;
+            hi = strtol(end + 1, &end, 10);
+        }
+        if (hi < lo || hi >= CPU_SETSIZE) return -1;
+        for (long c = lo; c <= hi; c++) CPU_SET(c, set);
+        s = end;
+        if (*s == ',') s++;
+        else if (*s && *s != '\n') return -1;
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+static int read_file(const char *path, char *buf, size_t size) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    size_t n = fread(buf, 1, size - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    return 0;
+}
+
+static int read_cpulist(const char *path, cpu_set_t *set) {
+    char buf[4096];
+    if (read_file(path, buf, sizeof(buf)) != 0) return -1;
+    return parse_cpulist(buf, set);
+}
+
+// CPUs sharing the highest-level data or unified cache of cpu
+static int read_llc(int cpu, cpu_set_t *set) {
+    int best = 0;
+    for (int i = 0;; i++) {
+        char path[128], buf[64];
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/level", cpu, i);
+        if (read_file(path, buf, sizeof(buf)) != 0) break;
+        int level = atoi(buf);
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/type", cpu, i);
+        if (read_file(path, buf, sizeof(buf)) != 0 || strncmp(buf, "Instruction", 11) == 0) {
+            continue;
+        }
+        cpu_set_t shared;
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/shared_cpu_list", cpu, i);
+        if (level > best && read_cpulist(path, &shared) == 0) {
+            *set = shared;
+            best = level;
+        }
+    }
+    return best > 0 ? 0 : -1;
+}
+
+static void load_topology(void) {
+    topo.loaded = 1;
+    if (sched_getaffinity(0, sizeof(topo.allowed), &topo.allowed) != 0) {
+        CPU_ZERO(&topo.allowed);
+        CPU_SET(0, &topo.allowed);
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &topo.allowed)) continue;
+        char path[128];
+        cpu_set_t set;
+
+        topo.core[cpu] = cpu;
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/thread_siblings_list", cpu);
+        if (read_cpulist(path, &set) == 0) {
+            CPU_AND(&set, &set, &topo.allowed);
+            for (int c = 0; c < cpu; c++) {
+                if (CPU_ISSET(c, &set)) {
+                    topo.core[cpu] = topo.core[c];
+                    break;
+                }
+            }
+        }
+
+        if (read_llc(cpu, &set) != 0) set = topo.allowed;
+        CPU_AND(&set, &set, &topo.allowed);
+        CPU_SET(cpu, &set);
+        int d = 0;
+        while (d < topo.ndomains && !CPU_ISSET(cpu, &topo.domains[d])) d++;
+        if (d == topo.ndomains) {
+            if (topo.ndomains == PIN_MAX_DOMAINS) d--;
+            else topo.domains[topo.ndomains++] = set;
+        }
+        CPU_OR(&topo.domains[d], &topo.domains[d], &set);
+    }
+}
+
+// Adjacent stages share a cache: one core each if the domain has enough,
+// else the whole domain for all of them
+static void place_auto(PinPlan *plan, int count) {
+    if (!topo.loaded) load_topology();
+    const cpu_set_t *domain = &topo.domains[placed % topo.ndomains];
+
+    short cores[CPU_SETSIZE];
+    int ncores = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, domain) && topo.core[cpu] == cpu) cores[ncores++] = cpu;
+    }
+
+    int start = (placed / topo.ndomains) * count;
+    placed++;
+    for (int s = 0; s < count; s++) {
+        if (ncores < count) {
+            plan->cpus[s] = *domain;
+            continue;
+        }
+        int core = cores[(start + s) % ncores];
+        CPU_ZERO(&plan->cpus[s]);
+        for (int cpu = core; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, domain) && topo.core[cpu] == core) CPU_SET(cpu, &plan->cpus[s]);
+        }
+    }
+}
+
+// One list per stage separated by ':', the last repeated for the rest
+static int place_lists(PinPlan *plan, int count, char *lists) {
+    int s = 0;
+    for (char *list = strtok(lists, ":"); list; list = strtok(NULL, ":")) {
+        cpu_set_t set;
+        if (parse_cpulist(list, &set) != 0) {
+            fprintf(stderr, "minibash: pin: invalid cpu list '%s'\n", list);
+            return -1;
+        }
+        if (s < count) plan->cpus[s] = set;
+        s++;
+    }
+    if (s == 0) {
+        fprintf(stderr, "minibash: pin: invalid cpu list ''\n");
+        return -1;
+    }
+    if (s > count) {
+        fprintf(stderr, "minibash: pin: more cpu lists than pipeline stages\n");
+        return -1;
+    }
+    for (; s < count; s++) plan->cpus[s] = plan->cpus[s - 1];
+    return 0;
+}
+
+static int usage(void) {
+    fprintf(stderr, "minibash: pin: usage: pin [-n nice] [-b] [auto | cpulist[:cpulist...]] command\n");
+    return -1;
+}
+
+int pin_take(Pipeline *pipeline, PinPlan *plan) {
+    plan->active = 0;
+    Command *cmd = &pipeline->cmds[0];
+    if (!cmd->name || strcmp(cmd->name, "pin") != 0) return 0;
+
+    plan->nice = 0;
+    plan->batch = 0;
+    int skip = 1;
+    while (skip < cmd->argc) {
+        if (strcmp(cmd->args[skip], "-b") == 0) {
+            plan->batch = 1;
+            skip++;
+        } else if (strcmp(cmd->args[skip], "-n") == 0) {
+            if (skip + 1 >= cmd->argc) return usage();
+            char *end;
+            long n = strtol(cmd->args[skip + 1], &end, 10);
+            if (*cmd->args[skip + 1] == '\0' || *end || n < -20 || n > 19) {
+                fprintf(stderr, "minibash: pin: invalid nice value '%s'\n", cmd->args[skip + 1]);
+                return -1;
+            }
+            plan->nice = (int)n;
+            skip += 2;
+        } else {
+            break;
+        }
+    }
+
+    char *lists = NULL;
+    if (skip < cmd->argc && strcmp(cmd->args[skip], "auto") == 0) {
+        skip++;
+    } else if (skip < cmd->argc && isdigit((unsigned char)cmd->args[skip][0])) {
+        lists = cmd->args[skip++];
+    }
+    if (skip >= cmd->argc) return usage();
+
+    if (lists) {
+        if (place_lists(plan, pipeline->count, lists) != 0) return -1;
+    } else {
+        place_auto(plan, pipeline->count);
+    }
+    plan->active = 1;
+    stats_add("pin.pipelines", 1);
+
+    memmove(cmd->args, cmd->args + skip, (cmd->argc - skip + 1) * sizeof(char *));
+    cmd->argc -= skip;
+    for (int i = 0; i < cmd->nsubs; i++) {
+        if (cmd->subs[i].arg >= 0) cmd->subs[i].arg -= skip;
+    }
+    cmd->name = cmd->args[0];
+    return 0;
+}
+
+void pin_apply(const PinPlan *plan, int stage) {
+    if (!plan->active) return;
+    if (sched_setaffinity(0, sizeof(plan->cpus[stage]), &plan->cpus[stage]) != 0) {
+        fprintf(stderr, "minibash: pin: sched_setaffinity: %s\n", strerror(errno));
+    }
+    if (plan->batch) {
+        struct sched_param param = {0};
+        if (sched_setscheduler(0, SCHED_BATCH, &param) != 0) {
+            fprintf(stderr, "minibash: pin: sched_setscheduler: %s\n", strerror(errno));
+        }
+    }
+    if (plan->nice) {
+        errno = 0;
+        if (nice(plan->nice) == -1 && errno) {
+            fprintf(stderr, "minibash: pin: nice: %s\n", strerror(errno));
+        }
+    }
+}
@@ -0,0 +1,413 @@
+#define _GNU_SOURCE
+
+#include "prompt.h"
+#include "builtins.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROMPT_MAX 1024
+#define GIT_BUDGET_MS 4
+
+#define DEFAULT_PS1 "%F{45}%n%f %F{81}[%W]%f%{ %F{214}(git:%g)%f%} %?[%s]%f $ "
+
+extern char **environ;
+
+typedef enum {
+    OP_TEXT,
+    OP_NAME,
+    OP_CWD,
+    OP_CWD_BASE,
+    OP_GIT,
+    OP_STATUS,
+    OP_STATUS_COLOR,
+    OP_GROUP,       // arg: index of the matching OP_GROUP_END
+    OP_GROUP_END
+} OpType;
+
+typedef struct Op {
+    OpType type;
+    int arg;
+    char *text;
+} Op;
+
+typedef struct Template {
+    char *source;
+    Op *ops;
+    int count;
+    int uses_git;
+} Template;
+
+// Git branch of one directory, filled in by the worker
+typedef struct GitCache {
+    char dir[PATH_MAX];
+    char branch[128];
+    int known;      // branch (possibly empty: not a repo) is valid for dir
+} GitCache;
+
+static Template tmpl = {0};
+static char rendered[PROMPT_MAX];
+static int rendered_status = 0;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    int started;
+    int efd;
+    char want[PATH_MAX];    // directory to resolve, empty if idle
+    GitCache cache;
+} git = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .efd = -1,
+};
+
+static void template_free(Template *t) {
+    for (int i = 0; i < t->count; i++) {
+        free(t->ops[i].text);
+    }
+    free(t->ops);
+    free(t->source);
+    memset(t, 0, sizeof(*t));
+}
+
+static int emit(Template *t, int *cap, OpType type, int arg, const char *text, size_t len) {
+    if (t->count == *cap) {
+        *cap = *cap ? *cap * 2 : 16;
+        Op *tmp = realloc(t->ops, (size_t)*cap * sizeof(Op));
+        if (!tmp) return -1;
+        t->ops = tmp;
+    }
+    Op *op = &t->ops[t->count];
+    op->type = type;
+    op->arg = arg;
+    op->text = NULL;
+    if (text) {
+        op->text = strndup(text, len);
+        if (!op->text) return -1;
+    }
+    if (type == OP_GIT) t->uses_git = 1;
+    t->count++;
+    return 0;
+}
+
+static int compile(Template *t, const char *src) {
+    memset(t, 0, sizeof(*t));
+    t->source = strdup(src);
+    if (!t->source) return -1;
+
+    int cap = 0;
+    int groups[8];
+    int depth = 0;
+    char color[32];
+    const char *p = src;
+    while (*p) {
+        const char *lit = p;
+        while (*p && *p != '%') p++;
+        if (p > lit && emit(t, &cap, OP_TEXT, 0, lit, (size_t)(p - lit)) != 0) goto fail;
+        if (!*p) break;
+
+        char d = p[1];
+        p += d ? 2 : 1;
+        int rc = 0;
+        switch (d) {
+        case 'n': rc = emit(t, &cap, OP_NAME, 0, NULL, 0); break;
+        case 'w': rc = emit(t, &cap, OP_CWD, 0, NULL, 0); break;
+        case 'W': rc = emit(t, &cap, OP_CWD_BASE, 0, NULL, 0); break;
+        case 'g': rc = emit(t, &cap, OP_GIT, 0, NULL, 0); break;
+        case 's': rc = emit(t, &cap, OP_STATUS, 0, NULL, 0); break;
+        case '?': rc = emit(t, &cap, OP_STATUS_COLOR, 0, NULL, 0); break;
+        case 'f': rc = emit(t, &cap, OP_TEXT, 0, "\033[0m", 4); break;
+        case '%': rc = emit(t, &cap, OP_TEXT, 0, "%", 1); break;
+        case 'F':
+            if (*p == '{') {
+                const char *end = strchr(p, '}');
+                if (end) {
+                    int n = snprintf(color, sizeof(color), "\033[38;5;%dm", atoi(p + 1));
+                    rc = emit(t, &cap, OP_TEXT, 0, color, (size_t)n);
+                    p = end + 1;
+                }
+            }
+            break;
+        case '{':
+            if (depth < (int)(sizeof(groups) / sizeof(groups[0]))) {
+                groups[depth++] = t->count;
+                rc = emit(t, &cap, OP_GROUP, 0, NULL, 0);
+            }
+            break;
+        case '}':
+            if (depth > 0) {
+                t->ops[groups[--depth]].arg = t->count;
+                rc = emit(t, &cap, OP_GROUP_END, 0, NULL, 0);
+            }
+            break;
+        default:
+            // Unknown directive: keep it verbatim
+            rc = emit(t, &cap, OP_TEXT, 0, p - 2, d ? 2 : 1);
+            break;
+        }
+        if (rc != 0) goto fail;
+    }
+    // Close groups left open by the template
+    while (depth > 0) {
+        t->ops[groups[--depth]].arg = t->count;
+        if (emit(t, &cap, OP_GROUP_END, 0, NULL, 0) != 0) goto fail;
+    }
+    return 0;
+
+fail:
+    template_free(t);
+    return -1;
+}
+
+static const Template *current_template(void) {
+    const char *src = get_var("PS1");
+    if (!src || !*src) src = DEFAULT_PS1;
+    if (!tmpl.source || strcmp(tmpl.source, src) != 0) {
+        template_free(&tmpl);
+        if (compile(&tmpl, src) != 0) compile(&tmpl, DEFAULT_PS1);
+    }
+    return &tmpl;
+}
+
+// Runs argv with stdout captured; stores the first line in out
+static int run_capture(char *const argv[], char *out, size_t out_size) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) return -1;
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&fa, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    // The worker blocks every signal; git must stay interruptible
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t none, dfl;
+    sigemptyset(&none);
+    sigemptyset(&dfl);
+    sigaddset(&dfl, SIGINT);
+    sigaddset(&dfl, SIGQUIT);
+    sigaddset(&dfl, SIGTSTP);
+    sigaddset(&dfl, SIGPIPE);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &dfl);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    pid_t pid;
+    int err = posix_spawnp(&pid, argv[0], &fa, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    close(fds[1]);
+    if (err != 0) {
+        close(fds[0]);
+        return -1;
+    }
+
+    size_t len = 0;
+    ssize_t n;
+    while (len + 1 < out_size && (n = read(fds[0], out + len, out_size - 1 - len)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        len += (size_t)n;
+    }
+    out[len] = '\0';
+    close(fds[0]);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+    out[strcspn(out, "\n")] = '\0';
+    return 0;
+}
+
+static void git_branch(const char *dir, char *branch, size_t size) {
+    char probe[8];
+    branch[0] = '\0';
+    char *inside[] = {"git", "-C", (char *)dir, "rev-parse", "--is-inside-work-tree", NULL};
+    if (run_capture(inside, probe, sizeof(probe)) != 0 || strcmp(probe, "true") != 0) {
+        return;
+    }
+    char *symbolic[] = {"git", "-C", (char *)dir, "symbolic-ref", "--short", "HEAD", NULL};
+    if (run_capture(symbolic, branch, size) == 0) return;
+    char *detached[] = {"git", "-C", (char *)dir, "rev-parse", "--short", "HEAD", NULL};
+    if (run_capture(detached, branch, size) != 0) branch[0] = '\0';
+}
+
+static void *git_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&git.lock);
+    while (1) {
+        while (!git.want[0]) pthread_cond_wait(&git.wake, &git.lock);
+        char dir[PATH_MAX];
+        memcpy(dir, git.want, sizeof(dir));
+        git.want[0] = '\0';
+        pthread_mutex_unlock(&git.lock);
+
+        char branch[sizeof(git.cache.branch)];
+        git_branch(dir, branch, sizeof(branch));
+
+        pthread_mutex_lock(&git.lock);
+        int changed = !git.cache.known || strcmp(git.cache.dir, dir) != 0 ||
+                      strcmp(git.cache.branch, branch) != 0;
+        memcpy(git.cache.dir, dir, sizeof(dir));
+        memcpy(git.cache.branch, branch, sizeof(branch));
+        git.cache.known = 1;
+        pthread_cond_broadcast(&git.done);
+        if (changed) {
+            uint64_t one = 1;
+            ssize_t w = write(git.efd, &one, sizeof(one));
+            (void)w;
+        }
+    }
+    return NULL;
+}
+
+int prompt_init(void) {
+    if (git.started) return 0;
+    git.efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (git.efd == -1) return -1;
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t tid;
+    int err = pthread_create(&tid, NULL, git_worker, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+        close(git.efd);
+        git.efd = -1;
+        return -1;
+    }
+    pthread_detach(tid);
+    git.started = 1;
+    return 0;
+}
+
+void prompt_cleanup(void) {
+    template_free(&tmpl);
+}
+
+int prompt_notify_fd(void) {
+    return git.efd;
+}
+
+// Branch for dir: cached value when the cache already covers dir (a refresh
+// still runs behind it), otherwise wait up to the segment budget for the
+// worker. Returns 1 if *branch is meaningful.
+static int git_segment(const char *dir, int wait, char *branch, size_t size) {
+    if (!git.started) return 0;
+
+    pthread_mutex_lock(&git.lock);
+    int hit = git.cache.known && strcmp(git.cache.dir, dir) == 0;
+    if (wait) {
+        snprintf(git.want, sizeof(git.want), "%s", dir);
+        pthread_cond_signal(&git.wake);
+    }
+    if (!hit && wait) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += GIT_BUDGET_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!(git.cache.known && strcmp(git.cache.dir, dir) == 0)) {
+            if (pthread_cond_timedwait(&git.done, &git.lock, &deadline) != 0) break;
+        }
+        hit = git.cache.known && strcmp(git.cache.dir, dir) == 0;
+    }
+    if (hit) snprintf(branch, size, "%s", git.cache.branch);
+    pthread_mutex_unlock(&git.lock);
+    return hit;
+}
+
+// Append s to the output, clipped to the buffer
+static void put(char *out, size_t *len, const char *s) {
+    size_t n = strlen(s);
+    if (*len + n >= PROMPT_MAX) n = PROMPT_MAX - 1 - *len;
+    memcpy(out + *len, s, n);
+    *len += n;
+    out[*len] = '\0';
+}
+
+static const char *render(int last_status, int request_git) {
+    const Template *t = current_template();
+
+    char cwd[PATH_MAX] = {0};
+    const char *folder = "?";
+    if (getcwd(cwd, sizeof(cwd))) {
+        const char *last_slash = strrchr(cwd, '/');
+        if (last_slash && *(last_slash + 1) != '\0') {
+            folder = last_slash + 1;
+        } else {
+            folder = cwd;
+        }
+    }
+
+    char branch[128] = "";
+    if (t->uses_git && cwd[0]) git_segment(cwd, request_git, branch, sizeof(branch));
+
+    // Drop notifications covered by this render
+    uint64_t n;
+    if (git.efd != -1) while (read(git.efd, &n, sizeof(n)) > 0) {}
+
+    char num[16];
+    size_t len = 0;
+    rendered[0] = '\0';
+    for (int i = 0; i < t->count; i++) {
+        const Op *op = &t->ops[i];
+        switch (op->type) {
+        case OP_TEXT: put(rendered, &len, op->text); break;
+        case OP_NAME: put(rendered, &len, "minibash"); break;
+        case OP_CWD: put(rendered, &len, cwd[0] ? cwd : "?"); break;
+        case OP_CWD_BASE: put(rendered, &len, folder); break;
+        case OP_GIT: put(rendered, &len, branch); break;
+        case OP_STATUS:
+            snprintf(num, sizeof(num), "%d", last_status);
+            put(rendered, &len, num);
+            break;
+        case OP_STATUS_COLOR:
+            put(rendered, &len, last_status == 0 ? "\033[38;5;41m" : "\033[38;5;197m");
+            break;
+        case OP_GROUP: {
+            // Skip the group if any segment inside has no value
+            int empty = 0;
+            for (int j = i + 1; j < op->arg; j++) {
+                if (t->ops[j].type == OP_GIT && !branch[0]) empty = 1;
+                if (t->ops[j].type == OP_CWD && !cwd[0]) empty = 1;
+            }
+            if (empty) i = op->arg;
+            break;
+        }
+        case OP_GROUP_END:
+            break;
+        }
+    }
+    return rendered;
+}
+
+const char *prompt_render(int last_status) {
+    rendered_status = last_status;
+    return render(last_status, 1);
+}
+
+const char *prompt_refresh(void) {
+    return render(rendered_status, 0);
+}
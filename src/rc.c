@@ -0,0 +1,366 @@
+#include "rc.h"
+#include "builtins.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNAP_MAGIC "MBSNAP\0"
+#define SNAP_VERSION 1
+
+#define SNAP_VAR 0
+#define SNAP_ALIAS 1
+#define SNAP_EXPORTED 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    int64_t rc_mtime_sec;
+    int64_t rc_mtime_nsec;
+    uint64_t rc_size;
+    uint64_t rc_hash;
+    uint64_t strings_off;
+    uint64_t strings_len;
+} SnapHeader;
+
+typedef struct {
+    uint32_t name_off;
+    uint32_t value_off;
+    uint32_t env_off;       // "NAME=value" for exported variables
+    uint32_t flags;
+} SnapEntry;
+
+extern char **environ;
+
+static uint64_t fnv1a(const char *data, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static int rc_path(char *buf, size_t size) {
+    const char *rc = getenv("MINIBASHRC");
+    if (rc) {
+        if (!*rc) return -1;
+        return snprintf(buf, size, "%s", rc) < (int)size ? 0 : -1;
+    }
+    const char *home = getenv("HOME");
+    if (!home || !*home) return -1;
+    return snprintf(buf, size, "%s/.minibashrc", home) < (int)size ? 0 : -1;
+}
+
+static int snap_path(const char *rc, char *buf, size_t size) {
+    const char *snap = getenv("MINIBASH_SNAPSHOT");
+    if (snap) {
+        if (!*snap || strcmp(snap, "0") == 0) return -1;
+        return snprintf(buf, size, "%s", snap) < (int)size ? 0 : -1;
+    }
+    return snprintf(buf, size, "%s.snap", rc) < (int)size ? 0 : -1;
+}
+
+static char *read_file(int fd, size_t size) {
+    char *data = malloc(size + 1);
+    if (!data) return NULL;
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = read(fd, data + got, size - got);
+        if (n <= 0) {
+            free(data);
+            return NULL;
+        }
+        got += (size_t)n;
+    }
+    data[size] = '\0';
+    return data;
+}
+
+static int header_matches(const SnapHeader *h, const struct stat *st, uint64_t hash) {
+    return memcmp(h->magic, SNAP_MAGIC, sizeof(h->magic)) == 0 &&
+           h->version == SNAP_VERSION &&
+           h->rc_mtime_sec == (int64_t)st->st_mtim.tv_sec &&
+           h->rc_mtime_nsec == (int64_t)st->st_mtim.tv_nsec &&
+           h->rc_size == (uint64_t)st->st_size &&
+           h->rc_hash == hash;
+}
+
+// Apply a snapshot if it is intact and describes this rc file. Returns 0 if
+// the tables were loaded from it.
+static int snap_apply(const char *path, const struct stat *rc_st, uint64_t hash) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(SnapHeader)) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    int ret = -1, keep = 0;
+    const SnapHeader *h = (const SnapHeader *)map;
+    size_t entries_size = (size_t)h->count * sizeof(SnapEntry);
+    if (!header_matches(h, rc_st, hash) ||
+        entries_size > size - sizeof(SnapHeader) ||
+        h->strings_off < sizeof(SnapHeader) + entries_size ||
+        h->strings_off > size || h->strings_len == 0 ||
+        h->strings_len > size - h->strings_off ||
+        map[h->strings_off + h->strings_len - 1] != '\0') {
+        goto out;
+    }
+
+    const SnapEntry *e = (const SnapEntry *)(map + sizeof(SnapHeader));
+    const char *strings = map + h->strings_off;
+    size_t nexport = 0;
+    for (uint32_t i = 0; i < h->count; i++) {
+        if (e[i].name_off >= h->strings_len || e[i].value_off >= h->strings_len ||
+            e[i].env_off >= h->strings_len) {
+            goto out;
+        }
+        if (e[i].flags & SNAP_EXPORTED) nexport++;
+    }
+
+    if (get_vars()->count > 0 || get_aliases()->count > 0) {
+        for (uint32_t i = 0; i < h->count; i++) {
+            const char *name = strings + e[i].name_off;
+            const char *value = strings + e[i].value_off;
+            if (e[i].flags & SNAP_ALIAS) {
+                set_alias(name, value);
+            } else if (e[i].flags & SNAP_EXPORTED) {
+                export_var(name, value);
+            } else {
+                set_var(name, value);
+            }
+        }
+        ret = 0;
+        goto out;
+    }
+
+    // The snapshot holds unique names, so into empty tables it can be
+    // appended without lookups
+    for (uint32_t i = 0; i < h->count; i++) {
+        const char *name = strings + e[i].name_off;
+        const char *value = strings + e[i].value_off;
+        if (e[i].flags & SNAP_ALIAS) {
+            append_alias(name, value);
+        } else {
+            append_var(name, value, e[i].flags & SNAP_EXPORTED);
+        }
+    }
+
+    // Exported variables go into one new environ whose new entries point
+    // into the mapping, instead of a setenv (scan, copy, realloc) per name
+    size_t envc = 0;
+    while (environ && environ[envc]) envc++;
+    char **env = nexport ? malloc((envc + nexport + 1) * sizeof(char *)) : NULL;
+    size_t n = envc;
+    if (env) memcpy(env, environ, envc * sizeof(char *));
+    for (uint32_t i = 0; i < h->count; i++) {
+        if (!(e[i].flags & SNAP_EXPORTED)) continue;
+        const char *name = strings + e[i].name_off;
+        if (!env || getenv(name)) {
+            setenv(name, strings + e[i].value_off, 1);
+        } else {
+            env[n++] = (char *)(strings + e[i].env_off);
+        }
+    }
+    if (n > envc) {
+        env[n] = NULL;
+        environ = env;
+        keep = 1;
+    } else {
+        free(env);
+    }
+    ret = 0;
+out:
+    // environ may now point into the mapping, so it then lives until exit
+    if (!keep) munmap((void *)map, size);
+    return ret;
+}
+
+typedef struct {
+    char *data;
+    size_t len, cap;
+} StrTab;
+
+static int strtab_add(StrTab *t, const char *s, uint32_t *off) {
+    size_t n = strlen(s) + 1;
+    if (t->len + n > UINT32_MAX) return -1;
+    if (t->len + n > t->cap) {
+        size_t cap = t->cap ? t->cap : 4096;
+        while (cap < t->len + n) cap *= 2;
+        char *tmp = realloc(t->data, cap);
+        if (!tmp) return -1;
+        t->data = tmp;
+        t->cap = cap;
+    }
+    memcpy(t->data + t->len, s, n);
+    *off = (uint32_t)t->len;
+    t->len += n;
+    return 0;
+}
+
+static int strtab_add_env(StrTab *t, const char *name, const char *value, uint32_t *off) {
+    size_t len = strlen(name) + strlen(value) + 2;
+    char *buf = malloc(len);
+    if (!buf) return -1;
+    snprintf(buf, len, "%s=%s", name, value);
+    int ret = strtab_add(t, buf, off);
+    free(buf);
+    return ret;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Write the current tables as a snapshot of the rc file. The file is built
+// under a temporary name and renamed so readers never see a partial image.
+static void snap_write(const char *path, const struct stat *rc_st, uint64_t hash) {
+    const EnvironmentVars *vars = get_vars();
+    const Aliases *aliases = get_aliases();
+    uint32_t count = (uint32_t)(vars->count + aliases->count);
+    SnapEntry *entries = calloc(count ? count : 1, sizeof(SnapEntry));
+    StrTab strings = {0};
+    if (!entries) return;
+
+    int ok = 1;
+    uint32_t n = 0;
+    for (int i = 0; ok && i < vars->count; i++, n++) {
+        entries[n].flags = SNAP_VAR | (vars->exported[i] ? SNAP_EXPORTED : 0);
+        ok = strtab_add(&strings, vars->names[i], &entries[n].name_off) == 0 &&
+             strtab_add(&strings, vars->values[i], &entries[n].value_off) == 0;
+        if (ok && vars->exported[i]) {
+            ok = strtab_add_env(&strings, vars->names[i], vars->values[i],
+                                &entries[n].env_off) == 0;
+        }
+    }
+    for (int i = 0; ok && i < aliases->count; i++, n++) {
+        entries[n].flags = SNAP_ALIAS;
+        ok = strtab_add(&strings, aliases->cmds[i], &entries[n].name_off) == 0 &&
+             strtab_add(&strings, aliases->aliases[i], &entries[n].value_off) == 0;
+    }
+    uint32_t empty;
+    if (ok && strings.len == 0) ok = strtab_add(&strings, "", &empty) == 0;
+
+    char tmp[PATH_MAX];
+    int fd = -1;
+    if (ok && snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid()) < (int)sizeof(tmp)) {
+        fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    }
+    if (fd != -1) {
+        SnapHeader h = {0};
+        memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+        h.version = SNAP_VERSION;
+        h.count = count;
+        h.rc_mtime_sec = (int64_t)rc_st->st_mtim.tv_sec;
+        h.rc_mtime_nsec = (int64_t)rc_st->st_mtim.tv_nsec;
+        h.rc_size = (uint64_t)rc_st->st_size;
+        h.rc_hash = hash;
+        h.strings_off = sizeof(h) + (uint64_t)count * sizeof(SnapEntry);
+        h.strings_len = strings.len;
+        int err = write_all(fd, &h, sizeof(h)) != 0 ||
+                  write_all(fd, entries, count * sizeof(SnapEntry)) != 0 ||
+                  write_all(fd, strings.data, strings.len) != 0;
+        if (close(fd) != 0) err = 1;
+        if (err || rename(tmp, path) != 0) unlink(tmp);
+    }
+    free(strings.data);
+    free(entries);
+}
+
+// A line can be replaced by the snapshot only if all it does is change the
+// variable and alias tables.
+static int line_is_snapshottable(const char *line) {
+    // Redirections write files; expansions depend on the environment
+    if (strpbrk(line, "|<>$")) return 0;
+    const char *p = line;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ';') p++;
+        if (!*p) break;
+        const char *word = p;
+        while (*p && *p != ' ' && *p != '\t' && *p != ';') p++;
+        size_t len = (size_t)(p - word);
+        while (*p == ' ' || *p == '\t') p++;
+        const char *arg = p;
+        while (*p && *p != ';') p++;
+        int has_arg = arg < p;
+        int has_eq = memchr(arg, '=', (size_t)(p - arg)) != NULL;
+
+        if (len == 6 && strncmp(word, "export", 6) == 0) {
+            if (!has_eq) return 0;
+        } else if ((len == 3 && strncmp(word, "set", 3) == 0) ||
+                   (len == 5 && strncmp(word, "alias", 5) == 0) ||
+                   (len == 5 && strncmp(word, "unset", 5) == 0) ||
+                   (len == 7 && strncmp(word, "unalias", 7) == 0)) {
+            // Without arguments these print the tables
+            if (!has_arg) return 0;
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int rc_load(RcRunLine run) {
+    char rc[PATH_MAX];
+    if (rc_path(rc, sizeof(rc)) != 0) return 0;
+    int fd = open(rc, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return 0;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    char *data = read_file(fd, (size_t)st.st_size);
+    close(fd);
+    if (!data) {
+        fprintf(stderr, "minibash: %s: read error\n", rc);
+        return -1;
+    }
+    uint64_t hash = fnv1a(data, (size_t)st.st_size);
+
+    char snap[PATH_MAX];
+    int use_snap = snap_path(rc, snap, sizeof(snap)) == 0;
+    if (use_snap && snap_apply(snap, &st, hash) == 0) {
+        free(data);
+        return 0;
+    }
+
+    int snapshottable = 1;
+    char *line = data;
+    while (line) {
+        char *nl = strchr(line, '\n');
+        if (nl) *nl = '\0';
+        while (*line == ' ' || *line == '\t') line++;
+        if (*line && *line != '#') {
+            if (!line_is_snapshottable(line)) snapshottable = 0;
+            run(line);
+        }
+        line = nl ? nl + 1 : NULL;
+    }
+    free(data);
+
+    if (use_snap && snapshottable) {
+        snap_write(snap, &st, hash);
+    }
+    return 0;
+}
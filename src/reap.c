@@ -0,0 +1,221 @@
+#include "reap.h"
+#include "zygote.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define REAP_MAX 64
+#define TIMER_TAG UINT32_MAX
+#define ZYGOTE_TAG (UINT32_MAX - 1)
+
+int reap_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int wait_status(int wstatus) {
+    if (WIFEXITED(wstatus)) return WEXITSTATUS(wstatus);
+    if (WIFSIGNALED(wstatus)) return 128 + WTERMSIG(wstatus);
+    return 0;
+}
+
+static void arm_timer(int tfd, long ms) {
+    struct itimerspec its = {0};
+    its.it_value.tv_sec = ms / 1000;
+    its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+    timerfd_settime(tfd, 0, &its, NULL);
+}
+
+// Kernels without pidfd: plain blocking waits, no deadline
+static int reap_blocking(const pid_t *pids, int n, int last, int *done) {
+    int status_code = 0;
+    for (int i = 0; i < n; i++) {
+        if (pids[i] <= 0 || done[i]) continue;
+        int wstatus = 0;
+        if (waitpid(pids[i], &wstatus, 0) == -1) {
+            perror("waitpid");
+            status_code = 127;
+            continue;
+        }
+        if (i == last) status_code = wait_status(wstatus);
+    }
+    return status_code;
+}
+
+// Stages spawned by the zygote: statuses arrive as messages from it. Reads
+// what is available (or, with block, waits for every stage). Returns the
+// number of stages that finished, or -1 if the zygote is gone.
+static int reap_zygote(const pid_t *pids, int n, int last, int *done,
+                       int *status_code, int block) {
+    int finished = 0, wstatus;
+    pid_t pid;
+    while ((pid = zygote_next_exit(&wstatus, block)) > 0) {
+        for (int i = 0; i < n; i++) {
+            if (pids[i] == pid && !done[i]) {
+                done[i] = 1;
+                finished++;
+                if (i == last) *status_code = wait_status(wstatus);
+                break;
+            }
+        }
+        if (block) {
+            int all = 1;
+            for (int i = 0; i < n; i++) {
+                if (pids[i] > 0 && !done[i]) all = 0;
+            }
+            if (all) break;
+        }
+    }
+    return pid < 0 ? -1 : finished;
+}
+
+static void report_running(const pid_t *pids, const char *const *names, int n,
+                           int stages, const int *done, const char *action) {
+    for (int i = 0; i < n; i++) {
+        if (pids[i] <= 0 || done[i]) continue;
+        const char *name = names[i] ? names[i] : "?";
+        if (i < stages) {
+            fprintf(stderr, "minibash: timeout: stage %d (%s) still running, sending %s\n",
+                    i + 1, name, action);
+        } else {
+            fprintf(stderr, "minibash: timeout: process substitution (%s) still running, sending %s\n",
+                    name, action);
+        }
+    }
+}
+
+int reap_pipeline(const pid_t *pids, const char *const *names, int n,
+                  const ReapLimits *limits) {
+    int done[REAP_MAX] = {0};
+    int last = -1, remaining = 0;
+    if (n > REAP_MAX) n = REAP_MAX;
+    int stages = n - (limits ? limits->helpers : 0);
+    for (int i = 0; i < n; i++) {
+        if (pids[i] > 0) {
+            if (i < stages) last = i;
+            remaining++;
+        }
+    }
+    if (remaining == 0) return 0;
+
+    int via_zygote = limits && limits->zygote;
+    int status_code = 0;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        if (!via_zygote) return reap_blocking(pids, n, last, done);
+        return reap_zygote(pids, n, last, done, &status_code, 1) < 0 ? 127 : status_code;
+    }
+
+    int pidfds[REAP_MAX];
+    for (int i = 0; i < n; i++) pidfds[i] = -1;
+    if (via_zygote) {
+        struct epoll_event ev = {.events = EPOLLIN, .data.u32 = ZYGOTE_TAG};
+        epoll_ctl(epfd, EPOLL_CTL_ADD, zygote_fd(), &ev);
+        // Some may have exited while later stages were being spawned
+        int r = reap_zygote(pids, n, last, done, &status_code, 0);
+        remaining = r < 0 ? 0 : remaining - r;
+    }
+    for (int i = 0; i < n && !via_zygote; i++) {
+        if (pids[i] <= 0) continue;
+        pidfds[i] = reap_pidfd(pids[i]);
+        struct epoll_event ev = {.events = EPOLLIN, .data.u32 = (uint32_t)i};
+        if (pidfds[i] == -1 || epoll_ctl(epfd, EPOLL_CTL_ADD, pidfds[i], &ev) == -1) {
+            for (int k = 0; k <= i; k++) {
+                if (pidfds[k] >= 0) close(pidfds[k]);
+            }
+            close(epfd);
+            return reap_blocking(pids, n, last, done);
+        }
+    }
+
+    int tfd = -1;
+    if (limits && limits->timeout_ms > 0 && limits->pgid > 0) {
+        tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        struct epoll_event ev = {.events = EPOLLIN, .data.u32 = TIMER_TAG};
+        if (tfd != -1 && epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) == 0) {
+            arm_timer(tfd, limits->timeout_ms);
+        } else if (tfd != -1) {
+            close(tfd);
+            tfd = -1;
+        }
+    }
+
+    int phase = 0;  // 0: running, 1: TERM sent, 2: KILL sent
+    struct epoll_event events[REAP_MAX + 1];
+    while (remaining > 0) {
+        int nev = epoll_wait(epfd, events, REAP_MAX + 1, -1);
+        if (nev == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int e = 0; e < nev; e++) {
+            uint32_t tag = events[e].data.u32;
+            if (tag == TIMER_TAG) {
+                uint64_t expirations;
+                ssize_t r = read(tfd, &expirations, sizeof(expirations));
+                (void)r;
+                if (phase == 0) {
+                    report_running(pids, names, n, stages, done, "TERM");
+                    kill(-limits->pgid, SIGTERM);
+                    kill(-limits->pgid, SIGCONT);
+                    if (limits->kill_ms > 0) arm_timer(tfd, limits->kill_ms);
+                    phase = 1;
+                } else if (phase == 1) {
+                    report_running(pids, names, n, stages, done, "KILL");
+                    kill(-limits->pgid, SIGKILL);
+                    phase = 2;
+                }
+                continue;
+            }
+            if (tag == ZYGOTE_TAG) {
+                int r = reap_zygote(pids, n, last, done, &status_code, 0);
+                if (r < 0) {
+                    fprintf(stderr, "minibash: zygote exited\n");
+                    status_code = 127;
+                    remaining = 0;
+                } else {
+                    remaining -= r;
+                }
+                continue;
+            }
+
+            int i = (int)tag;
+            int wstatus = 0;
+            pid_t r = waitpid(pids[i], &wstatus, WNOHANG);
+            if (r == 0) continue;
+            if (r == -1) {
+                perror("waitpid");
+                status_code = 127;
+            } else if (i == last) {
+                status_code = wait_status(wstatus);
+            }
+            done[i] = 1;
+            close(pidfds[i]);
+            pidfds[i] = -1;
+            remaining--;
+        }
+    }
+
+    if (remaining > 0 && !via_zygote) status_code = reap_blocking(pids, n, last, done);
+    for (int i = 0; i < n; i++) {
+        if (pidfds[i] >= 0) close(pidfds[i]);
+    }
+    if (tfd != -1) close(tfd);
+    close(epfd);
+    if (phase == 2) return REAP_KILLED;
+    return phase > 0 ? REAP_TIMED_OUT : status_code;
+}
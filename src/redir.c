@@ -0,0 +1,252 @@
+#define _GNU_SOURCE
+
+#include "redir.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Copies made while installing a plan go at or above this, out of the way
+// of descriptors a user would name
+#define REDIR_COPY_BASE 10
+
+int build_heredoc_fd(const char *delim) {
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t nread;
+    while (1) {
+        fprintf(stdout, "heredoc> ");
+        fflush(stdout);
+        nread = getline(&line, &len, stdin);
+        if (nread == -1) {
+            break;
+        }
+
+        if (nread > 0 && line[nread - 1] == '\n') {
+            line[nread - 1] = '\0';
+            if (strcmp(line, delim) == 0) {
+                break;
+            }
+            line[nread - 1] = '\n';
+        }
+
+        if (write(pipefd[1], line, nread) == -1) {
+            perror("write");
+            free(line);
+            close(pipefd[0]);
+            close(pipefd[1]);
+            return -1;
+        }
+    }
+
+    free(line);
+    close(pipefd[1]);
+    return pipefd[0];
+}
+
+void redir_plan_init(RedirPlan *plan, int in_fd, int out_fd) {
+    // Pipe ends come from pipe2(O_CLOEXEC)
+    plan->slots[0] = (RedirSlot){STDIN_FILENO, in_fd, in_fd != STDIN_FILENO};
+    plan->slots[1] = (RedirSlot){STDOUT_FILENO, out_fd, out_fd != STDOUT_FILENO};
+    plan->slots[2] = (RedirSlot){STDERR_FILENO, STDERR_FILENO, 0};
+    plan->nslots = 3;
+    plan->nowned = 0;
+}
+
+static int find_slot(const RedirPlan *plan, int target) {
+    for (int i = 0; i < plan->nslots; i++) {
+        if (plan->slots[i].target == target) return i;
+    }
+    return -1;
+}
+
+static int open_redir(const Redir *r) {
+    if (r->type == REDIR_HEREDOC) return build_heredoc_fd(r->path);
+    int flags = O_CLOEXEC;
+    if (r->type == REDIR_IN) flags |= O_RDONLY;
+    else if (r->type == REDIR_APPEND) flags |= O_WRONLY | O_CREAT | O_APPEND;
+    else flags |= O_WRONLY | O_CREAT | O_TRUNC;
+    int fd = open(r->path, flags, 0644);
+    if (fd == -1) fprintf(stderr, "minibash: %s: %s\n", r->path, strerror(errno));
+    return fd;
+}
+
+int redir_plan_command(RedirPlan *plan, const Command *cmd) {
+    for (int i = 0; i < cmd->nredirs; i++) {
+        const Redir *r = &cmd->redirs[i];
+        int source = -1, cloexec = 0;
+        if (r->type == REDIR_DUP) {
+            int k = find_slot(plan, r->src_fd);
+            if (k >= 0) {
+                source = plan->slots[k].source;
+                cloexec = plan->slots[k].cloexec;
+            } else {
+                // The shell's own descriptors are close-on-exec; only ones
+                // it inherited can be named
+                int flags = fcntl(r->src_fd, F_GETFD);
+                if (flags != -1 && !(flags & FD_CLOEXEC)) source = r->src_fd;
+            }
+            if (source == -1) {
+                fprintf(stderr, "minibash: %d: Bad file descriptor\n", r->src_fd);
+                goto fail;
+            }
+        } else if (r->type != REDIR_CLOSE) {
+            if (plan->nowned == REDIR_SLOTS) goto full;
+            source = open_redir(r);
+            if (source == -1) goto fail;
+            plan->owned[plan->nowned++] = source;
+            cloexec = 1;
+        }
+
+        int k = find_slot(plan, r->fd);
+        if (k < 0) {
+            if (plan->nslots == REDIR_SLOTS) goto full;
+            k = plan->nslots++;
+        }
+        plan->slots[k] = (RedirSlot){r->fd, source, cloexec};
+    }
+    return 0;
+
+full:
+    fprintf(stderr, "minibash: too many redirections\n");
+fail:
+    redir_release(plan);
+    return -1;
+}
+
+int redir_plan_keep(RedirPlan *plan, int fd) {
+    if (find_slot(plan, fd) >= 0) return 0;
+    if (plan->nslots == REDIR_SLOTS) return -1;
+    int flags = fcntl(fd, F_GETFD);
+    plan->slots[plan->nslots++] = (RedirSlot){fd, fd, flags != -1 && (flags & FD_CLOEXEC)};
+    return 0;
+}
+
+int redir_plan_source(const RedirPlan *plan, int target) {
+    int k = find_slot(plan, target);
+    return k >= 0 ? plan->slots[k].source : target;
+}
+
+static int read_later(const RedirSlot *slots, int n, const int *done, int fd) {
+    for (int i = 0; i < n; i++) {
+        if (!done[i] && slots[i].source == fd) return 1;
+    }
+    return 0;
+}
+
+// Point every target at its source. A target is overwritten only once no
+// pending slot still reads it; when only cycles are left, one target is
+// copied aside first. Closes come last for the same reason.
+static int install(const RedirPlan *plan, int for_exec) {
+    RedirSlot slots[REDIR_SLOTS];
+    int done[REDIR_SLOTS] = {0};
+    int copies[REDIR_SLOTS];
+    int n = plan->nslots, ncopies = 0, pending = 0, ret = -1;
+    memcpy(slots, plan->slots, (size_t)n * sizeof(RedirSlot));
+
+    for (int i = 0; i < n; i++) {
+        if (slots[i].source == slots[i].target) {
+            done[i] = 1;
+            // dup2 onto itself would leave close-on-exec set
+            if (for_exec && slots[i].cloexec && fcntl(slots[i].target, F_SETFD, 0) == -1) {
+                return -1;
+            }
+        } else if (slots[i].source >= 0) {
+            pending++;
+        }
+    }
+
+    while (pending > 0) {
+        int progress = 0;
+        for (int i = 0; i < n; i++) {
+            if (done[i] || slots[i].source < 0) continue;
+            done[i] = 1;
+            if (read_later(slots, n, done, slots[i].target)) {
+                done[i] = 0;
+                continue;
+            }
+            if (dup2(slots[i].source, slots[i].target) == -1) goto out;
+            pending--;
+            progress = 1;
+        }
+        if (progress) continue;
+
+        for (int i = 0; i < n; i++) {
+            if (done[i] || slots[i].source < 0) continue;
+            int copy = fcntl(slots[i].target, F_DUPFD_CLOEXEC, REDIR_COPY_BASE);
+            if (copy == -1) goto out;
+            copies[ncopies++] = copy;
+            for (int k = 0; k < n; k++) {
+                if (!done[k] && slots[k].source == slots[i].target) slots[k].source = copy;
+            }
+            break;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (!done[i] && slots[i].source < 0) close(slots[i].target);
+    }
+    ret = 0;
+
+out:
+    for (int i = 0; i < ncopies; i++) close(copies[i]);
+    return ret;
+}
+
+int redir_apply(const RedirPlan *plan) {
+    if (install(plan, 1) == 0) return 0;
+    perror("minibash: dup2");
+    return -1;
+}
+
+int redir_push(const RedirPlan *plan, RedirSaved *saved) {
+    saved->count = 0;
+    for (int i = 0; i < plan->nslots; i++) {
+        const RedirSlot *s = &plan->slots[i];
+        if (s->source == s->target) continue;
+        int flags = fcntl(s->target, F_GETFD);
+        int copy = -1;
+        if (flags != -1) {
+            copy = fcntl(s->target, F_DUPFD_CLOEXEC, REDIR_COPY_BASE);
+            if (copy == -1) {
+                perror("minibash: fcntl");
+                redir_pop(saved);
+                return -1;
+            }
+        }
+        saved->target[saved->count] = s->target;
+        saved->saved[saved->count] = copy;
+        saved->cloexec[saved->count++] = flags != -1 && (flags & FD_CLOEXEC);
+    }
+    if (install(plan, 0) != 0) {
+        perror("minibash: dup2");
+        redir_pop(saved);
+        return -1;
+    }
+    return 0;
+}
+
+void redir_pop(RedirSaved *saved) {
+    for (int i = saved->count - 1; i >= 0; i--) {
+        if (saved->saved[i] < 0) {
+            close(saved->target[i]);
+            continue;
+        }
+        dup3(saved->saved[i], saved->target[i], saved->cloexec[i] ? O_CLOEXEC : 0);
+        close(saved->saved[i]);
+    }
+    saved->count = 0;
+}
+
+void redir_release(RedirPlan *plan) {
+    for (int i = 0; i < plan->nowned; i++) close(plan->owned[i]);
+    plan->nowned = 0;
+}
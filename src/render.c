@@ -0,0 +1,240 @@
+#include "render.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t winch_pending = 1;
+static int term_cols = 80;
+static int term_rows = 24;
+
+static void on_winch(int sig) {
+    (void)sig;
+    winch_pending = 1;
+}
+
+void render_term_size(int *cols, int *rows) {
+    if (winch_pending) {
+        winch_pending = 0;
+        struct winsize ws;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0) {
+            if (ws.ws_col > 0) term_cols = ws.ws_col;
+            if (ws.ws_row > 0) term_rows = ws.ws_row;
+        }
+    }
+    if (cols) *cols = term_cols;
+    if (rows) *rows = term_rows;
+}
+
+static int prompt_display_len(const char *prompt) {
+    int len = 0;
+    for (const char *p = prompt; *p; p++) {
+        if (*p == '\033') {
+            while (*p && *p != 'm') {
+                p++;
+            }
+            if (!*p) break;
+            continue;
+        }
+        len++;
+    }
+    return len;
+}
+
+void render_init(Renderer *r, int fd) {
+    memset(r, 0, sizeof(*r));
+    outbuf_init(&r->out, fd);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_winch;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &sa, NULL);
+}
+
+void render_free(Renderer *r) {
+    outbuf_free(&r->out);
+    free(r->shown);
+    free(r->hint);
+    r->shown = NULL;
+    r->hint = NULL;
+    r->hint_len = r->hint_cap = 0;
+    r->shown_len = r->shown_cap = r->shown_pos = 0;
+    r->valid = 0;
+}
+
+void render_invalidate(Renderer *r) {
+    r->valid = 0;
+    r->cursor_row = 0;
+}
+
+// Cursor positions are offsets into the line. Past the prompt they wrap at
+// the terminal width, so each is a row below the prompt's and a column.
+static void move_cursor(Renderer *r, int from, int to) {
+    if (to == from) return;
+    int cols;
+    render_term_size(&cols, NULL);
+    int from_row = (r->prompt_width + from) / cols;
+    int to_row = (r->prompt_width + to) / cols;
+    if (to_row < from_row) outbuf_printf(&r->out, "\033[%dA", from_row - to_row);
+    else if (to_row > from_row) outbuf_printf(&r->out, "\033[%dB", to_row - from_row);
+    outbuf_printf(&r->out, "\033[%dG", (r->prompt_width + to) % cols + 1);
+    r->cursor_row = to_row;
+}
+
+// After output ending at offset end the cursor is there, except that a
+// terminal filling its last column holds the cursor on it until the next
+// byte. Wrap explicitly then, so rows and columns keep adding up.
+static void settle(Renderer *r, int end, int wrote) {
+    int cols;
+    render_term_size(&cols, NULL);
+    if (wrote && (r->prompt_width + end) % cols == 0) outbuf_puts(&r->out, "\r\n");
+    r->cursor_row = (r->prompt_width + end) / cols;
+}
+
+// Record the new frame. Only the bytes from the first difference onward need
+// copying; the rest already matches.
+static void remember(Renderer *r, const GapBuf *gb, int common) {
+    int len = (int)gapbuf_len(gb);
+    if (len > r->shown_cap) {
+        int cap = r->shown_cap ? r->shown_cap : 256;
+        while (cap < len) cap *= 2;
+        char *tmp = realloc(r->shown, (size_t)cap);
+        if (!tmp) {
+            // Without a copy of the screen we can only do full redraws
+            r->valid = 0;
+            return;
+        }
+        r->shown = tmp;
+        r->shown_cap = cap;
+    }
+    if (common < len) gapbuf_copy(gb, (size_t)common, (size_t)len, r->shown + common);
+    r->shown_len = len;
+    r->shown_pos = (int)gapbuf_cursor(gb);
+    r->valid = 1;
+}
+
+static void remember_hint(Renderer *r, const char *hint, int len) {
+    if (len > r->hint_cap) {
+        char *tmp = realloc(r->hint, (size_t)len);
+        if (!tmp) {
+            r->valid = 0;
+            return;
+        }
+        r->hint = tmp;
+        r->hint_cap = len;
+    }
+    if (len > 0) memcpy(r->hint, hint, (size_t)len);
+    r->hint_len = len;
+}
+
+static void reset_shown(Renderer *r) {
+    r->hint_len = 0;
+    r->shown_len = 0;
+    r->shown_pos = 0;
+    r->valid = 1;
+}
+
+void render_set_prompt(Renderer *r, const char *prompt) {
+    r->prompt = prompt;
+    r->prompt_width = prompt_display_len(prompt);
+    r->valid = 0;
+}
+
+void render_begin(Renderer *r, const char *prompt) {
+    // Anything still sitting in stdio must reach the terminal before the prompt
+    fflush(stdout);
+    r->prompt = prompt;
+    r->prompt_width = prompt_display_len(prompt);
+    outbuf_puts(&r->out, prompt);
+    settle(r, 0, r->prompt_width > 0);
+    outbuf_flush(&r->out);
+    reset_shown(r);
+}
+
+// Length of the prefix the buffer shares with what is on screen
+static int common_prefix(const Renderer *r, const GapBuf *gb) {
+    size_t tail_len;
+    const char *tail = gapbuf_tail(gb, &tail_len);
+    const char *spans[2] = {gb->data, tail};
+    int span_lens[2] = {(int)gapbuf_cursor(gb), (int)tail_len};
+
+    int common = 0;
+    for (int s = 0; s < 2; s++) {
+        int n = span_lens[s];
+        if (n > r->shown_len - common) n = r->shown_len - common;
+        int i = 0;
+        while (i < n && spans[s][i] == r->shown[common + i]) i++;
+        common += i;
+        if (i < span_lens[s]) break;
+    }
+    return common;
+}
+
+// Append logical range [from, len) of the buffer to the frame
+static void append_from(Renderer *r, const GapBuf *gb, int from) {
+    int cursor = (int)gapbuf_cursor(gb);
+    size_t tail_len;
+    const char *tail = gapbuf_tail(gb, &tail_len);
+    if (from < cursor) {
+        outbuf_append(&r->out, gb->data + from, (size_t)(cursor - from));
+        from = cursor;
+    }
+    outbuf_append(&r->out, tail + (from - cursor), tail_len - (size_t)(from - cursor));
+}
+
+void render_line(Renderer *r, const GapBuf *gb, const char *hint) {
+    OutBuf *out = &r->out;
+    int len = (int)gapbuf_len(gb);
+    int pos = (int)gapbuf_cursor(gb);
+    int hint_len = hint ? (int)strlen(hint) : 0;
+    int common = 0;
+
+    if (!r->valid) {
+        if (r->cursor_row > 0) outbuf_printf(out, "\033[%dA", r->cursor_row);
+        outbuf_puts(out, "\r");
+        outbuf_puts(out, r->prompt ? r->prompt : "");
+        append_from(r, gb, 0);
+        if (hint_len > 0) {
+            outbuf_puts(out, "\033[2m");
+            outbuf_append(out, hint, (size_t)hint_len);
+            outbuf_puts(out, "\033[0m");
+        }
+        settle(r, len + hint_len, r->prompt_width + len + hint_len > 0);
+        outbuf_puts(out, "\033[J");
+        move_cursor(r, len + hint_len, pos);
+    } else {
+        common = common_prefix(r, gb);
+        int same_hint = hint_len == r->hint_len &&
+                        (hint_len == 0 || memcmp(hint, r->hint, (size_t)hint_len) == 0);
+        if (common == len && common == r->shown_len && same_hint) {
+            move_cursor(r, r->shown_pos, pos);
+        } else {
+            move_cursor(r, r->shown_pos, common);
+            append_from(r, gb, common);
+            if (hint_len > 0) {
+                outbuf_puts(out, "\033[2m");
+                outbuf_append(out, hint, (size_t)hint_len);
+                outbuf_puts(out, "\033[0m");
+            }
+            settle(r, len + hint_len, len - common + hint_len > 0);
+            if (len + hint_len < r->shown_len + r->hint_len) outbuf_puts(out, "\033[J");
+            move_cursor(r, len + hint_len, pos);
+        }
+    }
+
+    outbuf_flush(out);
+    remember(r, gb, common);
+    remember_hint(r, hint, hint_len);
+}
+
+void render_finish(Renderer *r) {
+    int end = r->shown_len + r->hint_len;
+    move_cursor(r, r->shown_pos, end);
+    r->shown_pos = end;
+    outbuf_flush(&r->out);
+}
@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+
+#include "server.h"
+#include "builtins.h"
+#include "completion.h"
+#include "shell.h"
+#include "zygote.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define REQUEST_MAX (1 << 20)
+#define REQUEST_FDS 3
+
+static int make_addr(const char *sock_path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(sock_path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "minibash: %s: socket path too long\n", sock_path);
+        return -1;
+    }
+    strcpy(addr->sun_path, sock_path);
+    return 0;
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int reply_fd = -1;
+
+// Sent once, by the request process itself, when its line finishes
+static void send_status(int status) {
+    fflush(NULL);
+    int32_t code = status;
+    write_full(reply_fd, &code, sizeof(code));
+}
+
+// Read a request and its fds; returns the NUL-terminated command or NULL
+static char *recv_request(int conn, int fds[REQUEST_FDS]) {
+    uint32_t len;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(REQUEST_FDS * sizeof(int))];
+    } control;
+    struct iovec iov = {.iov_base = &len, .iov_len = sizeof(len)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    if (n != (ssize_t)sizeof(len)) return NULL;
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS ||
+        cm->cmsg_len != CMSG_LEN(REQUEST_FDS * sizeof(int))) {
+        return NULL;
+    }
+    memcpy(fds, CMSG_DATA(cm), REQUEST_FDS * sizeof(int));
+    if (len > REQUEST_MAX) return NULL;
+
+    char *command = malloc((size_t)len + 1);
+    if (!command) return NULL;
+    if (read_full(conn, command, len) != 0) {
+        free(command);
+        return NULL;
+    }
+    command[len] = '\0';
+    return command;
+}
+
+static void serve_request(int conn) {
+    int fds[REQUEST_FDS];
+    char *command = recv_request(conn, fds);
+    if (!command) _exit(1);
+
+    for (int i = 0; i < REQUEST_FDS; i++) {
+        if (dup2(fds[i], i) == -1) _exit(1);
+        if (fds[i] >= REQUEST_FDS) close(fds[i]);
+    }
+    reply_fd = conn;
+    int status = shell_run_line(command);
+    send_status(status);
+    shell_cleanup();
+    exit(status);
+}
+
+int server_run(const char *sock_path) {
+    struct sockaddr_un addr;
+    if (make_addr(sock_path, &addr) != 0) return 1;
+
+    // Received fds must not land on 0-2 if this process was started with
+    // them closed, or installing a request's stdio would clobber them
+    int null_fd;
+    do {
+        null_fd = open("/dev/null", O_RDWR);
+    } while (null_fd >= 0 && null_fd < REQUEST_FDS);
+    if (null_fd == -1) {
+        perror("minibash: /dev/null");
+        return 1;
+    }
+    close(null_fd);
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd == -1) {
+        perror("socket");
+        return 1;
+    }
+    unlink(sock_path);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        chmod(sock_path, 0600) == -1 || listen(lfd, SOMAXCONN) == -1) {
+        fprintf(stderr, "minibash: %s: %s\n", sock_path, strerror(errno));
+        close(lfd);
+        return 1;
+    }
+
+    // Requests are never waited for; the kernel reaps them
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sa.sa_flags = SA_NOCLDWAIT;
+    sigaction(SIGCHLD, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Concurrent requests cannot share one zygote connection; they fork
+    // from this process instead
+    zygote_stop();
+
+    const char *path = getenv("PATH");
+    if (path) completion_refresh_index(path);
+
+    while (1) {
+        int conn = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (conn == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                sleep(1);
+                continue;
+            }
+            break;
+        }
+
+        // Revalidate the executable index here so each request inherits an
+        // up-to-date copy instead of rebuilding it in the child
+        path = getenv("PATH");
+        if (path) completion_refresh_index(path);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(lfd);
+            sa.sa_flags = 0;
+            sigaction(SIGCHLD, &sa, NULL);
+            signal(SIGPIPE, SIG_DFL);
+            serve_request(conn);
+        }
+        if (pid == -1) perror("fork");
+        close(conn);
+    }
+    close(lfd);
+    return 1;
+}
+
+int server_request(const char *sock_path, const char *command) {
+    struct sockaddr_un addr;
+    if (make_addr(sock_path, &addr) != 0) return 127;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket");
+        return 127;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "minibash: %s: %s\n", sock_path, strerror(errno));
+        close(fd);
+        return 127;
+    }
+
+    size_t clen = strlen(command);
+    uint32_t len = (uint32_t)clen;
+    int fds[REQUEST_FDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(REQUEST_FDS * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = {.iov_base = &len, .iov_len = sizeof(len)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+    int32_t status;
+    if (clen > REQUEST_MAX || sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(len) ||
+        write_full(fd, command, clen) != 0 || read_full(fd, &status, sizeof(status)) != 0) {
+        fprintf(stderr, "minibash: %s: request failed\n", sock_path);
+        close(fd);
+        return 127;
+    }
+    close(fd);
+    return status;
+}
@@ -1,144 +1,140 @@
 #include "shell.h"
+#include "alloc.h"
+#include "arith.h"
+#include "array.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
-#include <limits.h>
 
 #include "execute.h"
+#include "func.h"
 #include "parse.h"
 #include "line_edit.h"
 #include "builtins.h"
+#include "prompt.h"
+#include "rc.h"
+#include "source.h"
+#include "zygote.h"
+
+static const char *refresh_prompt(void *ctx) {
+    (void)ctx;
+    return prompt_refresh();
+}
 
-static int run_capture(const char *cmd, char *out, size_t out_size) {
-    FILE *fp = popen(cmd, "r");
-    if (!fp) {
-        return -1;
-    }
+// A function definition still waiting for its closing brace
+static char *pending = NULL;
 
-    if (!fgets(out, out_size, fp)) {
-        pclose(fp);
+int shell_init(int load_rc) {
+    alloc_init();
+    // Forked first, while the shell's image is still small
+    const char *zygote = getenv("MINIBASH_ZYGOTE");
+    if (zygote && strcmp(zygote, "1") == 0 && zygote_start() != 0) {
+        perror("minibash: zygote");
+    }
+    if (builtins_init() != 0) {
+        fprintf(stderr, "failed to init builtins\n");
         return -1;
     }
-
-    pclose(fp);
-    size_t len = strcspn(out, "\n");
-    out[len] = '\0';
+    if (load_rc) {
+        rc_load(shell_run_line);
+    }
     return 0;
 }
 
-static int git_branch(char *branch, size_t size) {
-    char probe[8];
-    if (run_capture("git rev-parse --is-inside-work-tree 2>/dev/null", probe, sizeof(probe)) != 0) {
-        return -1;
-    }
-    if (strcmp(probe, "true") != 0) {
-        return -1;
+void shell_cleanup(void) {
+    if (pending) {
+        fprintf(stderr, "minibash: unexpected end of input in function definition\n");
+        xfree(pending);
+        pending = NULL;
     }
+    zygote_stop();
+    prompt_cleanup();
+    source_cleanup();
+    func_cleanup();
+    array_cleanup();
+    arith_cleanup();
+    builtins_cleanup();
+}
 
-    if (run_capture("git symbolic-ref --short HEAD 2>/dev/null", branch, size) == 0) {
-        return 0;
-    }
-    if (run_capture("git rev-parse --short HEAD 2>/dev/null", branch, size) == 0) {
-        return 0;
+// Run one command: a pipeline up to the next ';' or newline
+static void run_command(const char *text, size_t len) {
+    char *cmd_copy = xstrndup(ALLOC_PARSER, text, len);
+    if (!cmd_copy) return;
+
+    Pipeline pipeline;
+    int parse_status = parse_line(cmd_copy, &pipeline);
+    if (parse_status > 0) {
+        execute_commands(&pipeline);
     }
-    return -1;
+    free_pipeline(&pipeline);
+    xfree(cmd_copy);
 }
 
-static void build_prompt(char *prompt, size_t size, int last_status) {
-    const char *c_reset = "\033[0m";
-    const char *c_prompt = "\033[38;5;45m";   // cyan-ish
-    const char *c_folder = "\033[38;5;81m";   // light cyan
-    const char *c_git = "\033[38;5;214m";     // orange
-    const char *c_ok = "\033[38;5;41m";       // green
-    const char *c_err = "\033[38;5;197m";     // red
-
-    char cwd[PATH_MAX] = {0};
-    const char *folder = "?";
-    if (getcwd(cwd, sizeof(cwd))) {
-        const char *last_slash = strrchr(cwd, '/');
-        if (last_slash && *(last_slash + 1) != '\0') {
-            folder = last_slash + 1;
-        } else {
-            folder = cwd;
-        }
+int shell_run_line(char *line) {
+    char *joined = NULL;
+    if (pending) {
+        // This line continues the definition left open by the last one
+        size_t plen = strlen(pending), len = strlen(line);
+        joined = xmalloc(ALLOC_PARSER, plen + len + 2);
+        if (!joined) return execute_last_status();
+        memcpy(joined, pending, plen);
+        joined[plen] = '\n';
+        memcpy(joined + plen + 1, line, len + 1);
+        xfree(pending);
+        pending = NULL;
+        line = joined;
     }
 
-    char branch[128];
-    int has_git = git_branch(branch, sizeof(branch)) == 0;
+    char *p = line;
+    while (!execute_exiting()) {
+        p += strspn(p, " \t;\n");
+        if (!*p) break;
 
-    const char *status_color = last_status == 0 ? c_ok : c_err;
+        size_t used = 0;
+        int def = func_define(p, &used);
+        if (def == 2) {
+            pending = xstrdup(ALLOC_PARSER, p);
+            break;
+        }
+        if (def != 0) {
+            execute_set_last_status(def == 1 ? 0 : 2);
+            p += used;
+            continue;
+        }
 
-    if (has_git) {
-        snprintf(prompt, size, "%sminibash%s %s[%s]%s %s(git:%s)%s %s[%d]%s $ ",
-                 c_prompt, c_reset,
-                 c_folder, folder, c_reset,
-                 c_git, branch, c_reset,
-                 status_color, last_status, c_reset);
-    } else {
-        snprintf(prompt, size, "%sminibash%s %s[%s]%s %s[%d]%s $ ",
-                 c_prompt, c_reset,
-                 c_folder, folder, c_reset,
-                 status_color, last_status, c_reset);
+        size_t len = strcspn(p, ";\n");
+        run_command(p, len);
+        p += len;
     }
+    xfree(joined);
+    return execute_last_status();
 }
 
-void shell_loop(void) {
-    if (builtins_init() != 0) {
-        fprintf(stderr, "failed to init builtins\n");
-        return;
-    }
-
+int shell_loop(void) {
+    // exit in the rc file
+    if (execute_exiting()) return execute_last_status();
     LineEditor *ed = line_editor_create();
     if (!ed) {
         fprintf(stderr, "failed to init line editor\n");
-        builtins_cleanup();
-        return;
+        return 1;
+    }
+    if (prompt_init() == 0) {
+        line_editor_set_prompt_hook(ed, prompt_notify_fd(), refresh_prompt, NULL);
     }
-    int last_status = 0;
     while (1) {
-        char prompt[256];
-        build_prompt(prompt, sizeof(prompt), last_status);
+        const char *prompt = pending ? "> " : prompt_render(execute_last_status());
         char *line = NULL;
         int len = line_editor_read(ed, prompt, &line);
         if (len < 0) {
-            free(line);
+            xfree(line);
             break;
         }
-
-        // Split by semicolon for chained commands
-        char *saveptr = NULL;
-        char *cmd = strtok_r(line, ";", &saveptr);
-        while (cmd) {
-            // Skip leading whitespace
-            while (*cmd == ' ' || *cmd == '\t') cmd++;
-            if (*cmd == '\0') {
-                cmd = strtok_r(NULL, ";", &saveptr);
-                continue;
-            }
-
-            // Create a copy for parsing
-            char *cmd_copy = strdup(cmd);
-            if (!cmd_copy) {
-                cmd = strtok_r(NULL, ";", &saveptr);
-                continue;
-            }
-
-            Pipeline pipeline;
-            int parse_status = parse_line(cmd_copy, &pipeline);
-            if (parse_status > 0) {
-                last_status = execute_commands(&pipeline);
-            }
-            free_pipeline(&pipeline);
-            free(cmd_copy);
-
-            cmd = strtok_r(NULL, ";", &saveptr);
-        }
-
-        free(line);
+        shell_run_line(line);
+        xfree(line);
+        if (execute_exiting()) break;
     }
 
     line_editor_destroy(ed);
-    builtins_cleanup();
+    return execute_exiting() ? execute_last_status() : 0;
 }
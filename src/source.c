@@ -0,0 +1,407 @@
+#define _GNU_SOURCE
+
+#include "source.h"
+#include "alloc.h"
+#include "arena.h"
+#include "command.h"
+#include "execute.h"
+#include "func.h"
+#include "parse.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SOURCE_CACHE_MAX 8
+
+typedef enum {
+    ITEM_STMT,
+    ITEM_DEF
+} ItemKind;
+
+// One thing the script does, in order
+typedef struct {
+    ItemKind kind;
+    int line;
+    int lines;              // how many it spans
+    PackedPipeline stmt;    // ITEM_STMT
+    char *def;              // ITEM_DEF: the definition's text in the map
+} Item;
+
+// A mapped script and what has been parsed from it. Statements are cut out
+// of the map in place (the mapping is private), so their words point into it.
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    char *map;
+    size_t map_len;
+    Item *items;
+    int nitems;
+    int cap;
+    Arena arena;            // the packed statements
+    uint64_t used;          // when it last ran, for eviction
+    int refs;               // runs in progress
+    int cached;
+} Script;
+
+static Script *cache[SOURCE_CACHE_MAX];
+static int ncached = 0;
+static uint64_t ticks = 0;
+
+static void destroy(Script *sc) {
+    if (sc->map) munmap(sc->map, sc->map_len);
+    arena_free(&sc->arena);
+    xfree(sc->items);
+    xfree(sc);
+}
+
+static void release(Script *sc) {
+    if (--sc->refs == 0 && !sc->cached) destroy(sc);
+}
+
+// A script still running is freed when it finishes
+static void evict(int i) {
+    Script *sc = cache[i];
+    cache[i] = cache[--ncached];
+    sc->cached = 0;
+    if (sc->refs == 0) destroy(sc);
+}
+
+static int same_file(const Script *sc, const struct stat *st) {
+    return sc->size == st->st_size &&
+           sc->mtime.tv_sec == st->st_mtim.tv_sec &&
+           sc->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// The parse of the file st describes, if cached; one of an older version of
+// the same file is dropped
+static Script *lookup(const struct stat *st) {
+    for (int i = 0; i < ncached; i++) {
+        if (cache[i]->dev != st->st_dev || cache[i]->ino != st->st_ino) continue;
+        if (same_file(cache[i], st)) return cache[i];
+        evict(i);
+        return NULL;
+    }
+    return NULL;
+}
+
+static void insert(Script *sc) {
+    if (ncached == SOURCE_CACHE_MAX) {
+        int oldest = 0;
+        for (int i = 1; i < ncached; i++) {
+            if (cache[i]->used < cache[oldest]->used) oldest = i;
+        }
+        evict(oldest);
+    }
+    cache[ncached++] = sc;
+    sc->cached = 1;
+}
+
+// Map size bytes of fd followed by a NUL, writable without touching the file
+static char *map_file(int fd, size_t size, size_t *len) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    *len = (size + 1 + page - 1) & ~(page - 1);
+    char *map = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) return NULL;
+    // The file goes over the front; the byte after it falls in the
+    // zero-filled end of its last page or in the anonymous page behind it
+    if (size > 0 &&
+        mmap(map, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(map, *len);
+        return NULL;
+    }
+    map[size] = '\0';
+    madvise(map, *len, MADV_SEQUENTIAL);
+    return map;
+}
+
+static Item *add_item(Script *sc, ItemKind kind, int line, int lines) {
+    if (sc->nitems == sc->cap) {
+        int cap = sc->cap ? sc->cap * 2 : 32;
+        Item *tmp = xrealloc(ALLOC_PARSER, sc->items, (size_t)cap * sizeof(Item));
+        if (!tmp) return NULL;
+        sc->items = tmp;
+        sc->cap = cap;
+    }
+    Item *it = &sc->items[sc->nitems++];
+    it->kind = kind;
+    it->line = line;
+    it->lines = lines;
+    return it;
+}
+
+// Step over blank space, separators, NULs left by cutting out statements,
+// and comment lines
+static char *skip_blank(char *s, const char *end, int *line) {
+    while (s < end) {
+        if (*s == '#') {
+            s += strcspn(s, "\n");
+            continue;
+        }
+        if (*s == '\n') (*line)++;
+        else if (*s != ' ' && *s != '\t' && *s != ';' && *s != '\0') break;
+        s++;
+    }
+    return s;
+}
+
+static int count_lines(const char *s, size_t n) {
+    int lines = 0;
+    for (const char *e = s + n; (s = memchr(s, '\n', (size_t)(e - s))); s++) lines++;
+    return lines;
+}
+
+// Whether the file behind fd is no longer what sc mapped. Pages past a
+// shrunken end would raise SIGBUS when touched.
+static int changed(const Script *sc, int fd) {
+    struct stat st;
+    return fstat(fd, &st) != 0 || !same_file(sc, &st);
+}
+
+// The file from off to its current end, read into a NUL-terminated buffer
+static char *read_rest(int fd, off_t off, size_t *len) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return NULL;
+    size_t cap = st.st_size > off ? (size_t)(st.st_size - off) : 0;
+    char *buf = xmalloc(ALLOC_PARSER, cap + 1);
+    if (!buf) return NULL;
+    *len = 0;
+    while (*len < cap) {
+        ssize_t n = pread(fd, buf + *len, cap - *len, off + (off_t)*len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        *len += (size_t)n;
+    }
+    buf[*len] = '\0';
+    return buf;
+}
+
+// Move the map's contents into anonymous memory at the same address before
+// caching it, so the statements keep pointing at it and later runs cannot
+// fault when the file is truncated (which drops even copied private pages).
+// Fails if the file has already changed.
+static int detach(Script *sc, int fd) {
+    if (changed(sc, fd)) return -1;
+    char *copy = mmap(NULL, sc->map_len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (copy == MAP_FAILED) return -1;
+    memcpy(copy, sc->map, sc->map_len);
+    if (mremap(copy, sc->map_len, sc->map_len, MREMAP_MAYMOVE | MREMAP_FIXED, sc->map) == MAP_FAILED) {
+        munmap(copy, sc->map_len);
+        return -1;
+    }
+    return 0;
+}
+
+// Parse the script a statement at a time, running each as soon as it is
+// parsed and keeping its parsed form in sc. *whole is cleared unless all of
+// it was parsed without error. If a statement changes the file, the rest is
+// read from fd at the same offset and parsed from that copy instead.
+static int run_fresh(Script *sc, const char *path, int fd, int *whole) {
+    Pipeline *p = xmalloc(ALLOC_PARSER, sizeof(Pipeline));
+    if (!p) {
+        perror("minibash");
+        *whole = 0;
+        return 1;
+    }
+    init_pipeline(p);
+
+    char *s = sc->map, *end = sc->map + sc->size;
+    char *rest = NULL;
+    int line = 1, status = 0, lines_run = 0;
+    while (!func_returning() && !execute_exiting()) {
+        if (!rest && s > sc->map && changed(sc, fd)) {
+            size_t len;
+            rest = read_rest(fd, s - sc->map, &len);
+            if (!rest) {
+                fprintf(stderr, "minibash: %s: %s\n", path, strerror(errno));
+                status = 1;
+                break;
+            }
+            s = rest;
+            end = rest + len;
+            *whole = 0;
+        }
+        s = skip_blank(s, end, &line);
+        if (s >= end) break;
+        parse_set_location(path, line);
+
+        size_t used = 0;
+        int def = func_define(s, &used);
+        if (def == 2) {
+            parse_error_prefix();
+            fprintf(stderr, "unterminated function definition\n");
+            *whole = 0;
+            status = 2;
+            s = end;
+            break;
+        }
+        if (def != 0) {
+            int span = count_lines(s, used) + 1;
+            if (def == 1) {
+                lines_run += span;
+                Item *it = add_item(sc, ITEM_DEF, line, span);
+                if (it) it->def = s;
+                else *whole = 0;
+            } else {
+                *whole = 0;
+            }
+            status = def == 1 ? 0 : 2;
+            execute_set_last_status(status);
+            line += span - 1;
+            s += used;
+            continue;
+        }
+
+        size_t len = strcspn(s, ";\n");
+        char term = s[len];
+        s[len] = '\0';
+        int r = parse_line_again(s, p);
+        if (r < 0) {
+            *whole = 0;
+            status = 2;
+        } else if (r > 0) {
+            Item *it = add_item(sc, ITEM_STMT, line, 1);
+            if (!it || pack_pipeline(&it->stmt, p, &sc->arena) != 0) {
+                if (it) sc->nitems--;
+                *whole = 0;
+            }
+            status = execute_commands(p);
+            lines_run++;
+        }
+        s += len;
+        if (term) s++;
+        if (term == '\n') line++;
+    }
+    // Stopped by return: whatever follows has not been parsed
+    if (skip_blank(s, end, &line) < end) *whole = 0;
+    stats_add("source.lines", (uint64_t)lines_run);
+    xfree(rest);
+    free_pipeline(p);
+    xfree(p);
+    return status;
+}
+
+// Run what an earlier run parsed. Definitions are made again from their
+// text, which is still in the map.
+static int run_cached(Script *sc, const char *path) {
+    Arena arena;
+    arena_init(&arena);
+    Pipeline *work = arena_alloc(&arena, sizeof(Pipeline));
+    if (!work) {
+        perror("minibash");
+        return 1;
+    }
+    char **args[MAX_CMDS] = {0};
+
+    int status = 0, lines_run = 0;
+    for (int i = 0; i < sc->nitems && !func_returning() && !execute_exiting(); i++) {
+        const Item *it = &sc->items[i];
+        parse_set_location(path, it->line);
+        lines_run += it->lines;
+        if (it->kind == ITEM_DEF) {
+            size_t used = 0;
+            status = func_define(it->def, &used) == 1 ? 0 : 2;
+            execute_set_last_status(status);
+            continue;
+        }
+        if (unpack_pipeline(work, args, &it->stmt, &arena) != 0) {
+            perror("minibash");
+            status = 1;
+            break;
+        }
+        status = execute_commands(work);
+    }
+    stats_add("source.lines", (uint64_t)lines_run);
+    arena_free(&arena);
+    return status;
+}
+
+// Open path and map it, or find its parse in the cache. *fdp is left open
+// for the caller.
+static Script *load(const char *path, struct stat *st, int *fresh, int *fdp) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "minibash: %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, st) != 0) {
+        fprintf(stderr, "minibash: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    if (!S_ISREG(st->st_mode)) {
+        fprintf(stderr, "minibash: %s: not a regular file\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    Script *sc = lookup(st);
+    *fresh = sc == NULL;
+    if (!sc) {
+        sc = xcalloc(ALLOC_PARSER, 1, sizeof(Script));
+        if (!sc) {
+            perror("minibash");
+            close(fd);
+            return NULL;
+        }
+        arena_init(&sc->arena);
+        sc->dev = st->st_dev;
+        sc->ino = st->st_ino;
+        sc->mtime = st->st_mtim;
+        sc->size = st->st_size;
+        sc->map = map_file(fd, (size_t)st->st_size, &sc->map_len);
+        if (!sc->map) {
+            fprintf(stderr, "minibash: %s: %s\n", path, strerror(errno));
+            destroy(sc);
+            sc = NULL;
+        }
+    }
+    if (sc) *fdp = fd;
+    else close(fd);
+    return sc;
+}
+
+int builtin_source(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "minibash: %s: usage: %s file [arg...]\n", argv[0], argv[0]);
+        return 2;
+    }
+    const char *path = argv[1];
+    struct stat st;
+    int fresh = 0, fd = -1;
+    Script *sc = load(path, &st, &fresh, &fd);
+    if (!sc) return 1;
+    stats_add("source.runs", 1);
+    if (!fresh) stats_add("source.cached", 1);
+    sc->used = ++ticks;
+    sc->refs++;
+
+    const char *saved_file;
+    int saved_line;
+    parse_get_location(&saved_file, &saved_line);
+    int status = 1;
+    if (func_enter_source(argc - 1, argv + 1) == 0) {
+        int whole = 1;
+        status = fresh ? run_fresh(sc, path, fd, &whole) : run_cached(sc, path);
+        status = func_leave_source(status);
+        // A nested source of the same file may have cached it already
+        if (fresh && whole && !lookup(&st) && detach(sc, fd) == 0) insert(sc);
+    }
+    parse_set_location(saved_file, saved_line);
+    close(fd);
+    release(sc);
+    return status;
+}
+
+void source_cleanup(void) {
+    while (ncached > 0) evict(ncached - 1);
+}
@@ -0,0 +1,64 @@
+#include "stats.h"
+#include "alloc.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define STATS_MAX 64
+
+typedef struct {
+    const char *name;
+    uint64_t value;
+} Counter;
+
+static Counter counters[STATS_MAX];
+static int ncounters = 0;
+
+static Counter *counter(const char *name) {
+    for (int i = 0; i < ncounters; i++) {
+        if (counters[i].name == name || strcmp(counters[i].name, name) == 0) {
+            return &counters[i];
+        }
+    }
+    if (ncounters == STATS_MAX) return NULL;
+    counters[ncounters].name = name;
+    counters[ncounters].value = 0;
+    return &counters[ncounters++];
+}
+
+void stats_add(const char *name, uint64_t delta) {
+    Counter *c = counter(name);
+    if (c) c->value += delta;
+}
+
+void stats_set(const char *name, uint64_t value) {
+    Counter *c = counter(name);
+    if (c) c->value = value;
+}
+
+uint64_t stats_get(const char *name) {
+    for (int i = 0; i < ncounters; i++) {
+        if (strcmp(counters[i].name, name) == 0) return counters[i].value;
+    }
+    return 0;
+}
+
+int builtin_stats(OutBuf *out, OutBuf *err, int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "alloc") == 0) {
+        int sites = argc > 2 && strcmp(argv[2], "sites") == 0;
+        if (alloc_report(out, sites) != 0) {
+            outbuf_puts(err, "minibash: stats: allocation profiling is off (MINIBASH_ALLOC_PROFILE=1)\n");
+            return 1;
+        }
+        return 0;
+    }
+    const char *prefix = argc > 1 ? argv[1] : NULL;
+    size_t plen = prefix ? strlen(prefix) : 0;
+    for (int i = 0; i < ncounters; i++) {
+        const char *name = counters[i].name;
+        if (prefix && (strncmp(name, prefix, plen) != 0 || name[plen] != '.')) continue;
+        outbuf_printf(out, "%-32s %" PRIu64 "\n", name, counters[i].value);
+    }
+    return 0;
+}
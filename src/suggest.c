@@ -0,0 +1,229 @@
+#include "suggest.h"
+#include "alloc.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A use's weight doubles every FRECENCY_HALF_LIFE recorded commands, which is
+// the same as older uses decaying by half over that span.
+#define FRECENCY_HALF_LIFE 64.0
+#define FRECENCY_RESCALE_EXP 512
+#define NO_NODE UINT32_MAX
+#define NO_ENTRY UINT32_MAX
+
+typedef struct Node {
+    uint32_t child;
+    uint32_t sibling;
+    uint32_t best;      // highest scoring entry with this prefix
+    uint32_t entry;     // entry ending exactly here
+    unsigned char ch;
+} Node;
+
+// A free entry has no line and chains to the next free one through node
+typedef struct Entry {
+    char *line;
+    double score;
+    uint32_t node;      // where the line ends
+    uint32_t refs;      // history lines sharing this copy
+} Entry;
+
+// Nodes and entries dropped with their lines are reused before the arrays
+// grow. Free nodes chain through sibling.
+struct SuggestTrie {
+    Node *nodes;
+    uint32_t node_count;
+    uint32_t node_cap;
+    uint32_t free_node;
+    Entry *entries;
+    uint32_t entry_count;
+    uint32_t entry_cap;
+    uint32_t free_entry;
+    double tick;
+};
+
+static uint32_t node_new(SuggestTrie *t, unsigned char ch) {
+    if (t->free_node != NO_NODE) {
+        uint32_t i = t->free_node;
+        t->free_node = t->nodes[i].sibling;
+        t->nodes[i] = (Node){NO_NODE, NO_NODE, NO_ENTRY, NO_ENTRY, ch};
+        return i;
+    }
+    if (t->node_count == t->node_cap) {
+        uint32_t cap = t->node_cap ? t->node_cap * 2 : 1024;
+        Node *tmp = xrealloc(ALLOC_HISTORY, t->nodes, cap * sizeof(Node));
+        if (!tmp) return NO_NODE;
+        t->nodes = tmp;
+        t->node_cap = cap;
+    }
+    Node *n = &t->nodes[t->node_count];
+    n->child = NO_NODE;
+    n->sibling = NO_NODE;
+    n->best = NO_ENTRY;
+    n->entry = NO_ENTRY;
+    n->ch = ch;
+    return t->node_count++;
+}
+
+static uint32_t find_child(const SuggestTrie *t, uint32_t node, unsigned char ch) {
+    for (uint32_t c = t->nodes[node].child; c != NO_NODE; c = t->nodes[c].sibling) {
+        if (t->nodes[c].ch == ch) return c;
+    }
+    return NO_NODE;
+}
+
+SuggestTrie *suggest_create(void) {
+    SuggestTrie *t = xcalloc(ALLOC_HISTORY, 1, sizeof(SuggestTrie));
+    if (!t) return NULL;
+    t->free_node = NO_NODE;
+    t->free_entry = NO_ENTRY;
+    if (node_new(t, 0) == NO_NODE) {
+        xfree(t);
+        return NULL;
+    }
+    return t;
+}
+
+void suggest_destroy(SuggestTrie *t) {
+    if (!t) return;
+    for (uint32_t i = 0; i < t->entry_count; i++) {
+        xfree(t->entries[i].line);
+    }
+    xfree(t->entries);
+    xfree(t->nodes);
+    xfree(t);
+}
+
+static uint32_t entry_new(SuggestTrie *t, const char *line, uint32_t node) {
+    if (t->free_entry == NO_ENTRY && t->entry_count == t->entry_cap) {
+        uint32_t cap = t->entry_cap ? t->entry_cap * 2 : 128;
+        Entry *tmp = xrealloc(ALLOC_HISTORY, t->entries, cap * sizeof(Entry));
+        if (!tmp) return NO_ENTRY;
+        t->entries = tmp;
+        t->entry_cap = cap;
+    }
+    char *copy = xstrdup(ALLOC_HISTORY, line);
+    if (!copy) return NO_ENTRY;
+    uint32_t e = t->free_entry;
+    if (e != NO_ENTRY) t->free_entry = t->entries[e].node;
+    else e = t->entry_count++;
+    t->entries[e] = (Entry){copy, 0.0, node, 0};
+    return e;
+}
+
+// Keep weights in range; scaling every score by the same factor preserves
+// the ranking stored in the nodes.
+static void rescale(SuggestTrie *t) {
+    for (uint32_t i = 0; i < t->entry_count; i++) {
+        if (t->entries[i].line) t->entries[i].score = ldexp(t->entries[i].score, -FRECENCY_RESCALE_EXP);
+    }
+    t->tick -= FRECENCY_RESCALE_EXP * FRECENCY_HALF_LIFE;
+}
+
+const char *suggest_record(SuggestTrie *t, const char *line) {
+    if (!t || !line || !*line) return NULL;
+
+    // Walk (and extend) the path for line
+    uint32_t node = 0;
+    for (const unsigned char *p = (const unsigned char *)line; *p; p++) {
+        uint32_t next = find_child(t, node, *p);
+        if (next == NO_NODE) {
+            next = node_new(t, *p);
+            if (next == NO_NODE) return NULL;
+            t->nodes[next].sibling = t->nodes[node].child;
+            t->nodes[node].child = next;
+        }
+        node = next;
+    }
+
+    uint32_t e = t->nodes[node].entry;
+    if (e == NO_ENTRY) {
+        e = entry_new(t, line, node);
+        if (e == NO_ENTRY) return NULL;
+        t->nodes[node].entry = e;
+    }
+    t->entries[e].refs++;
+
+    t->tick += 1.0;
+    if (t->tick / FRECENCY_HALF_LIFE >= FRECENCY_RESCALE_EXP) rescale(t);
+    t->entries[e].score += exp2(t->tick / FRECENCY_HALF_LIFE);
+
+    // Scores only grow, so the entry just bumped is the only one that can
+    // take over a node along its own path.
+    double score = t->entries[e].score;
+    node = 0;
+    for (const unsigned char *p = (const unsigned char *)line;; p++) {
+        Node *n = &t->nodes[node];
+        if (n->best == NO_ENTRY || score >= t->entries[n->best].score) n->best = e;
+        if (!*p) break;
+        node = find_child(t, node, *p);
+    }
+    return t->entries[e].line;
+}
+
+void suggest_release(SuggestTrie *t, const char *line) {
+    if (!t || !line || !*line) return;
+
+    // Path for line, root first
+    size_t len = strlen(line);
+    uint32_t *path = xmalloc(ALLOC_HISTORY, (len + 1) * sizeof(uint32_t));
+    if (!path) return;
+    path[0] = 0;
+    for (size_t i = 0; i < len; i++) {
+        path[i + 1] = find_child(t, path[i], (unsigned char)line[i]);
+        if (path[i + 1] == NO_NODE) {
+            xfree(path);
+            return;
+        }
+    }
+    uint32_t e = t->nodes[path[len]].entry;
+    if (e == NO_ENTRY || --t->entries[e].refs > 0) {
+        xfree(path);
+        return;
+    }
+
+    xfree(t->entries[e].line);
+    t->entries[e].line = NULL;
+    t->entries[e].node = t->free_entry;
+    t->free_entry = e;
+    t->nodes[path[len]].entry = NO_ENTRY;
+
+    // Only nodes on the path could rank the entry best. Rank them again
+    // from their own entry and their children, deepest first, unlinking
+    // the ones left with nothing below them.
+    for (size_t i = len + 1; i-- > 0;) {
+        Node *n = &t->nodes[path[i]];
+        if (n->best != e) continue;
+        uint32_t best = n->entry;
+        for (uint32_t c = n->child; c != NO_NODE; c = t->nodes[c].sibling) {
+            uint32_t b = t->nodes[c].best;
+            if (best == NO_ENTRY || t->entries[b].score > t->entries[best].score) best = b;
+        }
+        n->best = best;
+        if (best != NO_ENTRY || i == 0) continue;
+        uint32_t *link = &t->nodes[path[i - 1]].child;
+        while (*link != path[i]) link = &t->nodes[*link].sibling;
+        *link = n->sibling;
+        n->sibling = t->free_node;
+        t->free_node = path[i];
+    }
+    xfree(path);
+}
+
+void suggest_reset(const SuggestTrie *t, SuggestCursor *cur) {
+    cur->node = t ? 0 : NO_NODE;
+    cur->depth = 0;
+}
+
+void suggest_step(const SuggestTrie *t, SuggestCursor *cur, char ch) {
+    cur->depth++;
+    if (cur->node == NO_NODE) return;
+    cur->node = find_child(t, cur->node, (unsigned char)ch);
+}
+
+const char *suggest_best(const SuggestTrie *t, const SuggestCursor *cur) {
+    if (!t || cur->node == NO_NODE || cur->depth == 0) return NULL;
+    uint32_t best = t->nodes[cur->node].best;
+    if (best == NO_ENTRY) return NULL;
+    return t->entries[best].line;
+}
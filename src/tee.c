@@ -0,0 +1,293 @@
+#define _GNU_SOURCE
+
+#include "tee.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TEE_MAX_OUTPUTS 32
+#define TEE_PIPE_SIZE (1 << 20)
+#define TEE_ROUNDS 64
+#define COPY_CHUNK 65536
+
+// One destination. Each round of input is duplicated into the output's own
+// pipe (mid) and spliced on to fd from there, so outputs drain at their own
+// pace until one falls a whole pipe behind.
+typedef struct {
+    const char *name;
+    int fd;
+    int mid[2];
+    size_t rounds[TEE_ROUNDS];  // bytes of each round still in mid, oldest first
+    int head, count;
+    size_t queued;
+    int copy;                   // fd refuses splice; write from a copy
+    int live;
+} Output;
+
+typedef struct {
+    Output outs[TEE_MAX_OUTPUTS];
+    int n;
+    int depth;                  // rounds a mid pipe can hold for certain
+    int status;
+    char *buf;
+    unsigned long long bytes, copied;
+} Tee;
+
+static int write_all(int fd, const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// An output whose reader left is dropped quietly; other failures count
+static void drop(Tee *t, Output *o, int err) {
+    if (err != EPIPE) {
+        fprintf(stderr, "minibash: tee: %s: %s\n", o->name, strerror(err));
+        t->status = 1;
+    }
+    o->live = 0;
+}
+
+static void consumed(Output *o, size_t n) {
+    o->queued -= n;
+    while (n > 0 && o->count > 0) {
+        size_t take = n < o->rounds[o->head] ? n : o->rounds[o->head];
+        o->rounds[o->head] -= take;
+        n -= take;
+        if (o->rounds[o->head] == 0) {
+            o->head = (o->head + 1) % TEE_ROUNDS;
+            o->count--;
+        }
+    }
+}
+
+// Move what is queued in o's pipe to its descriptor, until it would block
+static void drain(Tee *t, Output *o) {
+    while (o->live && o->queued > 0) {
+        ssize_t n;
+        if (!o->copy) {
+            n = splice(o->mid[0], NULL, o->fd, NULL, o->queued,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0 && errno == EINVAL) {
+                // Terminals and O_APPEND files on older kernels
+                o->copy = 1;
+                continue;
+            }
+        } else {
+            size_t want = o->queued < COPY_CHUNK ? o->queued : COPY_CHUNK;
+            n = read(o->mid[0], t->buf, want);
+            if (n > 0 && write_all(o->fd, t->buf, (size_t)n) != 0) n = -1;
+            if (n > 0) t->copied += (unsigned long long)n;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return;
+        if (n <= 0) {
+            drop(t, o, n < 0 ? errno : EIO);
+            return;
+        }
+        consumed(o, (size_t)n);
+    }
+}
+
+// Take the next round from in: tee(2) it into every live output's pipe but
+// the last, which gets it by splice(2), consuming it. Returns its size, 0 at
+// end of input, -1 with errno set.
+static ssize_t fill_round(Tee *t, int in) {
+    int last = -1;
+    for (int k = 0; k < t->n; k++) {
+        if (t->outs[k].live) last = k;
+    }
+    ssize_t len = -1;
+    for (int k = 0; k <= last; k++) {
+        Output *o = &t->outs[k];
+        if (!o->live) continue;
+        size_t want = len < 0 ? INT_MAX : (size_t)len;
+        ssize_t r = k == last
+            ? splice(in, NULL, o->mid[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+            : tee(in, o->mid[1], want, SPLICE_F_NONBLOCK);
+        if (len < 0) {
+            if (r <= 0) return r;
+            len = r;
+        } else if (r != len) {
+            // Cannot happen while depth holds; never hand on a torn stream
+            drop(t, o, r < 0 ? errno : EIO);
+        }
+    }
+    for (int k = 0; k <= last; k++) {
+        Output *o = &t->outs[k];
+        if (!o->live) continue;
+        o->rounds[(o->head + o->count) % TEE_ROUNDS] = (size_t)len;
+        o->count++;
+        o->queued += (size_t)len;
+    }
+    t->bytes += (unsigned long long)len;
+    return len;
+}
+
+static void run_spliced(Tee *t, int in) {
+    int eof = 0;
+    while (1) {
+        int live = 0, pending = 0, room = 1;
+        for (int k = 0; k < t->n; k++) {
+            Output *o = &t->outs[k];
+            if (!o->live) continue;
+            live++;
+            if (o->queued > 0) pending = 1;
+            if (o->count >= t->depth) room = 0;
+        }
+        if (live == 0 || (eof && !pending)) break;
+
+        // Input is only read while every output has room for another
+        // round, so the slowest consumer sets the pace
+        struct pollfd pfds[TEE_MAX_OUTPUTS + 1];
+        int map[TEE_MAX_OUTPUTS + 1], np = 0;
+        if (!eof && room) {
+            pfds[np] = (struct pollfd){.fd = in, .events = POLLIN};
+            map[np++] = -1;
+        }
+        for (int k = 0; k < t->n; k++) {
+            if (!t->outs[k].live || t->outs[k].queued == 0) continue;
+            pfds[np] = (struct pollfd){.fd = t->outs[k].fd, .events = POLLOUT};
+            map[np++] = k;
+        }
+        if (poll(pfds, np, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("minibash: tee: poll");
+            t->status = 1;
+            break;
+        }
+        for (int i = 0; i < np; i++) {
+            if (!pfds[i].revents) continue;
+            if (map[i] >= 0) {
+                drain(t, &t->outs[map[i]]);
+                continue;
+            }
+            ssize_t r = fill_round(t, in);
+            if (r == 0) {
+                eof = 1;
+            } else if (r < 0 && errno != EAGAIN && errno != EINTR) {
+                perror("minibash: tee");
+                t->status = 1;
+                eof = 1;
+            }
+        }
+    }
+}
+
+// Input that is not a pipe cannot be tee(2)d; copy it through user space
+static void run_copied(Tee *t) {
+    while (1) {
+        ssize_t n = read(STDIN_FILENO, t->buf, COPY_CHUNK);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror("minibash: tee");
+            t->status = 1;
+        }
+        if (n <= 0) break;
+        int live = 0;
+        for (int k = 0; k < t->n; k++) {
+            Output *o = &t->outs[k];
+            if (!o->live) continue;
+            if (write_all(o->fd, t->buf, (size_t)n) != 0) {
+                drop(t, o, errno);
+                continue;
+            }
+            live++;
+        }
+        t->bytes += (unsigned long long)n;
+        t->copied += (unsigned long long)n * (unsigned long long)live;
+        if (live == 0) break;
+    }
+}
+
+int builtin_tee(int argc, char **argv) {
+    int append = 0, i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-a") != 0) {
+            fprintf(stderr, "minibash: tee: usage: tee [-a] [file...]\n");
+            return 1;
+        }
+        append = 1;
+    }
+    if (argc - i + 1 > TEE_MAX_OUTPUTS) {
+        fprintf(stderr, "minibash: tee: at most %d files\n", TEE_MAX_OUTPUTS - 1);
+        return 1;
+    }
+
+    Tee *t = calloc(1, sizeof(Tee));
+    if (!t || !(t->buf = malloc(COPY_CHUNK))) {
+        perror("minibash: tee");
+        free(t);
+        return 1;
+    }
+    t->outs[t->n++] = (Output){.name = "standard output", .fd = STDOUT_FILENO, .mid = {-1, -1}, .live = 1};
+    for (; i < argc; i++) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+        int fd = open(argv[i], flags, 0644);
+        if (fd == -1) {
+            fprintf(stderr, "minibash: tee: %s: %s\n", argv[i], strerror(errno));
+            t->status = 1;
+            continue;
+        }
+        t->outs[t->n++] = (Output){.name = argv[i], .fd = fd, .mid = {-1, -1}, .live = 1};
+    }
+
+    struct stat st;
+    int piped = fstat(STDIN_FILENO, &st) == 0 && S_ISFIFO(st.st_mode);
+    int in_size = piped ? fcntl(STDIN_FILENO, F_GETPIPE_SZ) : -1;
+    t->depth = in_size > 0 ? TEE_ROUNDS : 0;
+    for (int k = 0; k < t->n && t->depth > 0; k++) {
+        Output *o = &t->outs[k];
+        if (pipe2(o->mid, O_CLOEXEC | O_NONBLOCK) == -1) {
+            t->depth = 0;
+            break;
+        }
+        if (fcntl(o->mid[1], F_SETPIPE_SZ, TEE_PIPE_SIZE) == -1) {
+            fcntl(o->mid[1], F_SETPIPE_SZ, in_size);
+        }
+        int depth = fcntl(o->mid[1], F_GETPIPE_SZ) / in_size;
+        if (depth < t->depth) t->depth = depth;
+    }
+
+    // A reader going away shows up as EPIPE instead of killing the shell
+    struct sigaction ign = {0}, old;
+    ign.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ign, &old);
+    fflush(stdout);
+    if (t->depth > 0) run_spliced(t, STDIN_FILENO);
+    else run_copied(t);
+    sigaction(SIGPIPE, &old, NULL);
+
+    for (int k = 0; k < t->n; k++) {
+        Output *o = &t->outs[k];
+        if (o->fd != STDOUT_FILENO) close(o->fd);
+        if (o->mid[0] >= 0) close(o->mid[0]);
+        if (o->mid[1] >= 0) close(o->mid[1]);
+    }
+    stats_add("tee.runs", 1);
+    stats_add("tee.bytes", t->bytes);
+    stats_add("tee.copied", t->copied);
+
+    int status = t->status;
+    free(t->buf);
+    free(t);
+    return status;
+}
@@ -0,0 +1,295 @@
+#define _GNU_SOURCE
+
+#include "xargs.h"
+#include "reap.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define READ_BLOCK (1 << 20)
+// execve() refuses more than 3/4 of the default 8 MB stack limit whatever
+// _SC_ARG_MAX says, and any single string over 32 pages
+#define KERNEL_ARG_CAP (6 << 20)
+#define ARG_STRLEN_MAX (32 * 4096)
+#define ARG_HEADROOM 2048
+
+extern char **environ;
+
+// Running batches, in the order they were started
+typedef struct {
+    pid_t pid;
+    int pidfd;
+} Child;
+
+typedef struct {
+    // argv[0..fixed) is the command and initial args; the batch follows
+    char **argv;
+    int argc, cap, fixed;
+    char *strs;         // batch strings, never more than limit bytes
+    size_t used;
+    size_t space;       // argument space of the batch as execve counts it
+    size_t limit;
+    long max_args;
+    Child *children;
+    struct pollfd *pfds;
+    int nchildren, procs;
+    int status;
+    int stop;
+    unsigned long execs, args;
+} Xargs;
+
+static size_t arg_cost(size_t len) {
+    return len + 1 + sizeof(char *);
+}
+
+// Argument space left for the command line once the environment is in
+static size_t arg_limit(void) {
+    long max = sysconf(_SC_ARG_MAX);
+    size_t limit = max > 0 ? (size_t)max : 131072;
+    if (limit > KERNEL_ARG_CAP) limit = KERNEL_ARG_CAP;
+    size_t env = sizeof(char *);
+    for (char **e = environ; *e; e++) env += arg_cost(strlen(*e));
+    return limit > env + ARG_HEADROOM ? limit - env - ARG_HEADROOM : 0;
+}
+
+static void set_status(Xargs *x, int code) {
+    if (code > x->status) x->status = code;
+}
+
+static void note_exit(Xargs *x, int wstatus) {
+    if (WIFSIGNALED(wstatus)) {
+        fprintf(stderr, "minibash: xargs: %s: terminated by signal %d\n",
+                x->argv[0], WTERMSIG(wstatus));
+        set_status(x, 125);
+        x->stop = 1;
+    } else if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 255) {
+        fprintf(stderr, "minibash: xargs: %s: exited with status 255; aborting\n", x->argv[0]);
+        set_status(x, 124);
+        x->stop = 1;
+    } else if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) != 0) {
+        set_status(x, 123);
+    }
+}
+
+// Wait for one running batch to finish
+static void reap_child(Xargs *x) {
+    int idx = 0, wstatus = 0, polled = 1;
+    for (int i = 0; i < x->nchildren; i++) {
+        x->pfds[i].fd = x->children[i].pidfd;
+        x->pfds[i].events = POLLIN;
+        if (x->children[i].pidfd < 0) polled = 0;
+    }
+    // Without pidfds, wait for the oldest
+    if (polled && x->nchildren > 1) {
+        int r;
+        while ((r = poll(x->pfds, x->nchildren, -1)) == -1 && errno == EINTR) {
+        }
+        for (int i = 0; i < x->nchildren && r > 0; i++) {
+            if (x->pfds[i].revents) {
+                idx = i;
+                break;
+            }
+        }
+    }
+    Child *c = &x->children[idx];
+    while (waitpid(c->pid, &wstatus, 0) == -1) {
+        if (errno != EINTR) {
+            perror("minibash: xargs: waitpid");
+            break;
+        }
+    }
+    note_exit(x, wstatus);
+    if (c->pidfd >= 0) close(c->pidfd);
+    // Keep start order, so slot 0 stays the oldest
+    x->nchildren--;
+    memmove(c, c + 1, (size_t)(x->nchildren - idx) * sizeof(Child));
+}
+
+static void spawn_batch(Xargs *x) {
+    if (x->argc == x->fixed) return;
+    if (x->nchildren == x->procs) reap_child(x);
+    if (x->stop) return;
+
+    x->argv[x->argc] = NULL;
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    pid_t pid;
+    int rc = posix_spawnp(&pid, x->argv[0], &fa, NULL, x->argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    if (rc != 0) {
+        fprintf(stderr, "minibash: xargs: %s: %s\n", x->argv[0], strerror(rc));
+        set_status(x, rc == ENOENT ? 127 : 126);
+        x->stop = 1;
+    } else {
+        x->children[x->nchildren].pid = pid;
+        x->children[x->nchildren].pidfd = reap_pidfd(pid);
+        x->nchildren++;
+        x->execs++;
+        x->args += (unsigned long)(x->argc - x->fixed);
+    }
+    x->argc = x->fixed;
+    x->used = 0;
+    x->space = 0;
+}
+
+static void add_arg(Xargs *x, const char *s, size_t len) {
+    size_t cost = arg_cost(len);
+    if (x->argc > x->fixed &&
+        (x->space + cost > x->limit ||
+         (x->max_args > 0 && x->argc - x->fixed >= x->max_args))) {
+        spawn_batch(x);
+    }
+    if (x->stop) return;
+    if (cost > x->limit || len >= ARG_STRLEN_MAX) {
+        fprintf(stderr, "minibash: xargs: argument line too long\n");
+        set_status(x, 1);
+        x->stop = 1;
+        return;
+    }
+    if (x->argc + 1 >= x->cap) {
+        char **tmp = realloc(x->argv, (size_t)x->cap * 2 * sizeof(char *));
+        if (!tmp) {
+            perror("minibash: xargs");
+            set_status(x, 1);
+            x->stop = 1;
+            return;
+        }
+        x->argv = tmp;
+        x->cap *= 2;
+    }
+    char *dst = x->strs + x->used;
+    memcpy(dst, s, len);
+    dst[len] = '\0';
+    x->used += len + 1;
+    x->space += cost;
+    x->argv[x->argc++] = dst;
+}
+
+static int parse_count(const char *s, long *out) {
+    char *end;
+    if (!s) return -1;
+    *out = strtol(s, &end, 10);
+    return *end || end == s || *out < 0 ? -1 : 0;
+}
+
+static int usage(void) {
+    fprintf(stderr, "minibash: xargs: usage: xargs [-0] [-n max-args] [-P procs] [command [initial-args...]]\n");
+    return 1;
+}
+
+int builtin_xargs(int argc, char **argv) {
+    char delim = '\n';
+    long max_args = 0, procs = 1;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(argv[i], "-0") == 0) {
+            delim = '\0';
+        } else if (argv[i][1] == 'n' || argv[i][1] == 'P') {
+            long *dst = argv[i][1] == 'n' ? &max_args : &procs;
+            const char *n = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : NULL);
+            if (parse_count(n, dst) != 0) return usage();
+        } else {
+            return usage();
+        }
+    }
+    if (procs == 0) procs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (procs <= 0) procs = 1;
+
+    Xargs x = {0};
+    x.max_args = max_args;
+    x.procs = (int)procs;
+    x.fixed = argc > i ? argc - i : 1;
+    x.cap = x.fixed + 64;
+    x.argv = malloc((size_t)x.cap * sizeof(char *));
+    x.children = malloc((size_t)x.procs * sizeof(Child));
+    x.pfds = malloc((size_t)x.procs * sizeof(struct pollfd));
+    char *buf = malloc(READ_BLOCK);
+    if (!x.argv || !x.children || !x.pfds || !buf) {
+        perror("minibash: xargs");
+        x.status = 1;
+        goto out;
+    }
+
+    // The command and initial args take their share of the space too
+    size_t limit = arg_limit(), fixed_space = sizeof(char *);
+    if (argc > i) {
+        for (int k = 0; k < x.fixed; k++) {
+            x.argv[k] = argv[i + k];
+            fixed_space += arg_cost(strlen(argv[i + k]));
+        }
+    } else {
+        x.argv[0] = "echo";
+        fixed_space += arg_cost(4);
+    }
+    x.argc = x.fixed;
+    if (limit <= fixed_space) {
+        fprintf(stderr, "minibash: xargs: environment leaves no room for arguments\n");
+        x.status = 1;
+        goto out;
+    }
+    x.limit = limit - fixed_space;
+    x.strs = malloc(x.limit);
+    if (!x.strs) {
+        perror("minibash: xargs");
+        x.status = 1;
+        goto out;
+    }
+
+    fflush(stdout);
+    size_t have = 0;
+    int eof = 0;
+    while (!x.stop && !eof) {
+        ssize_t n = read(STDIN_FILENO, buf + have, READ_BLOCK - have);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror("minibash: xargs");
+            set_status(&x, 1);
+            break;
+        }
+        if (n == 0) eof = 1;
+        have += (size_t)n;
+
+        char *p = buf, *end = buf + have, *e;
+        while (!x.stop && (e = memchr(p, delim, (size_t)(end - p)))) {
+            if (e > p) add_arg(&x, p, (size_t)(e - p));
+            p = e + 1;
+        }
+        if (eof && !x.stop && p < end) {
+            add_arg(&x, p, (size_t)(end - p));
+            p = end;
+        }
+        have = (size_t)(end - p);
+        if (have == READ_BLOCK) {
+            fprintf(stderr, "minibash: xargs: argument line too long\n");
+            set_status(&x, 1);
+            break;
+        }
+        memmove(buf, p, have);
+    }
+    if (!x.stop) spawn_batch(&x);
+    while (x.nchildren > 0) reap_child(&x);
+
+    stats_add("xargs.runs", 1);
+    stats_add("xargs.execs", x.execs);
+    stats_add("xargs.args", x.args);
+
+out:
+    free(buf);
+    free(x.strs);
+    free(x.pfds);
+    free(x.children);
+    free(x.argv);
+    return x.status;
+}
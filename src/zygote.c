@@ -0,0 +1,375 @@
+#define _GNU_SOURCE
+
+#include "zygote.h"
+#include "redir.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define ZYGOTE_MSG_MAX (128 * 1024)
+#define ZYGOTE_FDS_MAX (REDIR_SLOTS + 1)   // working directory, then slot sources
+
+#define ZYGOTE_TAKE_TTY 1
+
+enum { MSG_SPAWNED, MSG_EXITED };
+
+typedef struct {
+    uint32_t argc;
+    uint32_t envc;
+    int32_t pgid;
+    uint32_t flags;
+    uint32_t nslots;
+    int32_t slots[REDIR_SLOTS];     // target, or -1 - target to close it
+    // followed by argc + envc NUL-terminated strings
+} SpawnRequest;
+
+typedef struct {
+    int32_t type;
+    int32_t pid;        // -errno for a failed spawn
+    int32_t status;
+} ZygoteMsg;
+
+extern char **environ;
+
+static struct {
+    int fd;
+    pid_t pid;
+    ZygoteMsg *pending;     // exits read while waiting for a spawn reply
+    int npending, cap;
+} zygote = {.fd = -1};
+
+// ---- helper process ----
+
+static void send_msg(int sock, int type, pid_t pid, int status) {
+    ZygoteMsg m = {.type = type, .pid = pid, .status = status};
+    ssize_t w = send(sock, &m, sizeof(m), MSG_NOSIGNAL);
+    (void)w;
+}
+
+static void spawn_child(int sock, int sfd, char **argv, char **envp, int cwd,
+                        const RedirPlan *plan, pid_t pgid, uint32_t flags) {
+    close(sock);
+    close(sfd);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    if (fchdir(cwd) == -1) {
+        perror("minibash: chdir");
+        _exit(EXIT_FAILURE);
+    }
+    close(cwd);
+    if (pgid >= 0) {
+        setpgid(0, pgid);
+        // fd 0 is still the terminal the shell started on
+        if (flags & ZYGOTE_TAKE_TTY) {
+            sigset_t ttou, old;
+            sigemptyset(&ttou);
+            sigaddset(&ttou, SIGTTOU);
+            sigprocmask(SIG_BLOCK, &ttou, &old);
+            tcsetpgrp(STDIN_FILENO, getpgrp());
+            sigprocmask(SIG_SETMASK, &old, NULL);
+        }
+    }
+    // The received descriptors are close-on-exec; only the targets stay
+    if (redir_apply(plan) != 0) _exit(EXIT_FAILURE);
+
+    environ = envp;
+    execvp(argv[0], argv);
+    perror("execvp");
+    _exit(EXIT_FAILURE);
+}
+
+static void handle_request(int sock, int sfd, char *buf, ssize_t len,
+                           const int *fds, int nfds) {
+    SpawnRequest req;
+    if ((size_t)len < sizeof(req)) {
+        send_msg(sock, MSG_SPAWNED, -EINVAL, 0);
+        return;
+    }
+    memcpy(&req, buf, sizeof(req));
+    if (req.argc == 0 || req.nslots > REDIR_SLOTS) {
+        send_msg(sock, MSG_SPAWNED, -EINVAL, 0);
+        return;
+    }
+
+    // One received descriptor per slot that is not closed, after the cwd
+    RedirPlan plan = {.nslots = (int)req.nslots};
+    int used = 1, open_slots = 0;
+    for (uint32_t i = 0; i < req.nslots; i++) {
+        int32_t t = req.slots[i];
+        int source = -1;
+        if (t >= 0 && ++open_slots < nfds) source = fds[used++];
+        plan.slots[i] = (RedirSlot){t >= 0 ? t : -1 - t, source, 1};
+    }
+    if (open_slots + 1 != nfds) {
+        send_msg(sock, MSG_SPAWNED, -EINVAL, 0);
+        return;
+    }
+    size_t nstr = (size_t)req.argc + req.envc;
+    char **strs = calloc(nstr + 2, sizeof(char *));
+    if (!strs) {
+        send_msg(sock, MSG_SPAWNED, -ENOMEM, 0);
+        return;
+    }
+
+    // argv in strs[0..argc), NULL, envp in strs[argc+1..], NULL
+    char *p = buf + sizeof(req), *end = buf + len;
+    for (size_t i = 0; i < nstr; i++) {
+        char *nul = p < end ? memchr(p, '\0', (size_t)(end - p)) : NULL;
+        if (!nul) {
+            free(strs);
+            send_msg(sock, MSG_SPAWNED, -EINVAL, 0);
+            return;
+        }
+        strs[i < req.argc ? i : i + 1] = p;
+        p = nul + 1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        spawn_child(sock, sfd, strs, strs + req.argc + 1, fds[0], &plan, req.pgid, req.flags);
+    }
+    if (pid > 0 && req.pgid >= 0) {
+        // Also from here, so the group exists before the shell hears back
+        setpgid(pid, req.pgid ? req.pgid : pid);
+    }
+    send_msg(sock, MSG_SPAWNED, pid > 0 ? pid : -errno, 0);
+    free(strs);
+}
+
+static void zygote_main(int sock, pid_t shell) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != shell) _exit(0);
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, NULL);
+    int sfd = signalfd(-1, &chld, SFD_CLOEXEC | SFD_NONBLOCK);
+    char *buf = malloc(ZYGOTE_MSG_MAX);
+    if (sfd == -1 || !buf) _exit(1);
+
+    struct pollfd pfds[2] = {{.fd = sock, .events = POLLIN}, {.fd = sfd, .events = POLLIN}};
+    while (1) {
+        if (poll(pfds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            _exit(1);
+        }
+        if (pfds[1].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            while (read(sfd, &si, sizeof(si)) > 0) {
+            }
+            int wstatus;
+            pid_t pid;
+            while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+                send_msg(sock, MSG_EXITED, pid, wstatus);
+            }
+        }
+        if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            union {
+                struct cmsghdr align;
+                char buf[CMSG_SPACE(ZYGOTE_FDS_MAX * sizeof(int))];
+            } control;
+            struct iovec iov = {.iov_base = buf, .iov_len = ZYGOTE_MSG_MAX};
+            struct msghdr msg = {0};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control.buf;
+            msg.msg_controllen = sizeof(control.buf);
+            ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+            if (n == 0 || (n == -1 && errno != EINTR)) _exit(0);
+            if (n == -1) continue;
+
+            struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+            int fds[ZYGOTE_FDS_MAX];
+            int nfds = 0;
+            if (cm && cm->cmsg_type == SCM_RIGHTS) {
+                nfds = (int)((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+                memcpy(fds, CMSG_DATA(cm), (size_t)nfds * sizeof(int));
+            }
+            if (nfds == 0 || (msg.msg_flags & MSG_CTRUNC)) {
+                send_msg(sock, MSG_SPAWNED, -EINVAL, 0);
+            } else {
+                handle_request(sock, sfd, buf, n, fds, nfds);
+            }
+            for (int i = 0; i < nfds; i++) close(fds[i]);
+        }
+    }
+}
+
+// ---- shell side ----
+
+int zygote_start(void) {
+    if (zygote.fd != -1) return 0;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) return -1;
+    pid_t shell = getpid();
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        zygote_main(sv[1], shell);
+        _exit(0);
+    }
+    close(sv[1]);
+    zygote.fd = sv[0];
+    zygote.pid = pid;
+    return 0;
+}
+
+void zygote_stop(void) {
+    if (zygote.fd == -1) return;
+    close(zygote.fd);
+    zygote.fd = -1;
+    waitpid(zygote.pid, NULL, 0);
+    free(zygote.pending);
+    zygote.pending = NULL;
+    zygote.npending = zygote.cap = 0;
+}
+
+int zygote_active(void) {
+    return zygote.fd != -1;
+}
+
+int zygote_fd(void) {
+    return zygote.fd;
+}
+
+static int queue_exit(const ZygoteMsg *m) {
+    if (zygote.npending == zygote.cap) {
+        int cap = zygote.cap ? zygote.cap * 2 : 16;
+        ZygoteMsg *tmp = realloc(zygote.pending, (size_t)cap * sizeof(ZygoteMsg));
+        if (!tmp) return -1;
+        zygote.pending = tmp;
+        zygote.cap = cap;
+    }
+    zygote.pending[zygote.npending++] = *m;
+    return 0;
+}
+
+// One message from the zygote: 1 if read, 0 if none available, -1 if it died
+static int recv_msg(ZygoteMsg *m, int block) {
+    while (1) {
+        ssize_t n = recv(zygote.fd, m, sizeof(*m), block ? 0 : MSG_DONTWAIT);
+        if (n == (ssize_t)sizeof(*m)) return 1;
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        zygote_stop();
+        return -1;
+    }
+}
+
+pid_t zygote_spawn(char *const argv[], const RedirPlan *plan, pid_t pgid, int take_tty) {
+    if (zygote.fd == -1 || !argv[0]) return -1;
+
+    SpawnRequest req = {.pgid = pgid, .flags = take_tty ? ZYGOTE_TAKE_TTY : 0};
+    int sent[ZYGOTE_FDS_MAX];
+    int nsent = 1;
+    req.nslots = (uint32_t)plan->nslots;
+    for (int i = 0; i < plan->nslots; i++) {
+        const RedirSlot *s = &plan->slots[i];
+        req.slots[i] = s->source >= 0 ? s->target : -1 - s->target;
+        if (s->source >= 0) sent[nsent++] = s->source;
+    }
+    size_t len = sizeof(req);
+    for (char *const *a = argv; *a; a++, req.argc++) len += strlen(*a) + 1;
+    for (char **e = environ; e && *e; e++, req.envc++) len += strlen(*e) + 1;
+    if (len > ZYGOTE_MSG_MAX) return -1;
+
+    char *buf = malloc(len);
+    if (!buf) return -1;
+    memcpy(buf, &req, sizeof(req));
+    char *p = buf + sizeof(req);
+    for (char *const *a = argv; *a; a++) p = stpcpy(p, *a) + 1;
+    for (char **e = environ; e && *e; e++) p = stpcpy(p, *e) + 1;
+
+    int cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (cwd == -1) {
+        free(buf);
+        return -1;
+    }
+    sent[0] = cwd;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(ZYGOTE_FDS_MAX * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = {.iov_base = buf, .iov_len = len};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE((size_t)nsent * sizeof(int));
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN((size_t)nsent * sizeof(int));
+    memcpy(CMSG_DATA(cm), sent, (size_t)nsent * sizeof(int));
+
+    ssize_t n;
+    do {
+        n = sendmsg(zygote.fd, &msg, MSG_NOSIGNAL);
+    } while (n == -1 && errno == EINTR);
+    close(cwd);
+    free(buf);
+    if (n != (ssize_t)len) {
+        if (n == -1 && errno == EMSGSIZE) return -1;
+        zygote_stop();
+        return -1;
+    }
+
+    ZygoteMsg m;
+    while (recv_msg(&m, 1) == 1) {
+        if (m.type == MSG_SPAWNED) {
+            if (m.pid < 0) {
+                errno = -m.pid;
+                return -1;
+            }
+            return m.pid;
+        }
+        if (queue_exit(&m) != 0) break;
+    }
+    return -1;
+}
+
+pid_t zygote_next_exit(int *wstatus, int block) {
+    if (zygote.npending > 0) {
+        ZygoteMsg m = zygote.pending[0];
+        zygote.npending--;
+        memmove(zygote.pending, zygote.pending + 1, (size_t)zygote.npending * sizeof(ZygoteMsg));
+        *wstatus = m.status;
+        return m.pid;
+    }
+    if (zygote.fd == -1) return -1;
+    ZygoteMsg m;
+    int r;
+    while ((r = recv_msg(&m, block)) == 1) {
+        if (m.type == MSG_EXITED) {
+            *wstatus = m.status;
+            return m.pid;
+        }
+    }
+    return r;
+}